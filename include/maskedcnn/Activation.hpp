@@ -8,14 +8,24 @@ class Activation
 public:
     virtual void activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) = 0;
     virtual void activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) = 0;
+    // y = f(x) without the derivative, for inference; y may be x
+    virtual void forward(const float *x, float *y, int num) = 0;
+
+    // activate() split over the thread pool
+    void activateParallel(const float *x, float *y, float *delta, int num);
 };
 
+// Inference epilogue of a layer: y = f(x + bias[r]) over rows of `columns` values, in chunks small
+// enough that the activation reads what the bias pass just wrote from L1. bias may be null, y may be x.
+void biasActivate(Activation& activation, const float *bias, int rows, int columns, const float *x, float *y);
+
 
 class ReLu : public Activation
 {
 public:
     virtual void activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
     virtual void activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
+    virtual void forward(const float *x, float *y, int num) override;
 };
 
 class Sigmoid : public Activation
@@ -23,6 +33,7 @@ class Sigmoid : public Activation
 public:
     virtual void activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
     virtual void activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
+    virtual void forward(const float *x, float *y, int num) override;
 };
 
 class Tanh : public Activation
@@ -30,6 +41,7 @@ class Tanh : public Activation
 public:
     virtual void activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
     virtual void activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
+    virtual void forward(const float *x, float *y, int num) override;
 };
 
 class Id : public Activation
@@ -37,6 +49,7 @@ class Id : public Activation
 public:
     virtual void activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
     virtual void activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num) override;
+    virtual void forward(const float *x, float *y, int num) override;
 };
 
 }
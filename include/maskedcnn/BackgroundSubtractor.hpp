@@ -0,0 +1,43 @@
+#pragma once
+#include "MaskGenerator.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Keeps a running average of the frames as the background, each frame moving it by
+// 1 / 2^learningShift. Pixels differing from the background by more than the threshold are
+// foreground. Noise averages out of the background instead of triggering recomputation, and
+// lighting drift is absorbed. The mask holds this and the last frame's foreground, so the
+// places a moving object left are recomputed too.
+class BackgroundSubtractor : public MaskGenerator
+{
+public:
+    explicit BackgroundSubtractor(int threshold = 30, int learningShift = 5);
+
+    virtual void setThreshold(int threshold) override;
+    int threshold() const { return limit; }
+    int learningShift() const { return shift; }
+
+    virtual const BitMask& detect(const cv::Mat &frame) override;
+    virtual void setReference(const cv::Mat &frame) override;
+    virtual const BitMask& mask() const override { return changed; }
+    const BitMask& foreground() const { return current; }
+
+    virtual std::unique_ptr<MaskGenerator> clone() const override;
+    virtual std::string name() const override { return "background"; }
+
+private:
+    int limit;
+    int shift;
+    int height = 0;
+    int width = 0;
+
+    std::vector<uint16_t> background; // BGR, 8.8 fixed point
+    BitMask current;
+    BitMask previous;
+    BitMask changed;
+};
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "Network.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Collects frames from several camera streams and runs them through one network as batches.
+// Stream i always takes batch slot i, so its cached activations of the last frame stay in
+// plane i of every layer, and the changed patches of all streams share each layer's GEMM.
+// A batch is run once every stream has a frame waiting or the oldest waiting frame is maxWait
+// old; streams without a new frame get an empty mask and cost nothing.
+// Masks have to be enabled on the network for the frames to be computed incrementally.
+// An exception of the network or the callback stops the scheduler; submit() rethrows it from then on.
+class BatchScheduler
+{
+public:
+    // Called from the scheduler thread with the class map of every frame that was run
+    using Callback = std::function<void(int stream, const Tensor<float>& classes)>;
+
+    BatchScheduler(Network& network, int streams, std::chrono::microseconds maxWait, Callback callback);
+    // Runs the frames still waiting, then stops; after a failure they are dropped
+    ~BatchScheduler();
+
+    BatchScheduler(const BatchScheduler&) = delete;
+    BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+    // Queues a frame of a stream; a frame of the same stream still waiting is dropped, the mask of
+    // the new one is taken against the last frame that was run. Throws for an empty frame.
+    void submit(int stream, const cv::Mat& frame);
+
+    int streamCount() const { return pending.size(); }
+    size_t batchesRun() const;
+    size_t framesRun() const;
+    size_t framesDropped() const;
+
+private:
+    void run();
+
+    Network& network;
+    const std::chrono::microseconds maxWait;
+    Callback callback;
+
+    std::vector<cv::Mat> pending; // empty where a stream has nothing waiting
+    int pendingCount = 0;
+    std::chrono::steady_clock::time_point oldestPending;
+
+    size_t batches = 0;
+    size_t frames = 0;
+    size_t dropped = 0;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::exception_ptr error; // that stopped the scheduler thread
+    std::thread worker;
+};
+
+}
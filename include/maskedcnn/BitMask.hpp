@@ -0,0 +1,134 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "Tensor.hpp"
+
+namespace MaskedCNN
+{
+
+// Binary change mask, one bit per pixel. Every row starts on a fresh 64-bit word,
+// bits past the width are always zero. A batch stacks the frames' planes: row y of frame n
+// is row n * height() + y, so rows, runs and indices cover all frames in one sweep.
+class BitMask
+{
+public:
+    BitMask();
+    BitMask(int height, int width, int batch = 1);
+    explicit BitMask(const Tensor<float>& mask); // [H, W] or [N, H, W]; non-zero pixels are set
+
+    void resize(int height, int width, int batch = 1);
+    void assign(const Tensor<float>& mask); // as the constructor, reusing the storage
+    int height() const { return h; }
+    int width() const { return w; }
+    int batch() const { return n; }
+    int rows() const { return n * h; } // of all frames
+    int wordsPerRow() const { return words; }
+
+    bool test(int y, int x) const;
+    void set(int y, int x);
+    void reset(int y, int x);
+    void setRange(int y, int xBegin, int xEnd);
+    bool rowEmpty(int y) const;
+
+    uint64_t *row(int y) { return &bits[y * words]; }
+    const uint64_t *row(int y) const { return &bits[y * words]; }
+
+    void zero();
+    void fill();
+    void merge(const BitMask& other);
+
+    int count() const;
+    double howFilled() const;
+    bool sameShape(const BitMask& other) const;
+
+    // Output pixel of a convolution (or pooling) is set if any pixel of its window is set in prev
+    void convolveFrom(const BitMask& prev, int filterSize, int stride, int pad);
+    // Output pixel of a transposed convolution is set if any set pixel of prev reaches it
+    void deconvolveFrom(const BitMask& prev, int filterSize, int stride, int pad);
+    // Morphology with a (2 * radius + 1) square within each frame, radius < 64. Pixels past the
+    // border count as clear for dilation and as set for erosion, so neither shifts the edges.
+    void dilateFrom(const BitMask& prev, int radius);
+    void erodeFrom(const BitMask& prev, int radius);
+
+    // Row-major linear indices of the set pixels, n * height * width + y * width + x in a batch
+    int activeIndex(std::vector<int>& index) const;
+    // Calls f(begin, end) for every maximal run [begin, end) of set pixels in row y
+    template<typename F>
+    void forEachRun(int y, F f) const;
+    Tensor<float> toTensor() const; // [H, W], or [N, H, W] for a batch
+
+private:
+    template<typename Range>
+    void expandFrom(const BitMask& prev, Range range);
+    template<bool erode>
+    void morphologyFrom(const BitMask& prev, int radius);
+
+    int h = 0;
+    int w = 0;
+    int n = 1;
+    int words = 0;
+    std::vector<uint64_t> bits;
+    std::vector<uint64_t> rowBuffer;
+};
+
+template<typename F>
+void BitMask::forEachRun(int y, F f) const
+{
+    const uint64_t *r = row(y);
+    int begin = -1;
+    for (int i = 0; i < words; i++)
+    {
+        const uint64_t word = r[i];
+        int bit = 0;
+        while (bit < 64)
+        {
+            // Looking for the next set bit outside a run, the next clear one inside
+            const uint64_t rest = ((begin < 0) ? word : ~word) >> bit;
+            if (rest == 0)
+            {
+                break;
+            }
+            bit += __builtin_ctzll(rest);
+            if (begin < 0)
+            {
+                begin = i * 64 + bit;
+            }
+            else
+            {
+                f(begin, i * 64 + bit);
+                begin = -1;
+            }
+        }
+    }
+    if (begin >= 0)
+    {
+        f(begin, w);
+    }
+}
+
+// Occupancy of tileSize x tileSize blocks of a mask; a tile is occupied if any of its pixels is set.
+// The tile rows of a batch are stacked per frame like the mask rows.
+class TileMask
+{
+public:
+    TileMask(int tileSize = 8);
+
+    void build(const BitMask& mask);
+    void setTileSize(int tileSize);
+
+    int tileSize() const { return size; }
+    int tilesY() const { return rows; }
+    int tilesX() const { return cols; }
+    bool occupied(int ty, int tx) const { return tiles[ty * cols + tx] != 0; }
+
+    int count() const;
+    double howFilled() const;
+
+private:
+    int size;
+    int rows = 0;
+    int cols = 0;
+    std::vector<uint8_t> tiles;
+};
+
+}
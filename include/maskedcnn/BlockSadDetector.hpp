@@ -0,0 +1,46 @@
+#pragma once
+#include "MaskGenerator.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Marks whole blockSize x blockSize blocks by the sum of absolute BGR differences to the frame
+// the network last saw there. The reference of a block is only taken over when the block is
+// marked, so slow drift adds up until it crosses the threshold. A block is marked when its mean
+// difference per pixel exceeds the threshold, with hysteresis: half the threshold suffices for a
+// block marked the frame before or next to one above the full threshold. Isolated noisy pixels
+// average out within their block, while moving edges stay connected.
+class BlockSadDetector : public MaskGenerator
+{
+public:
+    explicit BlockSadDetector(int threshold = 0, int blockSize = 8);
+
+    virtual void setThreshold(int threshold) override;
+    int threshold() const { return high; }
+    int blockSize() const { return size; }
+
+    virtual const BitMask& detect(const cv::Mat &frame) override;
+    virtual void setReference(const cv::Mat &frame) override;
+    virtual const BitMask& mask() const override { return changed; }
+
+    virtual std::unique_ptr<MaskGenerator> clone() const override;
+    virtual std::string name() const override { return "block"; }
+
+private:
+    int high;
+    int size;
+    int blocksY = 0;
+    int blocksX = 0;
+
+    cv::Mat reference;
+    // Per block
+    std::vector<int> sad;
+    std::vector<int> area;
+    std::vector<uint8_t> marked;
+    std::vector<uint8_t> wasMarked; // the frame before
+    BitMask changed;
+};
+
+}
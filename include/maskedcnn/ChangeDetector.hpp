@@ -0,0 +1,48 @@
+#pragma once
+#include "MaskGenerator.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Change mask of one video stream. Per pixel the summed absolute BGR difference to the previous
+// frame accumulates until it exceeds the threshold; then the pixel is marked changed and its
+// accumulator starts over. The previous frame and the accumulators are kept in place, and one
+// pass over the frame (vectorized, spread over rows) updates both and writes the mask bits.
+// With downsample > 1 only one pixel of every downsample x downsample block is compared and the
+// block is marked as a whole, which is far cheaper at high resolutions.
+class ChangeDetector : public MaskGenerator
+{
+public:
+    explicit ChangeDetector(int threshold = 0, int downsample = 1);
+
+    virtual void setThreshold(int threshold) override;
+    int threshold() const { return limit; }
+    int downsample() const { return factor; }
+
+    virtual const BitMask& detect(const cv::Mat &frame) override;
+    virtual void setReference(const cv::Mat &frame) override;
+    virtual const BitMask& mask() const override { return changed; }
+
+    virtual std::unique_ptr<MaskGenerator> clone() const override;
+    virtual std::string name() const override { return "pixel"; }
+
+private:
+    void detectFull(const cv::Mat &frame);
+    void detectDownsampled(const cv::Mat &frame);
+
+    int limit;
+    int factor;
+    int height = 0;
+    int width = 0;
+
+    // At the compared pixels only: every pixel, or one per block
+    std::vector<uint8_t> previous;
+    std::vector<uint16_t> accumulated; // saturating; the threshold is capped below its maximum
+
+    BitMask sampled; // per block when downsampling
+    BitMask changed;
+};
+
+}
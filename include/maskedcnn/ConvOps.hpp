@@ -1,6 +1,9 @@
 #pragma once
 #include "Tensor.hpp"
+#include "TensorView.hpp"
 #include "Util.hpp"
+#include "BitMask.hpp"
+#include "PackedWeights.hpp"
 
 namespace MaskedCNN {
 
@@ -8,18 +11,49 @@ int rot180(int f, int filterSize);
 
 void convolution(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float>& out, int filterSize, int stride, int pad);
 void transposedConvolution(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float>& out, int filterSize, int stride, int pad);
-void im2col(const Tensor<float>& im, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col);
-int im2colMasked(const Tensor<float>& im, const Tensor<float>& mask, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col);
-void col2im(const Tensor<float>& col, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& im);
+void im2col(TensorView<const float> im, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col);
+int im2colMasked(TensorView<const float> im, const Tensor<float>& mask, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col);
+void col2im(const float *col, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, TensorView<float> im);
 void convolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& out, int filterSize, int stride, int pad);
 void transposedConvolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& out, int filterSize, int stride, int pad);
+// CPU versions multiplying with packed weights.
+// The CPU kernels take views: inputs gathered by im2col may be any view with contiguous rows
+// (crops, channel ranges); operands multiplied as they are, like the input of a pointwise or
+// transposed convolution and every dense output, need each channel to be one contiguous block.
+// Dense and indexed kernels also take [N, C, H, W] batches: dense ones run frame by frame,
+// indexed ones take indices n * H * W + y * W + x over the output planes of all frames (see
+// BitMask::activeIndex) and gather every frame's active patches into one GEMM. The transposed
+// convolution keeps the columns of all frames. The tile kernels are single frame.
+void convolutionIm2Col(TensorView<const float> input, const PackedWeights& filter, Tensor<float> &colBuffer, TensorView<float> out, int filterSize, int stride, int pad);
+void transposedConvolutionIm2Col(TensorView<const float> input, const PackedWeights& filter, Tensor<float> &colBuffer, TensorView<float> out, int filterSize, int stride, int pad);
 void convolutionIm2ColMasked(const Tensor<float>& input, const Tensor<float>& mask, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, Tensor<float>& out, int filterSize, int stride, int pad);
 void convolutionIm2ColMaskedPlaceBufferBack(const Tensor<float>& mask, Tensor<float> &outBuffer, Tensor<float>& out);
-void convolveMaskIm2Col(const Tensor<float>& prevMask, Tensor<float>& mask, Tensor<float>& colBuffer, int filterSize, int stride, int pad);
-void deconvolveMaskCol2Im(const Tensor<float>& prevMask, Tensor<float>& mask, Tensor<float>& colBuffer, int filterSize, int stride, int pad);
 void transposedConvolutionIm2ColMasked(const Tensor<float>& input, Tensor<float>& inputBuffer, const Tensor<float>& prevMask, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& out, int filterSize, int stride, int pad);
 void col2imMasked(const Tensor<float>& col, const Tensor<float>& prevMask, int patches, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& im);
 
+// Fused masked convolution: the active output pixels are listed once, only their patches are gathered
+// and multiplied, and results are scattered back by the same index
+int buildMaskIndex(const Tensor<float>& mask, std::vector<int>& index);
+void im2colIndexed(TensorView<const float> im, const std::vector<int>& index, int inputChannels, int inputHeight, int inputWidth, int outputWidth, int filterSize, int pad, int stride, float *col);
+void convolutionIm2ColIndexed(TensorView<const float> input, const std::vector<int>& index, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, int outputWidth, int filterSize, int stride, int pad);
+void scatterIndexed(const float *buffer, const std::vector<int>& index, int channels, int channelSize, float *out);
+void col2imIndexed(const Tensor<float>& col, const std::vector<int>& index, int channels, int height, int width, int filterSize, int pad, int stride, float *im);
+void transposedConvolutionIm2ColIndexed(const Tensor<float>& input, const std::vector<int>& inputIndex, const std::vector<int>& outputIndex, const Tensor<float>& filter, Tensor<float>& inputBuffer, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad);
+void transposedConvolutionIm2ColIndexed(TensorView<const float> input, const std::vector<int>& inputIndex, const std::vector<int>& outputIndex, const PackedWeights& filter, Tensor<float>& inputBuffer, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad);
+
+// Tile-sparse convolution: every output pixel of an occupied tile is computed, tile after tile and
+// row after row inside a tile, so patches are gathered as contiguous runs of the input rows.
+// The index lists the same pixels in the same order and is used for the scatter.
+int buildTileIndex(const TileMask& tiles, int outputHeight, int outputWidth, std::vector<int>& index);
+void im2colTiles(TensorView<const float> im, const TileMask& tiles, int patches, int inputChannels, int inputHeight, int inputWidth, int outputHeight, int outputWidth, int filterSize, int pad, int stride, float *col);
+void convolutionIm2ColTiles(TensorView<const float> input, const TileMask& tiles, int patches, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad);
+
+// Convolutions whose column matrix is the input itself and need no im2col: 1x1 kernels with unit
+// stride and no padding, and unpadded windows covering the whole input (FC layers as convolutions)
+bool isPointwiseConvolution(int inputHeight, int inputWidth, int filterSize, int stride, int pad);
+void convolutionPointwise(TensorView<const float> input, const PackedWeights& filter, TensorView<float> out);
+void convolutionPointwiseIndexed(TensorView<const float> input, const std::vector<int>& index, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer);
+
 
 
 }
@@ -2,9 +2,19 @@
 #include "Layer.hpp"
 #include "Activation.hpp"
 #include "Tensor.hpp"
+#include "PackedWeights.hpp"
 
 namespace MaskedCNN {
 
+// How the changed region of an incremental frame is computed: per active pixel, per active tile
+// (every pixel of a tile that has any active pixel), or the whole output. Auto picks from the fill.
+enum class SparseExecution
+{
+    Auto,
+    Pixel,
+    Tile,
+    Dense
+};
 
 class BaseConvolutionalLayer : public Layer
 {
@@ -13,10 +23,27 @@ public:
                        int filterSize, int pad, int filterDepth, int featureMaps, std::string name = "");
     BaseConvolutionalLayer(std::unique_ptr<Activation> activation, Tensor<float>&& weights,
                            Tensor<float>&& biases, int stride, int pad, std::string name = "");
-    virtual std::vector<int> getOutputDimensions() override;
+    virtual Shape getOutputDimensions() override;
     virtual int getNeuronInputNumber() const override;
 
+    int getStride() const { return stride; }
+    int getPad() const { return pad; }
+    const Activation& getActivation() const { return *activation; }
+    // Packed by packWeights(), or taken over as they are, e.g. from a model file
+    const PackedWeights& getPackedWeights() const { return packedWeights; }
+    virtual void usePackedWeights(PackedWeights&& weights);
+
+    void setSparseExecution(SparseExecution execution);
+    void setTileSize(int tileSize);
+    SparseExecution getLastExecution() const { return lastExecution; }
+
 protected:
+    void setInputDimensions(const Shape& dims);
+    // pixelFill: the share of the work a pixel-sparse pass does, of the output for a convolution
+    SparseExecution chooseExecution(double pixelFill);
+    // A sparse pass is charged per unit of the work it did, units of totalUnits
+    void measureExecution(double seconds, int units, int totalUnits);
+
     std::unique_ptr<Activation> activation;
     int pad;
     int stride;
@@ -24,11 +51,20 @@ protected:
     int filterDepth;
     int outputWidth, outputHeight, outputChannels;
     int inputWidth, inputHeight;
-    Tensor<float> colBuffer;
-    Tensor<float> outBuffer;
-    Tensor<float> maskColBuffer;
+    int batch = 1; // frames of an [N, C, H, W] input
+
+    PackedWeights packedWeights;
+    bool packed = false; // training repacks on every pass since the weights change, and leaves it false
 
-    std::vector<int> dimensions;
+    std::vector<int> activeIndex; // active output pixels of the current frame, of all frames in a batch
+
+    SparseExecution execution = SparseExecution::Auto;
+    SparseExecution lastExecution = SparseExecution::Dense;
+    TileMask tileMask;
+    Crossover tileCrossover; // crossover of tiled execution, measured on the occupied tile share
+    double tileDensityThreshold = 0.3; // active pixels per pixel of the occupied tiles needed for tiling
+
+    Shape dimensions;
 };
 
 class ConvolutionalLayer : public BaseConvolutionalLayer
@@ -40,9 +76,27 @@ public:
                            Tensor<float>&& biases, int stride, int pad, std::string name = "");
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
+    virtual void packWeights() override;
+
+    // 3x3 stride 1 layers with at least winogradMinChannels input channels use
+    // Winograd F(2x2, 3x3) for inference unless disabled
+    void setWinogradEnabled(bool enabled);
+    // Empty unless the layer uses Winograd
+    const Tensor<float>& getWinogradFilter() const { return winogradFilter; }
+    void useWinogradFilter(Tensor<float>&& filter);
+    // Transforms the Winograd filter if none was given before
+    virtual void usePackedWeights(PackedWeights&& weights) override;
 
 private:
-    void activateOutBuffer();
+    void activateProduct();
+    bool winogradShaped() const;
+
+    bool pointwise = false; // no im2col needed, see isPointwiseConvolution
+
+    static constexpr int winogradMinChannels = 32;
+    bool winogradEnabled = true;
+    Tensor<float> winogradFilter; // [16, outputChannels, inputChannels]
+    TileMask winogradTiles = TileMask(2);
 };
 
 class DeconvolutionalLayer : public BaseConvolutionalLayer
@@ -54,9 +108,11 @@ public:
                            Tensor<float>&& biases, int stride, int pad, std::string name = "");
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
+    virtual void packWeights() override;
 
 private:
-    Tensor<float> additionalBuffer;
+    Tensor<float> colBuffer; // columns of the last frame's input (of every frame in a batch), only kept while masks are enabled
+    std::vector<int> inputIndex; // changed input pixels of the current frame
 };
 
 }
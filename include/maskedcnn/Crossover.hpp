@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+
+namespace MaskedCNN
+{
+
+// Per-layer estimate of the fill ratio above which a dense pass is faster than a sparse one.
+// It is calibrated from the measured times of the passes the layer actually runs: the first
+// frame is always dense, the sparse cost is learned from the following incremental frames,
+// and both keep being smoothed so the estimate follows the machine load. A sparse estimate that
+// stops being measured ages towards sparse, so a few slow early passes can't keep a layer dense.
+class Crossover
+{
+public:
+    Crossover(double initialFill = 0.5);
+
+    void denseMeasured(double seconds);
+    // A sparse pass that computed `units` of the `totalUnits` a dense pass would have
+    void sparseMeasured(double seconds, int units, int totalUnits);
+
+    bool calibrated() const { return haveDense && haveSparse; }
+    double crossoverFill() const;
+    bool preferDense(double fill) const { return fill >= crossoverFill(); }
+
+private:
+    void smooth(double& estimate, bool& known, double value);
+
+    double initialFill;
+    double denseSeconds = 0;
+    double sparseSecondsPerFill = 0; // time of a sparse pass per unit of fill
+    bool haveDense = false;
+    bool haveSparse = false;
+    int densePasses = 0; // since the last measured sparse pass
+};
+
+class StopWatch
+{
+public:
+    StopWatch() : begin(std::chrono::steady_clock::now()) {}
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin;
+};
+
+}
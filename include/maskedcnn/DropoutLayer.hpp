@@ -12,8 +12,9 @@ public:
 
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
-    virtual std::vector<int> getOutputDimensions() override;
-    virtual Tensor<float> *getMask() override;
+    virtual Shape getOutputDimensions() override;
+    virtual BitMask *getMask() override;
+    double getDropProbability() const { return dropProbability; }
 
 
 private:
@@ -16,8 +16,9 @@ public:
                            Tensor<float>&& biases, std::string name = "");
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
-    virtual std::vector<int> getOutputDimensions() override;
+    virtual Shape getOutputDimensions() override;
     virtual int getNeuronInputNumber() const override;
+    const Activation& getActivation() const { return *activation; }
 
 private:
     std::unique_ptr<Activation> activation;
@@ -0,0 +1,25 @@
+#pragma once
+
+namespace MaskedCNN
+{
+
+// Single precision GEMM for the convolution kernels: C [m x n] = A [m x k] * B [k x n], all row-major.
+// Masked frames give GEMMs with a handful of output channels' worth of columns and a long k, where
+// BLAS spends most of its time packing and waking threads. Those go to an in-house register-blocked
+// kernel (AVX-512 or AVX2 when compiled for them) that reads A as it is and only packs the thin B;
+// larger shapes are left to BLAS.
+
+void sgemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+// Whether sgemm runs the shape with the in-house kernel
+bool smallGemmPreferred(int m, int n, int k);
+
+// The in-house kernel for any shape, e.g. to benchmark it against BLAS
+void smallGemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+// C [m x n] = op(A) [m x k] * op(B) [k x n] through BLAS. BLAS itself is kept single-threaded, so its
+// threads never compete with the pool: C is split into blocks of columns (or rows, when it is tall
+// and narrow), one BLAS call each, run on the pool.
+void blasSgemm(bool transA, bool transB, int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "Layer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Runs the forward pass of a layer graph in dependency order instead of vector order. Every layer
+// counts the bottoms it still waits for; the one finishing a layer's last bottom starts it. Of the
+// layers a finished one releases, its thread goes on with the first and hands the others to the
+// thread pool, so a chain runs on one thread with the pool to its kernels, and the branches of a
+// split or skip connection run at the same time.
+// Layers running at the same time must not share scratch, so every thread of a pass takes a
+// Workspace of its own from the executor and gives it to the layers it runs.
+class GraphExecutor
+{
+public:
+    // layers in an order where every bottom comes before its consumers, like the loader builds them
+    explicit GraphExecutor(const std::vector<std::unique_ptr<Layer>>& layers);
+
+    GraphExecutor(const GraphExecutor&) = delete;
+    GraphExecutor& operator=(const GraphExecutor&) = delete;
+
+    // forwardPropagate() of every layer. A throwing layer stops its consumers from running, the
+    // rest of the pass finishes and the exception is rethrown here.
+    void forward();
+
+    // Whether layer a is done whenever layer b starts, i.e. a is an ancestor of b
+    bool precedes(int a, int b) const { return ancestors[b][a]; }
+
+private:
+    void runFrom(int layer);
+    void launch(int layer);
+    int acquireWorkspace(std::shared_ptr<Workspace>& workspace);
+
+    std::vector<Layer*> layers;
+    std::vector<std::vector<int>> consumers;
+    std::vector<int> dependencies;
+    std::vector<std::vector<bool>> ancestors; // ancestors[b][a]
+    bool chain = true; // no layer has two consumers, so nothing can run concurrently
+
+    // State of the running pass
+    std::unique_ptr<std::atomic<int>[]> remaining;
+    std::vector<std::shared_ptr<Workspace>> workspaces;
+    std::vector<int> freeWorkspaces;
+    int running = 0;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+}
@@ -15,10 +15,12 @@ public:
 
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
-    virtual std::vector<int> getOutputDimensions() override;
+    virtual Shape getOutputDimensions() override;
 
-    void setInput(const Tensor<float> input);
-    void setMask(const Tensor<float> mask);
+    // [C, H, W], or [N, C, H, W] for a batch of frames with an [N, H, W] mask
+    void setInput(const Tensor<float>& input);
+    void setMask(const Tensor<float>& mask);
+    void setMask(const BitMask& mask);
 };
 
 }
@@ -3,7 +3,11 @@
 #include <memory>
 #include <string>
 #include "Tensor.hpp"
+#include "TensorView.hpp"
+#include "BitMask.hpp"
+#include "Crossover.hpp"
 #include "TrainingRegime.hpp"
+#include "Workspace.hpp"
 #include <opencv2/core/core.hpp>
 namespace MaskedCNN
 {
@@ -16,19 +20,33 @@ public:
     virtual ~Layer() = default;
     virtual void forwardPropagate() = 0;
     virtual void backwardPropagate() = 0;
-    virtual std::vector<int> getOutputDimensions() = 0;
+    virtual Shape getOutputDimensions() = 0;
     virtual int getNeuronInputNumber() const { return 0; }
+    // Lays the weights out for inference once they are final, e.g. after loading
+    virtual void packWeights() {}
     void addBottom(Layer *layer);
+    const std::vector<Layer*>& getBottoms() const { return bottoms; }
+
+    void setWorkspace(std::shared_ptr<Workspace> workspace);
+    // Makes the output a view of storage (large enough for it), or gives it its own storage again
+    void shareOutputStorage(Tensor<float>& storage);
+    void ownOutputStorage();
 
     std::string getName() const;
+    const Tensor<float>& getWeights() const { return weights; }
+    const Tensor<float>& getBiases() const { return biases; }
 
     virtual const Tensor<float> *getOutput();
     virtual Tensor<float> *getDelta();
-    virtual Tensor<float> *getMask();
+    virtual BitMask *getMask();
 
     void setTrainingMode(bool isTraining);
     void setMaskEnabled(bool maskEnabled);
 
+    void invalidateCache();
+    virtual long getCacheVersion() const;
+    double getCrossoverFill() const;
+
     void initializeWeightsStandardDistr();
     void initializeWeightsNormalDistrCorrectedVar();
 
@@ -41,6 +59,16 @@ public:
     std::pair<std::string, cv::Mat> displayMask();
 
 protected:
+    // Incremental inference: output keeps the values computed on earlier frames and only the
+    // masked region is recomputed. That is only valid if the cache was filled by a dense pass
+    // and none of the bottoms has been recomputed densely (got a new version) since.
+    bool cacheUsable() const;
+    void cacheUpdated(bool dense);
+
+    // delta, and z and dy/dz of layers with an activation, are only needed by backpropagation:
+    // shaped like the output in training mode, released otherwise
+    void updateTrainingBuffers(bool withActivation = true);
+
     std::string name;
     Tensor<float> z;
     Tensor<float> weights;
@@ -51,17 +79,26 @@ protected:
     Tensor<float> delta; //dE/dz
     Tensor<float> dy_dz;
 
-    Tensor<float> mask;
+    BitMask mask;
 
     int miniBatchSize;
     bool isTraining;
     bool initDone;
     bool maskEnabled = false;
 
+    // Masked layers pick dense or sparse execution per frame from the live fill
+    Crossover crossover;
+
+    bool cacheValid = false;
+    long cacheVersion = 0;
+    std::vector<long> bottomVersions;
+
     bool initCvWindow = false;
 
     std::unique_ptr<TrainingRegime> trainer;
     std::vector<Layer*> bottoms;
+
+    std::shared_ptr<Workspace> workspace = std::make_shared<Workspace>();
 };
 
 }
@@ -0,0 +1,41 @@
+#pragma once
+#include "BitMask.hpp"
+#include <opencv2/core/core.hpp>
+#include <memory>
+#include <string>
+
+namespace MaskedCNN
+{
+
+// Source of the change masks of one video stream: which pixels of a frame the network has to
+// recompute. Every stream needs its own instance, as generators keep state between frames.
+// Thresholds are in summed absolute BGR difference per pixel for all of them.
+class MaskGenerator
+{
+public:
+    virtual ~MaskGenerator() = default;
+
+    // Mask of a BGR frame against the frames before. The first frame, and one of another size,
+    // is only taken as the reference and gets an empty mask.
+    virtual const BitMask& detect(const cv::Mat &frame) = 0;
+    // Takes frame as the reference without a mask, dropping what was accumulated
+    virtual void setReference(const cv::Mat &frame) = 0;
+    virtual void setThreshold(int threshold) = 0;
+
+    // Of the last detect()
+    virtual const BitMask& mask() const = 0;
+    const TileMask& tiles(int tileSize);
+
+    // Same settings, without the state of the stream
+    virtual std::unique_ptr<MaskGenerator> clone() const = 0;
+    virtual std::string name() const = 0;
+
+private:
+    TileMask tileMask;
+};
+
+// One of "pixel" (ChangeDetector), "block" (BlockSadDetector), "background" (BackgroundSubtractor),
+// with "+open" appended for a MorphologicalFilter on top, e.g. "pixel+open"
+std::unique_ptr<MaskGenerator> makeMaskGenerator(const std::string &name, int threshold);
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Layer.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// The native model format, .mcnn: a header, the weight blobs, then the description of the layers.
+// Every blob starts on a 64-byte boundary and is stored as inference reads it: filters and biases
+// as they are, plus the packed GEMM operands and Winograd filters of the convolutions.
+// Opening a file maps it rather than reading it and the layers' tensors are views of the mapping,
+// so loading copies nothing and processes running the same model share its pages.
+class ModelFile
+{
+public:
+    explicit ModelFile(const std::string &path);
+    ~ModelFile();
+
+    ModelFile(const ModelFile&) = delete;
+    ModelFile& operator=(const ModelFile&) = delete;
+
+    // Layers whose weights point into the mapping, which has to outlive them. The mapping is
+    // private: pages written to, e.g. by training, are copied and the file stays as it is.
+    std::vector<std::unique_ptr<Layer>> createLayers() const;
+    const void *data() const { return address; }
+    size_t size() const { return length; }
+
+    // Layers as loadCaffeNet gives them, with packed weights; throws for layers it can't describe
+    static void save(const std::vector<std::unique_ptr<Layer>> &layers, const std::string &path);
+    // By the .mcnn extension
+    static bool isModelPath(const std::string &path);
+
+private:
+    uint8_t *address = nullptr;
+    size_t length = 0;
+};
+
+}
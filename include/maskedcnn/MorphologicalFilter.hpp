@@ -0,0 +1,33 @@
+#pragma once
+#include "MaskGenerator.hpp"
+
+namespace MaskedCNN
+{
+
+// Cleans up the mask of another generator: an opening with a (2 * openRadius + 1) square drops
+// specks of noise smaller than the square, and the result is grown by growRadius so the
+// surviving regions cover the edges the opening shaved off. Pixels it drops are not recomputed.
+class MorphologicalFilter : public MaskGenerator
+{
+public:
+    explicit MorphologicalFilter(std::unique_ptr<MaskGenerator> source, int openRadius = 1, int growRadius = 1);
+
+    virtual void setThreshold(int threshold) override;
+
+    virtual const BitMask& detect(const cv::Mat &frame) override;
+    virtual void setReference(const cv::Mat &frame) override;
+    virtual const BitMask& mask() const override { return cleaned; }
+
+    virtual std::unique_ptr<MaskGenerator> clone() const override;
+    virtual std::string name() const override;
+
+private:
+    std::unique_ptr<MaskGenerator> source;
+    int openRadius;
+    int growRadius;
+
+    BitMask eroded;
+    BitMask cleaned;
+};
+
+}
@@ -6,6 +6,9 @@
 #include "DropoutLayer.hpp"
 #include "PoolLayer.hpp"
 #include "SoftmaxLayer.hpp"
+#include "GraphExecutor.hpp"
+#include "ChangeDetector.hpp"
+#include "ModelFile.hpp"
 #include "Activation.hpp"
 #include "TrainingRegime.hpp"
 #include "DataLoader.hpp"
@@ -27,34 +30,84 @@ class Network
 {
 public:
     Network(std::vector<std::unique_ptr<Layer>> layers, int threshold);
+    // A Caffe model, or a .mcnn file (see ModelFile) used in place
     Network(std::string modelPath, int threshold);
     void setDisplayMask(int i, bool display);
     void setDisplayMask(std::string name, bool display);
     void setMaskEnabled(bool enabled);
+    void invalidateCaches();
     void setThreshold(int threshold);
+    // Source of the change masks of forward(), and of the streams of forwardBatch() not given
+    // one of their own. A ChangeDetector by default. The next frame is computed densely.
+    void setMaskGenerator(std::unique_ptr<MaskGenerator> generator);
+    // Of one stream of forwardBatch() only, e.g. a noisy camera. The next batch is computed densely.
+    void setMaskGenerator(int stream, std::unique_ptr<MaskGenerator> generator);
     std::vector<std::pair<std::string, cv::Mat>> forward(const cv::Mat &input);
+    // Runs frames of several streams as one [N, C, H, W] batch. Every stream keeps its own mask
+    // generator, so a frame's mask plane marks only its own changes.
+    // An empty Mat leaves its slot unchanged with an empty mask. Returns the class map of every
+    // frame given, an empty tensor for the others.
+    std::vector<Tensor<float>> forwardBatch(const std::vector<cv::Mat> &inputs);
     void dummyForward(const Tensor<float> &input, const Tensor<float> &mask);
+
+    // The steps of forward(), for callers running them on threads of their own (see VideoPipeline).
+    // The [3, H, W] input of a BGR frame, mean subtracted, in image's storage
+    static void toInput(const cv::Mat &frame, Tensor<float> &image);
+    static void toInput(const cv::Mat &frame, TensorView<float> image);
+    // Runs the layers on an input and its change mask
+    void infer(const Tensor<float> &input, const Tensor<float> &inputMask);
+    void infer(const Tensor<float> &input, const BitMask &inputMask);
+    // Class of every pixel of a frame of this size, from the output of the last infer()
+    Tensor<float> classes(cv::Size size);
+
     std::vector<std::string> layerNames() const;
     Tensor<float> getOutput();
 
     long forwardTime() const;
 
+    // Bytes held by layer outputs; with a memory plan several layers share each buffer
+    size_t outputBytes() const;
+
 private:
+    void runLayers(const Tensor<float> &input);
+
+    // Without masks a layer output is dead once its last consumer has run, so outputs whose
+    // lifetimes don't overlap are placed in the same buffer. Planned after a dense frame, when
+    // every shape is known. Masked inference reads last frame's outputs and keeps its own.
+    void planMemory();
+    void releaseMemoryPlan();
+
+    // The weights of the layers may point into it, so it goes after them
+    std::unique_ptr<ModelFile> model;
     std::vector<std::unique_ptr<Layer>> layers;
+    GraphExecutor executor;
     std::vector<bool> displayMaskSwitch;
     bool maskEnabled;
 
     cv::Mat currentFrame;
-    cv::Mat prevFrame;
     bool initDone;
-    bool maskInitDone;
 
     tms beginTime;
     tms endTime;
 
     int threshold;
 
-    Tensor<float> accumMatrix;
+    // Kept across frames so their storage is reused
+    Tensor<float> image;
+    // Change mask of the frames given to forward()
+    std::unique_ptr<MaskGenerator> generator;
+
+    // Per stream state of batched inference; empty entries get a clone of generator
+    std::vector<std::unique_ptr<MaskGenerator>> streamGenerators;
+    std::vector<bool> streamGeneratorSet; // by setMaskGenerator(stream, ...), so not a clone
+    cv::Size batchFrameSize;
+    Tensor<float> batchImage;
+    BitMask batchMask;
+
+    Shape inferredDimensions;
+    std::vector<Tensor<float>> outputStorage;
+    std::vector<Layer*> plannedLayers;
+    bool memoryPlanned = false;
 };
 
 }
@@ -11,6 +11,7 @@
 #include "PoolLayer.hpp"
 #include "SoftmaxLayer.hpp"
 #include "PipeLayer.hpp"
+#include "EltwiseLayer.hpp"
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include "caffe.pb.h"
 
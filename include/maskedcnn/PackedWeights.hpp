@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include "Tensor.hpp"
+
+namespace MaskedCNN
+{
+
+// Weights as the left operand A [rows x cols] of a layer's GEMM. Packed weights are laid out
+// once (at model load) in exactly the order the GEMM reads them, with 64-byte aligned rows;
+// a view wraps a filter tensor as it is and may have to be read transposed.
+class PackedWeights
+{
+public:
+    PackedWeights() = default;
+    PackedWeights(const Tensor<float>& filter); // view of a convolution filter [out, in, f, f]
+    PackedWeights(PackedWeights&& other) = default;
+    PackedWeights& operator=(PackedWeights&& other) = default;
+    PackedWeights(const PackedWeights&) = delete;
+    PackedWeights& operator=(const PackedWeights&) = delete;
+
+    // View of a transposed convolution filter [in, out, f, f], read as its transpose
+    static PackedWeights transposedView(const Tensor<float>& filter);
+    // Of a matrix already packed elsewhere, e.g. in a model file, which has to outlive the view
+    static PackedWeights packedView(const float *matrix, int rows, int cols, int stride);
+
+    void packConvolution(const Tensor<float>& filter);
+    void packTransposedConvolution(const Tensor<float>& filter);
+
+    bool empty() const { return matrix == nullptr; }
+    int rows() const { return m; }
+    int cols() const { return k; }
+    int stride() const { return ld; } // leading dimension of the stored matrix
+    bool transposed() const { return trans; }
+    const float *data() const { return matrix; }
+
+private:
+    void allocate(int rows, int cols);
+
+    const float *matrix = nullptr;
+    int m = 0;
+    int k = 0;
+    int ld = 0;
+    bool trans = false;
+    std::vector<float> storage;
+};
+
+}
@@ -15,7 +15,7 @@ public:
 
     virtual void forwardPropagate() override {}
     virtual void backwardPropagate() override {}
-    virtual std::vector<int> getOutputDimensions() override
+    virtual Shape getOutputDimensions() override
     {
         return bottoms[0]->getOutputDimensions();
     }
@@ -30,10 +30,15 @@ public:
         return bottoms[0]->getDelta();
     }
 
-    virtual Tensor<float> *getMask() override
+    virtual BitMask *getMask() override
     {
         return bottoms[0]->getMask();
     }
+
+    virtual long getCacheVersion() const override
+    {
+        return bottoms[0]->getCacheVersion();
+    }
 };
 
 
@@ -12,16 +12,18 @@ public:
     PoolLayer(int windowSize, std::string name = "");
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
-    virtual std::vector<int> getOutputDimensions() override;
+    virtual Shape getOutputDimensions() override;
+    int getWindowSize() const { return windowSize; }
 
 private:
+    Shape inputDimensions;
+    int batch = 1;
     int channels;
     int inputHeight;
     int inputWidth;
     int windowSize;
     int outputHeight;
     int outputWidth;
-    Tensor<float> buf;
 };
 
 }
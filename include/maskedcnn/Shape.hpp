@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <assert.h>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Tensor dimensions, outermost first, kept inline together with their row-major strides and
+// element count: copying, comparing and querying a shape never allocates
+class Shape
+{
+public:
+    static constexpr int maxDims = 5;
+
+    Shape() = default;
+    Shape(std::initializer_list<int> dimensions) { assign(dimensions.begin(), dimensions.end()); }
+    Shape(const std::vector<int> &dimensions) { assign(dimensions.data(), dimensions.data() + dimensions.size()); }
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    int operator[](int i) const
+    {
+        assert(i >= 0 && i < count);
+        return dims[i];
+    }
+
+    const int *begin() const { return dims; }
+    const int *end() const { return dims + count; }
+
+    // 0 for an empty shape
+    int elementCount() const { return elements; }
+
+    // Elements between neighbours along dimension i
+    int stride(int i) const
+    {
+        assert(i >= 0 && i < count);
+        return strides[i];
+    }
+
+    // The same shape with dimension i of another length
+    Shape withDimension(int i, int length) const
+    {
+        assert(i >= 0 && i < count);
+        Shape result = *this;
+        result.dims[i] = length;
+        result.update();
+        return result;
+    }
+
+    // The shape without its outermost dimension, e.g. one frame of a batch
+    Shape inner() const
+    {
+        assert(count > 0);
+        Shape result;
+        result.assign(dims + 1, dims + count);
+        return result;
+    }
+
+    std::vector<int> toVector() const { return std::vector<int>(begin(), end()); }
+
+    bool operator==(const Shape &other) const
+    {
+        return count == other.count && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const Shape &other) const { return !(*this == other); }
+
+private:
+    void assign(const int *first, const int *last)
+    {
+        if (last - first > maxDims)
+        {
+            throw std::runtime_error("Too many dimensions");
+        }
+
+        count = last - first;
+        std::copy(first, last, dims);
+        update();
+    }
+
+    void update()
+    {
+        int stride = 1;
+        for (int i = count - 1; i >= 0; i--)
+        {
+            strides[i] = stride;
+            stride *= dims[i];
+        }
+        elements = (count > 0) ? stride : 0;
+    }
+
+    int dims[maxDims] = {};
+    int strides[maxDims] = {};
+    int count = 0;
+    int elements = 0;
+};
+
+// Frames of an NCHW batch: the outermost length of a 4D shape, 1 for a single CHW image
+inline int batchSize(const Shape &dims)
+{
+    return (dims.size() == 4) ? dims[0] : 1;
+}
+
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__) || defined(__AVX512F__)
+// GCC 12 warns about the undefined passthrough operand inside its own AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#endif
+
+namespace MaskedCNN
+{
+
+// The widest float vector the build targets (-march=native): AVX-512, AVX2 with FMA, or four
+// plain floats the compiler is left to vectorize
+#if defined(__AVX512F__)
+struct Vec
+{
+    using Type = __m512;
+    static constexpr int width = 16;
+    static Type zero() { return _mm512_setzero_ps(); }
+    static Type load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, Type v) { _mm512_storeu_ps(p, v); }
+    static Type broadcast(float x) { return _mm512_set1_ps(x); }
+    static Type add(Type a, Type b) { return _mm512_add_ps(a, b); }
+    static Type sub(Type a, Type b) { return _mm512_sub_ps(a, b); }
+    static Type mul(Type a, Type b) { return _mm512_mul_ps(a, b); }
+    static Type div(Type a, Type b) { return _mm512_div_ps(a, b); }
+    static Type fma(Type a, Type b, Type c) { return _mm512_fmadd_ps(a, b, c); }
+    static Type max(Type a, Type b) { return _mm512_max_ps(a, b); }
+    static Type min(Type a, Type b) { return _mm512_min_ps(a, b); }
+    static Type round(Type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    // 1 where a > 0, 0 elsewhere
+    static Type step(Type a)
+    {
+        return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, zero(), _CMP_GT_OQ), broadcast(1.0f));
+    }
+    // 2^n for integral n in the normal range
+    static Type pow2(Type n)
+    {
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23));
+    }
+};
+#elif defined(__AVX2__) && defined(__FMA__)
+struct Vec
+{
+    using Type = __m256;
+    static constexpr int width = 8;
+    static Type zero() { return _mm256_setzero_ps(); }
+    static Type load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, Type v) { _mm256_storeu_ps(p, v); }
+    static Type broadcast(float x) { return _mm256_set1_ps(x); }
+    static Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+    static Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+    static Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+    static Type div(Type a, Type b) { return _mm256_div_ps(a, b); }
+    static Type fma(Type a, Type b, Type c) { return _mm256_fmadd_ps(a, b, c); }
+    static Type max(Type a, Type b) { return _mm256_max_ps(a, b); }
+    static Type min(Type a, Type b) { return _mm256_min_ps(a, b); }
+    static Type round(Type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Type step(Type a) { return _mm256_and_ps(_mm256_cmp_ps(a, zero(), _CMP_GT_OQ), broadcast(1.0f)); }
+    static Type pow2(Type n)
+    {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+    }
+};
+#else
+struct Vec
+{
+    struct Type { float v[4]; };
+    static constexpr int width = 4;
+
+    template<typename F>
+    static Type map(Type a, F f)
+    {
+        for (int i = 0; i < 4; i++) a.v[i] = f(a.v[i]);
+        return a;
+    }
+    template<typename F>
+    static Type map(Type a, Type b, F f)
+    {
+        for (int i = 0; i < 4; i++) a.v[i] = f(a.v[i], b.v[i]);
+        return a;
+    }
+
+    static Type zero() { return broadcast(0.0f); }
+    static Type load(const float *p) { return Type{{p[0], p[1], p[2], p[3]}}; }
+    static void store(float *p, Type v) { std::copy(v.v, v.v + 4, p); }
+    static Type broadcast(float x) { return Type{{x, x, x, x}}; }
+    static Type add(Type a, Type b) { return map(a, b, [](float x, float y) { return x + y; }); }
+    static Type sub(Type a, Type b) { return map(a, b, [](float x, float y) { return x - y; }); }
+    static Type mul(Type a, Type b) { return map(a, b, [](float x, float y) { return x * y; }); }
+    static Type div(Type a, Type b) { return map(a, b, [](float x, float y) { return x / y; }); }
+    static Type fma(Type a, Type b, Type c) { return add(mul(a, b), c); }
+    static Type max(Type a, Type b) { return map(a, b, [](float x, float y) { return std::max(x, y); }); }
+    static Type min(Type a, Type b) { return map(a, b, [](float x, float y) { return std::min(x, y); }); }
+    static Type round(Type a) { return map(a, [](float x) { return std::nearbyint(x); }); }
+    static Type step(Type a) { return map(a, [](float x) { return x > 0.0f ? 1.0f : 0.0f; }); }
+    static Type pow2(Type n) { return map(n, [](float x) { return std::ldexp(1.0f, (int)x); }); }
+};
+#endif
+
+#if defined(__AVX2__)
+// Byte shuffle index gathering channel c of 16 interleaved BGR pixels from the block-th of the
+// three 16 byte blocks holding them: out[i] = in[3i + c], -128 (zero) where another block has it
+constexpr char bgrShuffleIndex(int c, int block, int i)
+{
+    return ((3 * i + c) / 16 == block) ? (3 * i + c) % 16 : -128;
+}
+
+template<int c, int block>
+inline __m128i bgrShuffle(__m128i v)
+{
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(
+            bgrShuffleIndex(c, block, 0), bgrShuffleIndex(c, block, 1), bgrShuffleIndex(c, block, 2),
+            bgrShuffleIndex(c, block, 3), bgrShuffleIndex(c, block, 4), bgrShuffleIndex(c, block, 5),
+            bgrShuffleIndex(c, block, 6), bgrShuffleIndex(c, block, 7), bgrShuffleIndex(c, block, 8),
+            bgrShuffleIndex(c, block, 9), bgrShuffleIndex(c, block, 10), bgrShuffleIndex(c, block, 11),
+            bgrShuffleIndex(c, block, 12), bgrShuffleIndex(c, block, 13), bgrShuffleIndex(c, block, 14),
+            bgrShuffleIndex(c, block, 15)));
+}
+
+// Channel c of the 16 BGR pixels in blocks, one byte each
+template<int c>
+inline __m128i bgrChannel(const __m128i blocks[3])
+{
+    return _mm_or_si128(_mm_or_si128(bgrShuffle<c, 0>(blocks[0]), bgrShuffle<c, 1>(blocks[1])),
+                        bgrShuffle<c, 2>(blocks[2]));
+}
+#endif
+
+// e^x as 2^n * e^r with |r| <= ln(2) / 2 and a degree 6 polynomial for e^r (the Cephes expf
+// coefficients), about 2 ulp. Inputs are clamped to where the result stays a normal float.
+inline Vec::Type vecExp(Vec::Type x)
+{
+    x = Vec::min(Vec::max(x, Vec::broadcast(-87.3f)), Vec::broadcast(88.3f));
+
+    const Vec::Type n = Vec::round(Vec::mul(x, Vec::broadcast(1.44269504088896341f)));
+    // ln 2 split in two, so n * ln2 is subtracted without rounding error
+    Vec::Type r = Vec::fma(n, Vec::broadcast(-0.693359375f), x);
+    r = Vec::fma(n, Vec::broadcast(2.12194440e-4f), r);
+
+    Vec::Type p = Vec::broadcast(1.9875691500e-4f);
+    p = Vec::fma(p, r, Vec::broadcast(1.3981999507e-3f));
+    p = Vec::fma(p, r, Vec::broadcast(8.3334519073e-3f));
+    p = Vec::fma(p, r, Vec::broadcast(4.1665795894e-2f));
+    p = Vec::fma(p, r, Vec::broadcast(1.6666665459e-1f));
+    p = Vec::fma(p, r, Vec::broadcast(5.0000001201e-1f));
+    p = Vec::fma(p, Vec::mul(r, r), Vec::add(r, Vec::broadcast(1.0f)));
+
+    return Vec::mul(p, Vec::pow2(n));
+}
+
+// Runs f over whole vectors of x and then once over the zero-padded tail, so every
+// element goes through the same arithmetic; y may be x
+template<typename F>
+void forEachVector(const float *x, float *y, int num, F f)
+{
+    int i = 0;
+    for (; i + Vec::width <= num; i += Vec::width)
+    {
+        Vec::store(y + i, f(Vec::load(x + i)));
+    }
+    if (i < num)
+    {
+        float tail[Vec::width] = {};
+        std::copy(x + i, x + num, tail);
+        Vec::store(tail, f(Vec::load(tail)));
+        std::copy(tail, tail + (num - i), y + i);
+    }
+}
+
+// Same with a second output: f(x, yv) stores y in yv and returns z
+template<typename F>
+void forEachVector(const float *x, float *y, float *z, int num, F f)
+{
+    int i = 0;
+    for (; i + Vec::width <= num; i += Vec::width)
+    {
+        Vec::Type yv;
+        Vec::store(z + i, f(Vec::load(x + i), yv));
+        Vec::store(y + i, yv);
+    }
+    if (i < num)
+    {
+        float tailX[Vec::width] = {};
+        float tailY[Vec::width];
+        float tailZ[Vec::width];
+        std::copy(x + i, x + num, tailX);
+        Vec::Type yv;
+        Vec::store(tailZ, f(Vec::load(tailX), yv));
+        Vec::store(tailY, yv);
+        std::copy(tailY, tailY + (num - i), y + i);
+        std::copy(tailZ, tailZ + (num - i), z + i);
+    }
+}
+
+}
@@ -10,7 +10,7 @@ public:
 
     virtual void forwardPropagate() override;
     virtual void backwardPropagate() override;
-    virtual std::vector<int> getOutputDimensions() override;
+    virtual Shape getOutputDimensions() override;
 
     float getLoss() const;
     void setGroundTruth(int i);
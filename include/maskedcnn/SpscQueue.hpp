@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Bounded queue between exactly one producer and one consumer thread, without locks. Each index
+// is written by one side only, and an item is published by the release store of the tail.
+template<typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : items(capacity + 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side; false if the queue is full
+    bool tryPush(const T& item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t next = advance(t);
+        if (next == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        items[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false if the queue is empty
+    bool tryPop(T& item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[h];
+        head.store(advance(h), std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return items.size() - 1; }
+
+private:
+    size_t advance(size_t index) const { return index + 1 == items.size() ? 0 : index + 1; }
+
+    std::vector<T> items;
+    std::atomic<size_t> head{0}; // next item to pop
+    // Keeps the two indices off a common cache line, so the sides don't invalidate each other's
+    char padding[64];
+    std::atomic<size_t> tail{0}; // next free place
+};
+
+}
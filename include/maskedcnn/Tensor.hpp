@@ -5,7 +5,10 @@
 #include <cstring>
 #include <string>
 #include <cmath>
+#include <type_traits>
 #include "Util.hpp"
+#include "Shape.hpp"
+#include "TensorAllocator.hpp"
 #include <iostream>
 #include <cuda.h>
 #include <cuda_runtime.h>
@@ -14,6 +17,8 @@ namespace MaskedCNN
 
 // Better to make it explicit
 class shallow_copy {};
+// The caller overwrites every element, so the storage is not zero-filled
+class uninitialized {};
 
 enum class DataPosition {
     UNDEFINED,
@@ -21,18 +26,24 @@ enum class DataPosition {
     GPU
 };
 
-// Row-major order
+// Row-major order. Host storage comes from TensorAllocator::current(), 64-byte aligned, and is
+// kept when a resize fits into it.
 template<typename T>
 class Tensor
 {
+    static_assert(std::is_trivial<T>::value, "Tensor storage is not constructed");
+
 public:
     Tensor();
-    Tensor(std::vector<int> &dimensions);
-    Tensor(std::vector<int> &&dimensions);
+    Tensor(const Shape &dimensions);
+    Tensor(const Shape &dimensions, uninitialized);
     Tensor(int channelLength, int columnLength, int rowLength);
     Tensor(int channelLength2, int channelLength, int columnLength, int rowLength);
     Tensor(const Tensor<T>& other); // deep copy
     Tensor(const Tensor<T>& other, shallow_copy) noexcept;
+    // View of storage the tensor doesn't own, e.g. a mapped model file, which has to outlive it.
+    // Resizing beyond it moves the tensor to storage of its own.
+    Tensor(T *storage, const Shape &dimensions, shallow_copy) noexcept;
     Tensor(Tensor<T>&& other) noexcept;
     Tensor<T>& operator=(const Tensor<T>& other);
     Tensor<T>& operator=(Tensor<T>&& other) noexcept;
@@ -71,17 +82,19 @@ public:
 
     bool sameShape(const Tensor& other) const;
 
-    void reshape(const std::vector<int> &dimensions) const;
+    void reshape(const Shape &dimensions) const;
     void reshape(int rowLength, int columnLength, int channelLength);
-    void resize(const std::vector<int> &dimensions);
+    void resize(const Shape &dimensions);
+    void resize(const Shape &dimensions, uninitialized);
     void flatten();
     void fillwith(T scalar);
 
     void zero();
 
     int elementCount() const;
+    int capacity() const { return allocated; } // elements the host storage holds
     int nonZeroCount() const;
-    std::vector<int> dimensions() const;
+    const Shape& dimensions() const { return dims; }
     int dimensionCount() const;
 
     double mean();
@@ -94,13 +107,55 @@ public:
     std::string toString() const;
 
 private:
-    mutable std::vector<int> dims;
+    void allocateHost(int count);
+    void releaseHost();
+    void resizeHost(int count, bool zeroFill);
+
+    mutable Shape dims;
     T *data = nullptr;
     T *gpuData = nullptr;
     bool isShallow;
     DataPosition dataPosition = DataPosition::UNDEFINED;
+    int allocated = 0;
+    TensorAllocator *allocator = nullptr;
 };
 
+template<typename T>
+void Tensor<T>::allocateHost(int count)
+{
+    allocator = &TensorAllocator::current();
+    data = static_cast<T*>(allocator->allocate(count * sizeof(T)));
+    allocated = count;
+}
+
+template<typename T>
+void Tensor<T>::releaseHost()
+{
+    if (data && !isShallow)
+    {
+        allocator->deallocate(data, allocated * sizeof(T));
+    }
+    data = nullptr;
+    allocated = 0;
+}
+
+// Storage for count elements, reusing the current one when it is large enough;
+// a shallow copy keeps writing through to the storage it shares while it fits
+template<typename T>
+void Tensor<T>::resizeHost(int count, bool zeroFill)
+{
+    if (count > allocated || !data)
+    {
+        releaseHost();
+        isShallow = false;
+        allocateHost(count);
+    }
+    if (zeroFill)
+    {
+        std::memset(data, 0, count * sizeof(T));
+    }
+}
+
 template<typename T>
 Tensor<T>::Tensor()
     :data(nullptr), isShallow(false), dataPosition(DataPosition::UNDEFINED)
@@ -108,35 +163,31 @@ Tensor<T>::Tensor()
 }
 
 template<typename T>
-Tensor<T>::Tensor(std::vector<int> &dimensions)
+Tensor<T>::Tensor(const Shape &dimensions)
     :dims(dimensions), isShallow(false), dataPosition(DataPosition::CPU)
 {
-    data = new T[elementCount()];
-    std::memset(data, 0, elementCount() * sizeof(T));
+    resizeHost(elementCount(), true);
 }
 
 template<typename T>
-Tensor<T>::Tensor(std::vector<int> &&dimensions)
-    :dims(std::move(dimensions)), isShallow(false), dataPosition(DataPosition::CPU)
+Tensor<T>::Tensor(const Shape &dimensions, uninitialized)
+    :dims(dimensions), isShallow(false), dataPosition(DataPosition::CPU)
 {
-    data = new T[elementCount()];
-    std::memset(data, 0, elementCount() * sizeof(T));
+    resizeHost(elementCount(), false);
 }
 
 template<typename T>
 Tensor<T>::Tensor(int channelLength, int columnLength, int rowLength)
     :dims{channelLength, columnLength, rowLength}, isShallow(false), dataPosition(DataPosition::CPU)
 {
-    data = new T[elementCount()];
-    std::memset(data, 0, elementCount() * sizeof(T));
+    resizeHost(elementCount(), true);
 }
 
 template<typename T>
 Tensor<T>::Tensor(int channelLength2, int channelLength, int columnLength, int rowLength)
     :dims{channelLength2, channelLength, columnLength, rowLength}, isShallow(false), dataPosition(DataPosition::CPU)
 {
-    data = new T[elementCount()];
-    std::memset(data, 0, elementCount() * sizeof(T));
+    resizeHost(elementCount(), true);
 }
 
 template<typename T>
@@ -149,28 +200,39 @@ Tensor<T>::Tensor(const Tensor<T> &other)
         throw std::runtime_error("POSITION UNDEFINED");
         break;
     case DataPosition::CPU:
-        data = new T[other.elementCount()];
+        resizeHost(other.elementCount(), false);
         std::memcpy(data, other.data, other.elementCount() * sizeof(T));
         break;
     case DataPosition::GPU:
-        cudaMalloc(&gpuData, other.elementCount());
+        cudaMalloc(&gpuData, other.elementCount() * sizeof(T));
         cudaMemcpy(gpuData, other.gpuData, other.elementCount() * sizeof(T), cudaMemcpyDeviceToDevice);
     }
 }
 
 template<typename T>
 Tensor<T>::Tensor(const Tensor<T> &other, shallow_copy) noexcept
-    :dims(other.dims), data(other.data), gpuData(other.gpuData), isShallow(true), dataPosition(other.dataPosition)
+    :dims(other.dims), data(other.data), gpuData(other.gpuData), isShallow(true), dataPosition(other.dataPosition),
+      allocated(other.allocated)
 {
 }
 
+template<typename T>
+Tensor<T>::Tensor(T *storage, const Shape &dimensions, shallow_copy) noexcept
+    :dims(dimensions), data(storage), isShallow(true), dataPosition(DataPosition::CPU)
+{
+    allocated = elementCount();
+}
+
 template<typename T>
 Tensor<T>::Tensor(Tensor<T> &&other) noexcept
-    :dims(std::move(other.dims)), data(std::move(other.data)), gpuData(std::move(other.gpuData)), dataPosition(other.dataPosition)
+    :dims(other.dims), data(other.data), gpuData(other.gpuData), isShallow(other.isShallow),
+      dataPosition(other.dataPosition), allocated(other.allocated), allocator(other.allocator)
 {
-    isShallow = other.isShallow;
+    other.dims = Shape();
     other.data = nullptr;
     other.gpuData = nullptr;
+    other.allocated = 0;
+    other.dataPosition = DataPosition::UNDEFINED;
 }
 
 template<typename T>
@@ -187,17 +249,9 @@ Tensor<T>& Tensor<T>::operator=(const Tensor<T>& other)
         throw std::runtime_error("POSITION UNDEFINED");
         break;
     case DataPosition::CPU:
-        if (elementCount() == other.elementCount())
-        {
-            dims = other.dims;
-            std::memcpy(data, other.data, elementCount() * sizeof(T));
-        }
-        else
-        {
-            delete[] data;
-            dims = other.dims;
-            data = new T[elementCount()];
-        }
+        dims = other.dims;
+        resizeHost(elementCount(), false);
+        std::memcpy(data, other.data, elementCount() * sizeof(T));
         break;
     case DataPosition::GPU:
         if (elementCount() == other.elementCount())
@@ -214,21 +268,36 @@ Tensor<T>& Tensor<T>::operator=(const Tensor<T>& other)
         break;
     }
 
-    isShallow = false;
+    dataPosition = other.dataPosition;
     return *this;
 }
 
 template<typename T>
 Tensor<T>& Tensor<T>::operator=(Tensor<T>&& other) noexcept
 {
-    dims = std::move(other.dims);
-    data = std::move(other.data);
-    gpuData = std::move(other.data);
-    dataPosition = other.dataPosition;
+    if (this == &other)
+    {
+        return *this;
+    }
+
+    if (!isShallow && dataPosition == DataPosition::GPU)
+    {
+        cudaFree(gpuData);
+    }
+    releaseHost();
 
+    dims = other.dims;
+    data = other.data;
+    gpuData = other.gpuData;
+    dataPosition = other.dataPosition;
     isShallow = other.isShallow;
+    allocated = other.allocated;
+    allocator = other.allocator;
+
+    other.dims = Shape();
     other.data = nullptr;
     other.gpuData = nullptr;
+    other.allocated = 0;
     other.dataPosition = DataPosition::UNDEFINED;
 
     return *this;
@@ -244,8 +313,7 @@ Tensor<T>::~Tensor()
         case DataPosition::UNDEFINED:
             break;
         case DataPosition::CPU:
-            delete[] data;
-            data = nullptr;
+            releaseHost();
             break;
         case DataPosition::GPU:
             cudaFree(gpuData);
@@ -268,8 +336,7 @@ Tensor<T>& Tensor<T>::toGpu()
     case DataPosition::CPU:
         cudaMalloc(&gpuData, elementCount() * sizeof(T));
         cudaMemcpy(gpuData, data, elementCount() * sizeof(T), cudaMemcpyHostToDevice);
-        delete[] data;
-        data = nullptr;
+        releaseHost();
         dataPosition = DataPosition::GPU;
         break;
     case DataPosition::GPU:
@@ -288,7 +355,7 @@ Tensor<T>& Tensor<T>::toCpu()
         dataPosition = DataPosition::CPU;
         break;
     case DataPosition::GPU:
-        data = new T[elementCount()];
+        allocateHost(elementCount());
         cudaMemcpy(data, gpuData, elementCount() * sizeof(T), cudaMemcpyDeviceToHost);
         cudaFree(gpuData);
         gpuData = nullptr;
@@ -378,7 +445,7 @@ inline T& Tensor<T>::operator()(int row, int column)
     assert(dimensionCount() == 2);
     assert(column < this->dims[1] && column >= 0);
     assert(row < this->dims[0] && row >= 0);
-    return data[row * dims[1] + column];
+    return data[row * dims.stride(0) + column];
 }
 
 template<typename T>
@@ -388,7 +455,7 @@ inline const T& Tensor<T>::operator()(int row, int column) const
     assert(dimensionCount() == 2);
     assert(column < this->dims[1] && column >= 0);
     assert(row < this->dims[0] && row >= 0);
-    return data[row * dims[1] + column];
+    return data[row * dims.stride(0) + column];
 }
 
 template<typename T>
@@ -399,7 +466,7 @@ inline T& Tensor<T>::operator()(int channel, int row, int column)
     assert(column < this->dims[2] && column >= 0);
     assert(row < this->dims[1] && row >= 0);
     assert(channel < this->dims[0] && channel >= 0);
-    return data[(channel * dims[1] + row) * dims[2] + column];
+    return data[channel * dims.stride(0) + row * dims.stride(1) + column];
 }
 
 template<typename T>
@@ -411,7 +478,7 @@ inline const T& Tensor<T>::operator()(int channel, int row, int column) const
    assert(row < this->dims[1] && row >= 0);
    assert(channel < this->dims[0] && channel >= 0);
 
-   return data[(channel * dims[1] + row) * dims[2] + column];
+   return data[channel * dims.stride(0) + row * dims.stride(1) + column];
 }
 
 template<typename T>
@@ -423,7 +490,7 @@ inline T& Tensor<T>::operator()(int channel2, int channel, int row, int column)
     assert(row < this->dims[2] && row >= 0);
     assert(channel < this->dims[1] && channel >= 0);
     assert(channel2 < this->dims[0] && channel2 >= 0);
-    return data[((channel2 * dims[1] + channel) * dims[2] + row) * dims[3] + column];
+    return data[channel2 * dims.stride(0) + channel * dims.stride(1) + row * dims.stride(2) + column];
 }
 
 template<typename T>
@@ -435,7 +502,7 @@ inline const T& Tensor<T>::operator()(int channel2, int channel, int row, int co
     assert(row < this->dims[2] && row >= 0);
     assert(channel < this->dims[1] && channel >= 0);
     assert(channel2 < this->dims[0] && channel2 >= 0);
-    return data[((channel2 * dims[1] + channel) * dims[2] + row) * dims[3] + column];
+    return data[channel2 * dims.stride(0) + channel * dims.stride(1) + row * dims.stride(2) + column];
 }
 
 
@@ -446,9 +513,9 @@ inline bool Tensor<T>::sameShape(const Tensor &other) const
 }
 
 template<typename T>
-void Tensor<T>::reshape(const std::vector<int> &dimensions) const
+void Tensor<T>::reshape(const Shape &dimensions) const
 {
-    int newElementCount = multiplyAllElements(dimensions);
+    int newElementCount = dimensions.elementCount();
     if (newElementCount != elementCount())
     {
         throw std::runtime_error("Invalid reshape");
@@ -469,26 +536,40 @@ void Tensor<T>::reshape(int width, int height, int channels)
 }
 
 template<typename T>
-void Tensor<T>::resize(const std::vector<int> &dimensions)
+void Tensor<T>::resize(const Shape &dimensions, uninitialized)
 {
-    if (multiplyAllElements(dimensions) != elementCount())
+    const int newElementCount = dimensions.elementCount();
+    if (dataPosition == DataPosition::GPU)
+    {
+        resize(dimensions);
+        return;
+    }
+
+    resizeHost(newElementCount, false);
+    dataPosition = DataPosition::CPU;
+    dims = dimensions;
+}
+
+// The contents are kept if the element count does not change, zeroed otherwise
+template<typename T>
+void Tensor<T>::resize(const Shape &dimensions)
+{
+    const int newElementCount = dimensions.elementCount();
+    if (newElementCount != elementCount() || dataPosition == DataPosition::UNDEFINED)
     {
         switch(dataPosition)
         {
         case DataPosition::UNDEFINED:
-            data = new T[multiplyAllElements(dimensions)];
-            std::fill_n(data, elementCount(), T{0});
+            resizeHost(newElementCount, true);
             dataPosition = DataPosition::CPU;
             break;
         case DataPosition::CPU:
-            delete[] data;
-            data = new T[multiplyAllElements(dimensions)];
-            std::fill_n(data, elementCount(), T{0});
+            resizeHost(newElementCount, true);
             break;
         case DataPosition::GPU:
             cudaFree(gpuData);
-            cudaMalloc(&gpuData, multiplyAllElements(dimensions) * sizeof(T));
-            cudaMemset(gpuData, 0, multiplyAllElements(dimensions) * sizeof(T));
+            cudaMalloc(&gpuData, newElementCount * sizeof(T));
+            cudaMemset(gpuData, 0, newElementCount * sizeof(T));
             break;
         }
     }
@@ -499,9 +580,7 @@ void Tensor<T>::resize(const std::vector<int> &dimensions)
 template<typename T>
 void Tensor<T>::flatten()
 {
-    std::vector<int> newDims(1);
-    newDims[0] = elementCount();
-    reshape(newDims);
+    reshape({elementCount()});
 }
 
 template<typename T>
@@ -544,8 +623,7 @@ void Tensor<T>::zero()
 template<typename T>
 int Tensor<T>::elementCount() const
 {
-    if (dims.size() == 0) return 0;
-    return multiplyAllElements(dims);
+    return dims.elementCount();
 }
 
 template<typename T>
@@ -569,12 +647,6 @@ int Tensor<T>::nonZeroCount() const
     return count;
 }
 
-template<typename T>
-std::vector<int> Tensor<T>::dimensions() const
-{
-    return dims;
-}
-
 template<typename T>
 int Tensor<T>::dimensionCount() const
 {
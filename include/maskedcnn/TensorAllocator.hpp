@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Host memory behind Tensor data. Every block is aligned to a cache line, so vector loads
+// never split lines at the start of a tensor.
+class TensorAllocator
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    virtual ~TensorAllocator() = default;
+    virtual void *allocate(size_t bytes) = 0;
+    virtual void deallocate(void *pointer, size_t bytes) = 0;
+
+    // Used by tensors allocating from now on; a tensor frees with the allocator it got its memory from.
+    // The default is a PoolAllocator.
+    static TensorAllocator& current();
+    static void setCurrent(TensorAllocator& allocator);
+};
+
+// Straight to the system on every call
+class AlignedAllocator : public TensorAllocator
+{
+public:
+    void *allocate(size_t bytes) override;
+    void deallocate(void *pointer, size_t bytes) override;
+};
+
+// Keeps freed blocks in free lists by size class and hands them out again, so the buffers a network
+// resizes and the per-frame temporaries stop reaching the system allocator once every size has been
+// seen. Classes are a quarter of a power of two apart, which bounds the waste to 25%.
+class PoolAllocator : public TensorAllocator
+{
+public:
+    PoolAllocator() = default;
+    ~PoolAllocator();
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    void *allocate(size_t bytes) override;
+    void deallocate(void *pointer, size_t bytes) override;
+
+    // Returns the cached blocks to the system
+    void release();
+
+    // Blocks that had to be taken from the system so far
+    size_t systemAllocations() const;
+    size_t cachedBytes() const;
+
+private:
+    static int sizeClass(size_t bytes);
+    static size_t classBytes(int sizeClass);
+
+    mutable std::mutex mutex;
+    std::vector<std::vector<void*>> freeLists;
+    size_t allocations = 0;
+    size_t cached = 0;
+};
+
+}
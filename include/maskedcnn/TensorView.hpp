@@ -0,0 +1,160 @@
+#pragma once
+#include <type_traits>
+#include "Tensor.hpp"
+#include "Shape.hpp"
+
+namespace MaskedCNN
+{
+
+// Non-owning, strided window on tensor storage: a whole tensor, a range along any dimension
+// (channels, rows) or a crop of the two innermost ones, without copying. T is const for
+// read-only views. The viewed storage has to outlive the view and keep its place, so a view is
+// taken where it is used rather than kept across resizes.
+template<typename T>
+class TensorView
+{
+    using Element = typename std::remove_const<T>::type;
+    using Source = typename std::conditional<std::is_const<T>::value, const Tensor<Element>, Tensor<Element>>::type;
+
+public:
+    TensorView() = default;
+
+    // Contiguous elements in row-major order
+    TensorView(T *data, const Shape &dimensions)
+        :data(data), dims(dimensions)
+    {
+        for (int i = 0; i < dims.size(); i++)
+        {
+            strides[i] = dims.stride(i);
+        }
+    }
+
+    TensorView(Source &tensor)
+        :TensorView(tensor.elementCount() > 0 ? tensor.dataAddress() : nullptr, tensor.dimensions())
+    {
+    }
+
+    // Read-only view of a mutable one
+    template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value && !std::is_same<U, T>::value>::type>
+    TensorView(const TensorView<U> &other)
+        :data(other.data), dims(other.dims)
+    {
+        std::copy(other.strides, other.strides + Shape::maxDims, strides);
+    }
+
+    const Shape& dimensions() const { return dims; }
+    int dimensionCount() const { return dims.size(); }
+    int elementCount() const { return dims.elementCount(); }
+
+    int rowLength() const { return dims[dimensionCount() - 1]; }
+    int columnLength() const { return dims[dimensionCount() - 2]; }
+    int channelLength() const { return dims[dimensionCount() - 3]; }
+
+    // Elements between neighbours along dimension i
+    int stride(int i) const
+    {
+        assert(i >= 0 && i < dimensionCount());
+        return strides[i];
+    }
+
+    bool isContiguous() const
+    {
+        for (int i = 0; i < dims.size(); i++)
+        {
+            if (dims[i] > 1 && strides[i] != dims.stride(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The first element
+    T *dataAddress() const { return data; }
+
+    T& operator[](int index) const
+    {
+        assert(isContiguous() && index >= 0 && index < elementCount());
+        return data[index];
+    }
+
+    T& operator()(int row, int column) const
+    {
+        assert(dimensionCount() == 2);
+        assert(row >= 0 && row < dims[0] && column >= 0 && column < dims[1]);
+        return data[row * strides[0] + column * strides[1]];
+    }
+
+    T& operator()(int channel, int row, int column) const
+    {
+        assert(dimensionCount() == 3);
+        assert(channel >= 0 && channel < dims[0] && row >= 0 && row < dims[1] && column >= 0 && column < dims[2]);
+        return data[channel * strides[0] + row * strides[1] + column * strides[2]];
+    }
+
+    T& operator()(int channel2, int channel, int row, int column) const
+    {
+        assert(dimensionCount() == 4);
+        assert(channel2 >= 0 && channel2 < dims[0] && channel >= 0 && channel < dims[1]);
+        assert(row >= 0 && row < dims[2] && column >= 0 && column < dims[3]);
+        return data[channel2 * strides[0] + channel * strides[1] + row * strides[2] + column * strides[3]];
+    }
+
+    // Indices [begin, end) of dimension i, e.g. a channel range or a band of rows
+    TensorView slice(int i, int begin, int end) const
+    {
+        assert(i >= 0 && i < dimensionCount());
+        assert(begin >= 0 && begin <= end && end <= dims[i]);
+
+        return TensorView(data + begin * strides[i], dims.withDimension(i, end - begin), strides);
+    }
+
+    // Frame n of an NCHW batch as a CHW view; a CHW view is its own only frame
+    TensorView frame(int n) const
+    {
+        if (dimensionCount() != 4)
+        {
+            assert(n == 0);
+            return *this;
+        }
+        assert(n >= 0 && n < dims[0]);
+        return TensorView(data + n * strides[0], dims.inner(), strides + 1);
+    }
+
+    // Rows [y, y + height) and columns [x, x + width) of the two innermost dimensions
+    TensorView crop(int y, int x, int height, int width) const
+    {
+        assert(dimensionCount() >= 2);
+        return slice(dimensionCount() - 2, y, y + height).slice(dimensionCount() - 1, x, x + width);
+    }
+
+    // The same elements under other dimensions; only for contiguous views
+    TensorView reshape(const Shape &dimensions) const
+    {
+        if (!isContiguous() || dimensions.elementCount() != elementCount())
+        {
+            throw std::runtime_error("Invalid reshape");
+        }
+        return TensorView(data, dimensions);
+    }
+
+    TensorView flatten() const
+    {
+        return reshape({elementCount()});
+    }
+
+private:
+    template<typename U> friend class TensorView;
+
+    TensorView(T *data, const Shape &dimensions, const int *strides)
+        :data(data), dims(dimensions)
+    {
+        std::copy(strides, strides + dims.size(), this->strides);
+    }
+
+    T *data = nullptr;
+    Shape dims;
+    int strides[Shape::maxDims] = {};
+};
+
+}
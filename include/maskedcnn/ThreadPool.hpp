@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace MaskedCNN
+{
+
+// Small fixed pool of worker threads for the data-parallel loops of the CPU kernels. Every kernel,
+// BLAS calls included (see blasSgemm), runs on the global pool, so the threads a process uses are
+// exactly the pool's and several networks on a machine can be given disjoint shares of it.
+class ThreadPool
+{
+public:
+    // 0 threads means one per CPU the process may run on. Pinned workers are bound one to each
+    // of those CPUs, leaving the first to the calling thread.
+    explicit ThreadPool(int threads = 0, bool pinned = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads taking part in a parallelFor, the calling one included
+    int size() const { return workers.size() + 1; }
+
+    // Runs body(begin, end) over contiguous chunks of [0, count) of at least `grain` items and
+    // returns when all of them are done. The caller works on chunks too; calls made from inside
+    // a chunk run inline.
+    void parallelFor(int count, const std::function<void(int, int)>& body, int grain = 1);
+
+    // Runs task on a worker and returns right away, or runs it inline if the pool has no workers.
+    // A task may use parallelFor; the caller has to wait for its tasks itself.
+    void submit(std::function<void()> task);
+
+    // The pool of all kernels. Sized by MASKEDCNN_THREADS and pinned if MASKEDCNN_PIN_THREADS
+    // is 1, unless configured otherwise before its first use. Creating it sets BLAS to one thread.
+    static ThreadPool& global();
+    // Replaces the global pool; only while no kernel is running
+    static void configureGlobal(int threads, bool pinned);
+
+    // CPUs the process may run on
+    static int availableCores();
+
+private:
+    void workerLoop(int index, bool pinned);
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+}
@@ -13,9 +13,20 @@ inline int outputConvDimension(int inDim, int filterDim, int stride, int pad)
     return (inDim - filterDim + 2 * pad) / stride + 1;
 }
 
-inline int multiplyAllElements(const std::vector<int> vec)
+// Integer division rounding towards negative/positive infinity, b > 0
+inline int floorDiv(int a, int b)
 {
-    return std::accumulate(std::begin(vec), std::end(vec), 1, std::multiplies<double>());
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+inline int ceilDiv(int a, int b)
+{
+    return -floorDiv(-a, b);
+}
+
+inline int multiplyAllElements(const std::vector<int> &vec)
+{
+    return std::accumulate(std::begin(vec), std::end(vec), 1, std::multiplies<int>());
 }
 
 // [res] = [x]*[y]
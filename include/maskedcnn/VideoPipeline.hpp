@@ -0,0 +1,99 @@
+#pragma once
+#include "Network.hpp"
+#include "SpscQueue.hpp"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+// Runs the steps of Network::forward for a video as a pipeline, one thread per stage:
+//   decode -> mask (the generator's change mask) -> convert (input tensor)
+//   -> infer (layers and per pixel classes) -> output (the sink, e.g. visualizing and encoding)
+// Frames travel in a fixed set of slots through lock-free queues, so at most `depth` frames are
+// in flight and the frame rate is set by the slowest stage rather than by the sum of all of them.
+// The class map is taken in the infer stage, as the next frame overwrites the network's output.
+class VideoPipeline
+{
+public:
+    // Fills frame with the next BGR frame, false at the end of the video
+    using Source = std::function<bool(cv::Mat &frame)>;
+    // Gets the frames in order, with their classes
+    using Sink = std::function<void(const cv::Mat &frame, const Tensor<float> &classes)>;
+
+    struct StageStats
+    {
+        std::string name;
+        uint64_t frames;
+        double busySeconds;     // working on frames
+        double waitSeconds;     // waiting for a frame from the stage before
+        double maxFrameSeconds; // the slowest frame
+    };
+
+    // Masks from a ChangeDetector with the threshold
+    VideoPipeline(Network &network, int threshold, int depth = 4);
+    VideoPipeline(Network &network, std::unique_ptr<MaskGenerator> generator, int depth = 4);
+
+    VideoPipeline(const VideoPipeline&) = delete;
+    VideoPipeline& operator=(const VideoPipeline&) = delete;
+
+    // Runs until source returns false and the last frame has left the sink. Every run starts a new
+    // clip: nothing the network or the mask generator kept from earlier frames is used.
+    void run(Source source, Sink sink);
+
+    // Counters of the stages, readable while running
+    std::vector<StageStats> stageStats() const;
+    // From the start of decoding a frame to the sink returning, averaged over the frames
+    double meanLatencySeconds() const;
+
+private:
+    struct Slot
+    {
+        cv::Mat frame;
+        BitMask mask;
+        Tensor<float> image;
+        Tensor<float> classes;
+        std::chrono::steady_clock::time_point decoded;
+        bool last = false; // no frame, ends the stream
+    };
+
+    enum Stage { Decode, Mask, Convert, Infer, Output, StageCount };
+
+    struct Counters
+    {
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> busyNanos{0};
+        std::atomic<uint64_t> waitNanos{0};
+        std::atomic<uint64_t> maxNanos{0};
+    };
+
+    // Runs work on every slot coming from the queue before the stage and hands it on
+    void runStage(Stage stage, const std::function<void(Slot&)> &work);
+    Slot *pop(Stage stage);
+    void push(Stage stage, Slot *slot);
+
+    Network &network;
+
+    std::vector<Slot> slots;
+    // queues[s] feeds stage s; queues[Decode] brings back the slots the output stage is done with
+    std::vector<std::unique_ptr<SpscQueue<Slot*>>> queues;
+
+    // State of the mask stage
+    std::unique_ptr<MaskGenerator> generator;
+
+    Counters counters[StageCount];
+    std::atomic<uint64_t> latencyNanos{0};
+
+    // The first exception of a stage, rethrown by run() once the others have stopped
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+};
+
+}
@@ -2,18 +2,23 @@
 
 #include <opencv2/core/core.hpp>
 #include "Tensor.hpp"
+#include "TensorView.hpp"
+#include "BitMask.hpp"
 
 namespace MaskedCNN {
 
 Tensor<float> loadImage(const std::string &path);
 Tensor<float> matToTensor(const cv::Mat &image);
+void matToTensor(const cv::Mat &image, Tensor<float>& result); // into result's storage
+void matToTensor(const cv::Mat &image, TensorView<float> result); // into a [3, H, W] view, e.g. a frame of a batch
+// Interleaved BGR8 to planar [3, H, W] floats (value - mean[c]) * scale, in one pass spread over the rows
+void bgrToTensor(const cv::Mat &image, TensorView<float> result, const float mean[3], float scale = 1.0f);
 Tensor<float> labelToTensor(const cv::Mat& mask, int label);
 cv::Mat maskToMat(const Tensor<float> &tensor);
+cv::Mat maskToMat(const BitMask &mask);
 cv::Mat visualizeOutput(const Tensor<float> &tensor);
-Tensor<float> maxarg(const Tensor<float> &data);
-Tensor<float> cropLike(const Tensor<float> data, const cv::Mat templateImage, int offset);
+Tensor<float> maxarg(TensorView<const float> data);
 cv::Mat cropLike(const cv::Mat data, const cv::Mat templateImage, int offset);
-Tensor<float> diffFrames(const cv::Mat frame, const cv::Mat prevFrame, Tensor<float> accumMatrix, int threshold = 0);
 cv::Mat saltAndPepper(const cv::Mat frame, double prob);
 void addNoiseToVideo(std::string filename, double prob);
 cv::Mat median(const cv::Mat frame, int window);
@@ -0,0 +1,27 @@
+#pragma once
+#include "Tensor.hpp"
+#include "TensorView.hpp"
+#include "BitMask.hpp"
+
+namespace MaskedCNN {
+
+// Winograd F(2x2, 3x3) for 3x3 stride 1 convolutions: every 2x2 output tile is computed from a 4x4
+// input tile with 16 elementwise products per channel pair instead of 36 multiplications.
+// Products are done as 16 GEMMs [outputChannels x inputChannels] x [inputChannels x tiles].
+
+bool isWinogradConvolution(int filterSize, int stride);
+
+// filter [outputChannels, inputChannels, 3, 3] -> transformed [16, outputChannels, inputChannels]
+void winogradTransformFilter(const Tensor<float>& filter, Tensor<float>& transformed);
+
+// Frame by frame for an [N, C, H, W] batch
+void winogradConvolution(TensorView<const float> input, const Tensor<float>& transformedFilter, Tensor<float>& inputBuffer,
+                         Tensor<float>& productBuffer, TensorView<float> out, int pad);
+
+// Computes every output pixel of the occupied tiles (the tile size has to be even) into
+// outBuffer [outputChannels x patches], in the pixel order of buildTileIndex. Returns patches.
+int winogradConvolutionTiles(TensorView<const float> input, const TileMask& tiles, const Tensor<float>& transformedFilter,
+                             Tensor<float>& inputBuffer, Tensor<float>& productBuffer, Tensor<float>& outBuffer,
+                             int outputHeight, int outputWidth, int pad);
+
+}
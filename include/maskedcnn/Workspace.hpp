@@ -0,0 +1,23 @@
+#pragma once
+#include "Tensor.hpp"
+
+namespace MaskedCNN
+{
+
+// Scratch tensors a layer only needs while its forwardPropagate runs. Layers a network runs one
+// after another get the same Workspace, so every buffer grows to its largest use instead of each
+// layer keeping its own copy; the GraphExecutor gives branches running at the same time one each.
+// Nothing in here survives between frames.
+struct Workspace
+{
+    Tensor<float> columns;          // im2col matrices
+    Tensor<float> product;          // [outputChannels x patches] results of sparse passes
+    Tensor<float> activeOutput;
+    Tensor<float> activeDerivative;
+    Tensor<float> winogradInput;
+    Tensor<float> winogradProduct;
+    Tensor<float> gathered;         // changed input pixels of an indexed transposed convolution
+    Tensor<float> gatheredProduct;  // and their columns
+};
+
+}
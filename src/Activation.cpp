@@ -1,16 +1,74 @@
 #include "Activation.hpp"
+#include "ThreadPool.hpp"
+#include "Simd.hpp"
+#include <algorithm>
 #include <cmath>
 #include "../maskedcnncuda/ActivationCuda.h"
 namespace MaskedCNN
 {
 
+// Values the epilogue biases and activates in one go: 4 KB, well within L1
+static constexpr int epilogueChunk = 1024;
+
+void biasActivate(Activation& activation, const float *bias, int rows, int columns, const float *x, float *y)
+{
+    const int total = rows * columns;
+    const int chunks = (total + epilogueChunk - 1) / epilogueChunk;
+
+    ThreadPool::global().parallelFor(chunks, [&](int begin, int end)
+    {
+        for (int chunk = begin; chunk < end; chunk++)
+        {
+            const int first = chunk * epilogueChunk;
+            const int last = std::min(first + epilogueChunk, total);
+
+            if (bias)
+            {
+                // A chunk can span several rows, and one row several chunks
+                for (int i = first, row = first / columns; i < last; row++)
+                {
+                    const int rowEnd = std::min((row + 1) * columns, last);
+                    const float b = bias[row];
+                    for (; i < rowEnd; i++)
+                    {
+                        y[i] = x[i] + b;
+                    }
+                }
+                activation.forward(y + first, y + first, last - first);
+            }
+            else
+            {
+                activation.forward(x + first, y + first, last - first);
+            }
+        }
+    });
+}
+
+void Activation::activateParallel(const float *x, float *y, float *delta, int num)
+{
+    const int chunks = (num + epilogueChunk - 1) / epilogueChunk;
+    ThreadPool::global().parallelFor(chunks, [&](int begin, int end)
+    {
+        const int first = begin * epilogueChunk;
+        const int last = std::min(end * epilogueChunk, num);
+        activate(x + first, y + first, delta + first, last - first);
+    });
+}
+
+// The derivatives are written from the output: y' = y (1 - y) for the sigmoid, 1 - y^2 for tanh
+
 void ReLu::activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
 {
-    for (int i = 0; i < num; i++)
+    forEachVector(x, y, delta, num, [](Vec::Type v, Vec::Type& out)
     {
-        y[i] = (x[i] > 0.0) ? x[i] : 0.0;
-        delta[i] = (x[i] > 0.0) ? 1.0 : 0.0;
-    }
+        out = Vec::max(v, Vec::zero());
+        return Vec::step(v);
+    });
+}
+
+void ReLu::forward(const float *x, float *y, int num)
+{
+    forEachVector(x, y, num, [](Vec::Type v) { return Vec::max(v, Vec::zero()); });
 }
 
 void ReLu::activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
@@ -18,13 +76,32 @@ void ReLu::activate_gpu(const float *__restrict__ x, float *__restrict__ y, floa
     ReLu_activate_gpu(x,y,delta,num);
 }
 
+static Vec::Type vecSigmoid(Vec::Type v)
+{
+    const Vec::Type one = Vec::broadcast(1.0f);
+    return Vec::div(one, Vec::add(one, vecExp(Vec::sub(Vec::zero(), v))));
+}
+
+// tanh(x) = 1 - 2 / (e^2x + 1), which saturates cleanly where e^2x over- or underflows
+static Vec::Type vecTanh(Vec::Type v)
+{
+    const Vec::Type one = Vec::broadcast(1.0f);
+    const Vec::Type e = vecExp(Vec::add(v, v));
+    return Vec::sub(one, Vec::div(Vec::broadcast(2.0f), Vec::add(e, one)));
+}
+
 void Sigmoid::activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
 {
-    for (int i = 0; i < num; i++)
+    forEachVector(x, y, delta, num, [](Vec::Type v, Vec::Type& out)
     {
-        y[i] = 1.0 / (1.0 + std::exp(-x[i]));
-        delta[i] = y[i] * (1 - y[i]);
-    }
+        out = vecSigmoid(v);
+        return Vec::mul(out, Vec::sub(Vec::broadcast(1.0f), out));
+    });
+}
+
+void Sigmoid::forward(const float *x, float *y, int num)
+{
+    forEachVector(x, y, num, vecSigmoid);
 }
 
 void Sigmoid::activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
@@ -34,12 +111,16 @@ void Sigmoid::activate_gpu(const float *__restrict__ x, float *__restrict__ y, f
 
 void Tanh::activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
 {
-    for (int i = 0; i < num; i++)
+    forEachVector(x, y, delta, num, [](Vec::Type v, Vec::Type& out)
     {
-        float t = std::exp(2 * x[i]);
-        y[i] = (t - 1) / (t + 1);
-        delta[i] = (1 - y[i] * y[i]);
-    }
+        out = vecTanh(v);
+        return Vec::sub(Vec::broadcast(1.0f), Vec::mul(out, out));
+    });
+}
+
+void Tanh::forward(const float *x, float *y, int num)
+{
+    forEachVector(x, y, num, vecTanh);
 }
 
 void Tanh::activate_gpu(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
@@ -49,10 +130,15 @@ void Tanh::activate_gpu(const float *__restrict__ x, float *__restrict__ y, floa
 
 void Id::activate(const float *__restrict__ x, float *__restrict__ y, float *__restrict__ delta, int num)
 {
-    for (int i = 0; i < num; i++)
+    std::copy(x, x + num, y);
+    std::fill(delta, delta + num, 1.0f);
+}
+
+void Id::forward(const float *x, float *y, int num)
+{
+    if (x != y)
     {
-        y[i] = x[i];
-        delta[i] = 1;
+        std::copy(x, x + num, y);
     }
 }
 
@@ -62,5 +148,3 @@ void Id::activate_gpu(const float *x, float *y, float *delta, int num)
 }
 
 }
-
-
@@ -0,0 +1,99 @@
+#include "BackgroundSubtractor.hpp"
+#include "ThreadPool.hpp"
+#include <cstdlib>
+
+namespace MaskedCNN
+{
+
+BackgroundSubtractor::BackgroundSubtractor(int threshold, int learningShift)
+    :limit(threshold), shift(learningShift)
+{
+    if (learningShift < 0 || learningShift > 8)
+    {
+        throw std::runtime_error("Learning shift has to be in [0, 8]");
+    }
+}
+
+void BackgroundSubtractor::setThreshold(int threshold)
+{
+    limit = threshold;
+}
+
+void BackgroundSubtractor::setReference(const cv::Mat &frame)
+{
+    assert(frame.type() == CV_8UC3);
+    height = frame.rows;
+    width = frame.cols;
+
+    background.resize(height * width * 3);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row = frame.ptr<uint8_t>(y);
+        uint16_t *bg = &background[y * width * 3];
+        for (int i = 0; i < width * 3; i++)
+        {
+            bg[i] = row[i] << 8;
+        }
+    }
+
+    current.resize(height, width);
+    previous.resize(height, width);
+    changed.resize(height, width);
+}
+
+const BitMask& BackgroundSubtractor::detect(const cv::Mat &frame)
+{
+    if (frame.rows != height || frame.cols != width || background.empty())
+    {
+        setReference(frame);
+        return changed;
+    }
+
+    std::swap(current, previous);
+    ThreadPool::global().parallelFor(height, [&](int begin, int end)
+    {
+        // One buffer per thread, reused from frame to frame
+        thread_local std::vector<uint16_t> difference;
+        difference.resize(width * 3);
+        for (int y = begin; y < end; y++)
+        {
+            // Channels stay interleaved here, so the loop vectorizes
+            const uint8_t *row = frame.ptr<uint8_t>(y);
+            uint16_t *bg = &background[y * width * 3];
+            for (int i = 0; i < width * 3; i++)
+            {
+                const int pixel = row[i] << 8;
+                const int model = bg[i];
+                difference[i] = std::abs(pixel - model) >> 8;
+                bg[i] = model + ((pixel - model) >> shift);
+            }
+
+            uint64_t *bits = current.row(y);
+            for (int x0 = 0; x0 < width; x0 += 64)
+            {
+                uint64_t word = 0;
+                for (int x = x0; x < std::min(x0 + 64, width); x++)
+                {
+                    const int distance = difference[3 * x] + difference[3 * x + 1] + difference[3 * x + 2];
+                    word |= uint64_t(distance > limit) << (x - x0);
+                }
+                bits[x0 / 64] = word;
+            }
+
+            const uint64_t *before = previous.row(y);
+            uint64_t *result = changed.row(y);
+            for (int i = 0; i < changed.wordsPerRow(); i++)
+            {
+                result[i] = bits[i] | before[i];
+            }
+        }
+    }, 4);
+    return changed;
+}
+
+std::unique_ptr<MaskGenerator> BackgroundSubtractor::clone() const
+{
+    return std::make_unique<BackgroundSubtractor>(limit, shift);
+}
+
+}
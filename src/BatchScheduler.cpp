@@ -0,0 +1,129 @@
+#include "BatchScheduler.hpp"
+
+namespace MaskedCNN
+{
+
+BatchScheduler::BatchScheduler(Network& network, int streams, std::chrono::microseconds maxWait, Callback callback)
+    :network(network), maxWait(maxWait), callback(std::move(callback)), pending(streams)
+{
+    if (streams < 1)
+    {
+        throw std::runtime_error("A batch scheduler needs at least one stream");
+    }
+    worker = std::thread(&BatchScheduler::run, this);
+}
+
+BatchScheduler::~BatchScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void BatchScheduler::submit(int stream, const cv::Mat& frame)
+{
+    if (stream < 0 || stream >= streamCount())
+    {
+        throw std::runtime_error("Unknown stream");
+    }
+    // An empty Mat marks a stream with nothing waiting
+    if (frame.empty())
+    {
+        throw std::runtime_error("Empty frame");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        if (pending[stream].empty())
+        {
+            if (pendingCount == 0)
+            {
+                oldestPending = std::chrono::steady_clock::now();
+            }
+            pendingCount++;
+        }
+        else
+        {
+            dropped++;
+        }
+        frame.copyTo(pending[stream]);
+    }
+    wake.notify_all();
+}
+
+void BatchScheduler::run()
+{
+    std::vector<cv::Mat> batch(streamCount());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]{ return stopping || pendingCount > 0; });
+        if (pendingCount == 0)
+        {
+            return;
+        }
+
+        // A partial batch waits for the other streams until its oldest frame is due
+        wake.wait_until(lock, oldestPending + maxWait, [this]{ return stopping || pendingCount == streamCount(); });
+
+        for (int i = 0; i < streamCount(); i++)
+        {
+            batch[i] = pending[i];
+            pending[i] = cv::Mat();
+        }
+        frames += pendingCount;
+        batches++;
+        pendingCount = 0;
+        lock.unlock();
+
+        try
+        {
+            const std::vector<Tensor<float>> classes = network.forwardBatch(batch);
+            for (int i = 0; i < streamCount(); i++)
+            {
+                if (!batch[i].empty())
+                {
+                    callback(i, classes[i]);
+                }
+            }
+        }
+        catch (...)
+        {
+            // Frames still waiting are left unrun
+            lock.lock();
+            error = std::current_exception();
+            stopping = true;
+            return;
+        }
+
+        lock.lock();
+    }
+}
+
+size_t BatchScheduler::batchesRun() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return batches;
+}
+
+size_t BatchScheduler::framesRun() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames;
+}
+
+size_t BatchScheduler::framesDropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+}
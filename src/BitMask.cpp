@@ -0,0 +1,377 @@
+#include "BitMask.hpp"
+#include "Util.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace MaskedCNN
+{
+
+static void setBits(uint64_t *row, int begin, int end)
+{
+    while (begin < end)
+    {
+        const int word = begin / 64;
+        const int bit = begin % 64;
+        const int n = std::min(64 - bit, end - begin);
+        const uint64_t bitsToSet = (n == 64) ? ~0ULL : (((1ULL << n) - 1) << bit);
+        row[word] |= bitsToSet;
+        begin += n;
+    }
+}
+
+BitMask::BitMask()
+{
+}
+
+BitMask::BitMask(int height, int width, int batch)
+{
+    resize(height, width, batch);
+}
+
+BitMask::BitMask(const Tensor<float>& mask)
+{
+    assign(mask);
+}
+
+void BitMask::assign(const Tensor<float>& mask)
+{
+    const int planeSize = mask.columnLength() * mask.rowLength();
+    resize(mask.columnLength(), mask.rowLength(), (planeSize > 0) ? mask.elementCount() / planeSize : 1);
+
+    const float *data = mask.dataAddress();
+    for (int y = 0; y < rows(); y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            if (data[y * w + x] != 0)
+            {
+                set(y, x);
+            }
+        }
+    }
+}
+
+void BitMask::resize(int height, int width, int batch)
+{
+    h = height;
+    w = width;
+    n = batch;
+    words = (width + 63) / 64;
+    bits.assign(n * h * words, 0);
+}
+
+bool BitMask::test(int y, int x) const
+{
+    assert(y >= 0 && y < rows() && x >= 0 && x < w);
+    return (bits[y * words + x / 64] >> (x % 64)) & 1;
+}
+
+void BitMask::set(int y, int x)
+{
+    assert(y >= 0 && y < rows() && x >= 0 && x < w);
+    bits[y * words + x / 64] |= 1ULL << (x % 64);
+}
+
+void BitMask::reset(int y, int x)
+{
+    assert(y >= 0 && y < rows() && x >= 0 && x < w);
+    bits[y * words + x / 64] &= ~(1ULL << (x % 64));
+}
+
+void BitMask::setRange(int y, int xBegin, int xEnd)
+{
+    setBits(row(y), std::max(xBegin, 0), std::min(xEnd, w));
+}
+
+bool BitMask::rowEmpty(int y) const
+{
+    const uint64_t *r = row(y);
+    for (int i = 0; i < words; i++)
+    {
+        if (r[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BitMask::zero()
+{
+    std::fill(bits.begin(), bits.end(), 0);
+}
+
+void BitMask::fill()
+{
+    zero();
+    for (int y = 0; y < rows(); y++)
+    {
+        setBits(row(y), 0, w);
+    }
+}
+
+void BitMask::merge(const BitMask& other)
+{
+    assert(sameShape(other));
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+        bits[i] |= other.bits[i];
+    }
+}
+
+int BitMask::count() const
+{
+    int result = 0;
+    for (uint64_t word : bits)
+    {
+        result += __builtin_popcountll(word);
+    }
+    return result;
+}
+
+double BitMask::howFilled() const
+{
+    return (double)count() / (double)(n * h * w);
+}
+
+bool BitMask::sameShape(const BitMask& other) const
+{
+    return h == other.h && w == other.w && n == other.n;
+}
+
+// range(i, begin, end) gives the [begin, end) output coordinates an input coordinate i reaches;
+// it is used for both axes, so rows are expanded once and then ORed into every output row they reach.
+// Rows only reach rows of their own frame.
+template<typename Range>
+void BitMask::expandFrom(const BitMask& prev, Range range)
+{
+    assert(prev.n == n);
+    zero();
+    rowBuffer.resize(words);
+
+    for (int iy = 0; iy < prev.rows(); iy++)
+    {
+        if (prev.rowEmpty(iy)) continue;
+
+        const int frame = iy / prev.h;
+        int yBegin, yEnd;
+        range(iy % prev.h, yBegin, yEnd);
+        yBegin = frame * h + std::max(yBegin, 0);
+        yEnd = frame * h + std::min(yEnd, h);
+        if (yBegin >= yEnd) continue;
+
+        std::fill(rowBuffer.begin(), rowBuffer.end(), 0);
+        const uint64_t *prevRow = prev.row(iy);
+        for (int i = 0; i < prev.words; i++)
+        {
+            uint64_t word = prevRow[i];
+            while (word)
+            {
+                const int ix = i * 64 + __builtin_ctzll(word);
+                word &= word - 1;
+
+                int xBegin, xEnd;
+                range(ix, xBegin, xEnd);
+                setBits(rowBuffer.data(), std::max(xBegin, 0), std::min(xEnd, w));
+            }
+        }
+
+        for (int y = yBegin; y < yEnd; y++)
+        {
+            uint64_t *r = row(y);
+            for (int i = 0; i < words; i++)
+            {
+                r[i] |= rowBuffer[i];
+            }
+        }
+    }
+}
+
+void BitMask::convolveFrom(const BitMask& prev, int filterSize, int stride, int pad)
+{
+    expandFrom(prev, [=](int i, int& begin, int& end)
+    {
+        begin = ceilDiv(i + pad - filterSize + 1, stride);
+        end = floorDiv(i + pad, stride) + 1;
+    });
+}
+
+void BitMask::deconvolveFrom(const BitMask& prev, int filterSize, int stride, int pad)
+{
+    expandFrom(prev, [=](int i, int& begin, int& end)
+    {
+        begin = i * stride - pad;
+        end = begin + filterSize;
+    });
+}
+
+// out = in shifted by -radius..radius bits and ORed, across word boundaries
+static void dilateRow(const uint64_t *in, uint64_t *out, int words, int radius)
+{
+    for (int i = 0; i < words; i++)
+    {
+        uint64_t word = in[i];
+        for (int s = 1; s <= radius; s++)
+        {
+            word |= (in[i] << s) | (in[i] >> s);
+            if (i > 0)
+            {
+                word |= in[i - 1] >> (64 - s);
+            }
+            if (i + 1 < words)
+            {
+                word |= in[i + 1] << (64 - s);
+            }
+        }
+        out[i] = word;
+    }
+}
+
+// Separable: the rows in reach are combined first, then the combined row is spread sideways.
+// Erosion is the dilation of the complement, complemented.
+template<bool erode>
+void BitMask::morphologyFrom(const BitMask& prev, int radius)
+{
+    assert(radius >= 0 && radius < 64 && &prev != this);
+    resize(prev.h, prev.w, prev.n);
+    if (words == 0)
+    {
+        return;
+    }
+    rowBuffer.resize(2 * words);
+    uint64_t *combined = rowBuffer.data();
+    uint64_t *spread = combined + words;
+    const uint64_t lastWord = (w % 64 == 0) ? ~0ULL : (1ULL << (w % 64)) - 1;
+
+    for (int y = 0; y < rows(); y++)
+    {
+        const int frameBegin = (y / h) * h;
+        const int yBegin = std::max(y - radius, frameBegin);
+        const int yEnd = std::min(y + radius + 1, frameBegin + h);
+
+        std::fill_n(combined, words, erode ? ~0ULL : 0);
+        for (int iy = yBegin; iy < yEnd; iy++)
+        {
+            const uint64_t *r = prev.row(iy);
+            for (int i = 0; i < words; i++)
+            {
+                combined[i] = erode ? (combined[i] & r[i]) : (combined[i] | r[i]);
+            }
+        }
+
+        if (erode)
+        {
+            for (int i = 0; i < words; i++)
+            {
+                combined[i] = ~combined[i];
+            }
+            combined[words - 1] &= lastWord;
+        }
+        dilateRow(combined, spread, words, radius);
+
+        uint64_t *r = row(y);
+        for (int i = 0; i < words; i++)
+        {
+            r[i] = erode ? ~spread[i] : spread[i];
+        }
+        r[words - 1] &= lastWord;
+    }
+}
+
+void BitMask::dilateFrom(const BitMask& prev, int radius)
+{
+    morphologyFrom<false>(prev, radius);
+}
+
+void BitMask::erodeFrom(const BitMask& prev, int radius)
+{
+    morphologyFrom<true>(prev, radius);
+}
+
+int BitMask::activeIndex(std::vector<int>& index) const
+{
+    index.clear();
+    for (int y = 0; y < rows(); y++)
+    {
+        const uint64_t *r = row(y);
+        for (int i = 0; i < words; i++)
+        {
+            uint64_t word = r[i];
+            while (word)
+            {
+                index.push_back(y * w + i * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+    return index.size();
+}
+
+Tensor<float> BitMask::toTensor() const
+{
+    Tensor<float> result = (n == 1) ? Tensor<float>(Shape{h, w}) : Tensor<float>(Shape{n, h, w});
+    float *data = result.dataAddress();
+    for (int y = 0; y < rows(); y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            data[y * w + x] = test(y, x) ? 1 : 0;
+        }
+    }
+    return result;
+}
+
+
+TileMask::TileMask(int tileSize)
+    :size(tileSize)
+{
+}
+
+void TileMask::setTileSize(int tileSize)
+{
+    size = tileSize;
+}
+
+void TileMask::build(const BitMask& mask)
+{
+    const int frameRows = (mask.height() + size - 1) / size;
+    rows = mask.batch() * frameRows;
+    cols = (mask.width() + size - 1) / size;
+    tiles.assign(rows * cols, 0);
+
+    for (int y = 0; y < mask.rows(); y++)
+    {
+        const uint64_t *r = mask.row(y);
+        uint8_t *tileRow = &tiles[((y / mask.height()) * frameRows + (y % mask.height()) / size) * cols];
+        for (int i = 0; i < mask.wordsPerRow(); i++)
+        {
+            uint64_t word = r[i];
+            while (word)
+            {
+                const int x = i * 64 + __builtin_ctzll(word);
+                const int tx = x / size;
+                tileRow[tx] = 1;
+
+                // The rest of this tile's span in the word is already accounted for
+                const int tileEnd = (tx + 1) * size - i * 64;
+                if (tileEnd >= 64)
+                {
+                    break;
+                }
+                word &= ~0ULL << tileEnd;
+            }
+        }
+    }
+}
+
+int TileMask::count() const
+{
+    return std::count(tiles.begin(), tiles.end(), 1);
+}
+
+double TileMask::howFilled() const
+{
+    return (double)count() / (double)(rows * cols);
+}
+
+}
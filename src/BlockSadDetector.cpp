@@ -0,0 +1,163 @@
+#include "BlockSadDetector.hpp"
+#include "ThreadPool.hpp"
+#include "Simd.hpp"
+#include <cstdlib>
+#include <cstring>
+
+namespace MaskedCNN
+{
+
+static int rowSad(const uint8_t *a, const uint8_t *b, int n)
+{
+    int sum = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i)),
+                                              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i))));
+    }
+    sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#endif
+    for (; i < n; i++)
+    {
+        sum += std::abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+BlockSadDetector::BlockSadDetector(int threshold, int blockSize)
+    :high(threshold), size(blockSize)
+{
+    if (blockSize < 1)
+    {
+        throw std::runtime_error("Block size has to be at least 1");
+    }
+}
+
+void BlockSadDetector::setThreshold(int threshold)
+{
+    high = threshold;
+}
+
+void BlockSadDetector::setReference(const cv::Mat &frame)
+{
+    assert(frame.type() == CV_8UC3);
+    frame.copyTo(reference);
+    blocksY = (frame.rows + size - 1) / size;
+    blocksX = (frame.cols + size - 1) / size;
+
+    sad.assign(blocksY * blocksX, 0);
+    area.resize(blocksY * blocksX);
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            area[by * blocksX + bx] = (std::min(size, frame.rows - by * size)) * (std::min(size, frame.cols - bx * size));
+        }
+    }
+    marked.assign(blocksY * blocksX, 0);
+    wasMarked.assign(blocksY * blocksX, 0);
+
+    changed.resize(frame.rows, frame.cols);
+    changed.zero();
+}
+
+const BitMask& BlockSadDetector::detect(const cv::Mat &frame)
+{
+    if (frame.rows != reference.rows || frame.cols != reference.cols || reference.empty())
+    {
+        setReference(frame);
+        return changed;
+    }
+
+    const int height = frame.rows;
+    const int width = frame.cols;
+    ThreadPool::global().parallelFor(blocksY, [&](int begin, int end)
+    {
+        for (int by = begin; by < end; by++)
+        {
+            int *blockSad = &sad[by * blocksX];
+            std::fill_n(blockSad, blocksX, 0);
+            for (int y = by * size; y < std::min((by + 1) * size, height); y++)
+            {
+                const uint8_t *current = frame.ptr<uint8_t>(y);
+                const uint8_t *ref = reference.ptr<uint8_t>(y);
+                for (int bx = 0; bx < blocksX; bx++)
+                {
+                    const int x = bx * size;
+                    blockSad[bx] += rowSad(current + 3 * x, ref + 3 * x, 3 * std::min(size, width - x));
+                }
+            }
+        }
+    });
+
+    // Hysteresis, over the blocks only
+    std::swap(marked, wasMarked);
+    auto above = [&](int by, int bx, int limit)
+    {
+        const int b = by * blocksX + bx;
+        return sad[b] > limit * area[b];
+    };
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            const int b = by * blocksX + bx;
+            bool mark = above(by, bx, high);
+            if (!mark && above(by, bx, high / 2))
+            {
+                mark = wasMarked[b];
+                for (int ny = std::max(by - 1, 0); ny <= std::min(by + 1, blocksY - 1) && !mark; ny++)
+                {
+                    for (int nx = std::max(bx - 1, 0); nx <= std::min(bx + 1, blocksX - 1) && !mark; nx++)
+                    {
+                        mark = above(ny, nx, high);
+                    }
+                }
+            }
+            marked[b] = mark;
+        }
+    }
+
+    // The network recomputes the marked blocks, so they become the new reference there
+    ThreadPool::global().parallelFor(blocksY, [&](int begin, int end)
+    {
+        for (int by = begin; by < end; by++)
+        {
+            const int yEnd = std::min((by + 1) * size, height);
+            for (int y = by * size; y < yEnd; y++)
+            {
+                std::fill_n(changed.row(y), changed.wordsPerRow(), 0);
+            }
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                if (!marked[by * blocksX + bx])
+                {
+                    continue;
+                }
+                const int x = bx * size;
+                const int w = std::min(size, width - x);
+                for (int y = by * size; y < yEnd; y++)
+                {
+                    changed.setRange(y, x, x + w);
+                    std::memcpy(reference.ptr<uint8_t>(y) + 3 * x, frame.ptr<uint8_t>(y) + 3 * x, 3 * w);
+                }
+            }
+        }
+    });
+    return changed;
+}
+
+std::unique_ptr<MaskGenerator> BlockSadDetector::clone() const
+{
+    return std::make_unique<BlockSadDetector>(high, size);
+}
+
+}
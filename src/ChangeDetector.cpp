@@ -0,0 +1,189 @@
+#include "ChangeDetector.hpp"
+#include "ThreadPool.hpp"
+#include "Simd.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+namespace MaskedCNN
+{
+
+ChangeDetector::ChangeDetector(int threshold, int downsample)
+    :factor(downsample)
+{
+    if (downsample < 1)
+    {
+        throw std::runtime_error("Downsampling factor has to be at least 1");
+    }
+    setThreshold(threshold);
+}
+
+void ChangeDetector::setThreshold(int threshold)
+{
+    // A saturated accumulator still has to exceed it
+    limit = std::min(threshold, 65534);
+}
+
+void ChangeDetector::setReference(const cv::Mat &frame)
+{
+    assert(frame.type() == CV_8UC3);
+    height = frame.rows;
+    width = frame.cols;
+    const int sampledHeight = (height + factor - 1) / factor;
+    const int sampledWidth = (width + factor - 1) / factor;
+
+    previous.resize(sampledHeight * sampledWidth * 3);
+    for (int sy = 0; sy < sampledHeight; sy++)
+    {
+        const uint8_t *row = frame.ptr<uint8_t>(std::min(sy * factor + factor / 2, height - 1));
+        for (int sx = 0; sx < sampledWidth; sx++)
+        {
+            std::copy_n(row + 3 * std::min(sx * factor + factor / 2, width - 1), 3, &previous[(sy * sampledWidth + sx) * 3]);
+        }
+    }
+    accumulated.assign(sampledHeight * sampledWidth, 0);
+
+    sampled.resize(sampledHeight, sampledWidth);
+    changed.resize(height, width);
+    changed.zero();
+}
+
+const BitMask& ChangeDetector::detect(const cv::Mat &frame)
+{
+    if (frame.rows != height || frame.cols != width || previous.empty())
+    {
+        setReference(frame);
+        return changed;
+    }
+
+    if (factor == 1)
+    {
+        detectFull(frame);
+    }
+    else
+    {
+        detectDownsampled(frame);
+    }
+    return changed;
+}
+
+void ChangeDetector::detectFull(const cv::Mat &frame)
+{
+    ThreadPool::global().parallelFor(height, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            const uint8_t *current = frame.ptr<uint8_t>(y);
+            uint8_t *prev = &previous[y * width * 3];
+            uint16_t *accum = &accumulated[y * width];
+            uint64_t *bits = changed.row(y);
+            std::fill_n(bits, changed.wordsPerRow(), 0);
+
+            int x = 0;
+#if defined(__AVX2__)
+            // a > limit as a >= limit + 1, unsigned
+            const __m256i bound = _mm256_set1_epi16((short)std::max(limit + 1, 0));
+            for (; x + 16 <= width; x += 16)
+            {
+                __m128i diff[3];
+                for (int b = 0; b < 3; b++)
+                {
+                    __m128i *p = reinterpret_cast<__m128i*>(prev + 3 * x + 16 * b);
+                    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + 3 * x + 16 * b));
+                    const __m128i q = _mm_loadu_si128(p);
+                    diff[b] = _mm_or_si128(_mm_subs_epu8(c, q), _mm_subs_epu8(q, c));
+                    _mm_storeu_si128(p, c);
+                }
+
+                const __m256i sum = _mm256_add_epi16(_mm256_add_epi16(
+                        _mm256_cvtepu8_epi16(bgrChannel<0>(diff)),
+                        _mm256_cvtepu8_epi16(bgrChannel<1>(diff))),
+                        _mm256_cvtepu8_epi16(bgrChannel<2>(diff)));
+
+                __m256i *a = reinterpret_cast<__m256i*>(accum + x);
+                const __m256i total = _mm256_adds_epu16(_mm256_loadu_si256(a), sum);
+                const __m256i over = _mm256_cmpeq_epi16(_mm256_max_epu16(total, bound), total);
+                _mm256_storeu_si256(a, _mm256_andnot_si256(over, total));
+
+                // 16 pixels never straddle a word, x being a multiple of 16
+                const __m128i flags = _mm_packs_epi16(_mm256_castsi256_si128(over), _mm256_extracti128_si256(over, 1));
+                bits[x / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(flags) << (x % 64);
+            }
+#endif
+            for (; x < width; x++)
+            {
+                int sum = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    sum += std::abs(current[3 * x + c] - prev[3 * x + c]);
+                    prev[3 * x + c] = current[3 * x + c];
+                }
+                const int total = std::min(accum[x] + sum, 65535);
+                if (total > limit)
+                {
+                    bits[x / 64] |= uint64_t(1) << (x % 64);
+                    accum[x] = 0;
+                }
+                else
+                {
+                    accum[x] = total;
+                }
+            }
+        }
+    }, 4);
+}
+
+void ChangeDetector::detectDownsampled(const cv::Mat &frame)
+{
+    const int sampledHeight = sampled.height();
+    const int sampledWidth = sampled.width();
+    // Copies the byte stores below can't alias
+    const int f = factor;
+    const int lastColumn = width - 1;
+    const int bound = limit;
+
+    ThreadPool::global().parallelFor(sampledHeight, [&](int begin, int end)
+    {
+        for (int sy = begin; sy < end; sy++)
+        {
+            const uint8_t *row = frame.ptr<uint8_t>(std::min(sy * f + f / 2, height - 1));
+            uint8_t *prev = &previous[sy * sampledWidth * 3];
+            uint16_t *accum = &accumulated[sy * sampledWidth];
+            uint64_t *bits = sampled.row(sy);
+            std::fill_n(bits, sampled.wordsPerRow(), 0);
+            for (int sx = 0; sx < sampledWidth; sx++)
+            {
+                const uint8_t *current = row + 3 * std::min(sx * f + f / 2, lastColumn);
+                const int b = current[0], g = current[1], r = current[2];
+                const int sum = std::abs(b - prev[3 * sx]) + std::abs(g - prev[3 * sx + 1]) + std::abs(r - prev[3 * sx + 2]);
+                prev[3 * sx] = b;
+                prev[3 * sx + 1] = g;
+                prev[3 * sx + 2] = r;
+
+                const int total = std::min(accum[sx] + sum, 65535);
+                const bool over = total > bound;
+                bits[sx / 64] |= uint64_t(over) << (sx % 64);
+                accum[sx] = over ? 0 : total;
+            }
+
+            // Every changed sample marks its whole block
+            const int y = sy * f;
+            const int rowCount = std::min(f, height - y);
+            std::fill_n(changed.row(y), changed.wordsPerRow(), 0);
+            sampled.forEachRun(sy, [&](int xBegin, int xEnd)
+            {
+                changed.setRange(y, xBegin * f, std::min(xEnd * f, width));
+            });
+            for (int dy = 1; dy < rowCount; dy++)
+            {
+                std::copy_n(changed.row(y), changed.wordsPerRow(), changed.row(y + dy));
+            }
+        }
+    });
+}
+
+std::unique_ptr<MaskGenerator> ChangeDetector::clone() const
+{
+    return std::make_unique<ChangeDetector>(limit, factor);
+}
+
+}
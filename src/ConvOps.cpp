@@ -1,7 +1,11 @@
+#include "ConvOps.hpp"
 #include "Tensor.hpp"
 #include "Util.hpp"
+#include "ThreadPool.hpp"
+#include "Gemm.hpp"
 #include "../maskedcnncuda/ConvOpsCuda.h"
 #include <cublas_v2.h>
+#include <algorithm>
 
 namespace MaskedCNN {
 
@@ -114,158 +118,168 @@ void transposedConvolution(const Tensor<float>& input, const Tensor<float>& filt
 
 // Thanks to https://github.com/BVLC/caffe/blob/master/src/caffe/util/im2col.cpp for the reference implementation
 
-void im2col(const Tensor<float>& im, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col)
+// C [filter.rows() x n] = filter * B [filter.cols() x n], rows ldb and ldc apart
+static void multiplyWeights(const PackedWeights& filter, int n, const float *b, int ldb, float *c, int ldc)
 {
-    auto dataCol = col.dataAddress();
-    auto dataIm = im.dataAddress();
-    const int outputHeight = (inputHeight + 2 * pad - filterSize) / stride + 1;
-    const int outputWidth = (inputWidth + 2 * pad - filterSize) / stride + 1;
-    const int channelSize = inputHeight * inputWidth;
+    if (filter.transposed())
+    {
+        blasSgemm(true, false, filter.rows(), n, filter.cols(), filter.data(), filter.stride(), b, ldb, c, ldc);
+    }
+    else
+    {
+        sgemm(filter.rows(), n, filter.cols(), filter.data(), filter.stride(), b, ldb, c, ldc);
+    }
+}
+
+static void multiplyWeights(const PackedWeights& filter, int n, const float *b, float *c)
+{
+    multiplyWeights(filter, n, b, n, c, n);
+}
+
+// Distance between the channels of a [channels, height, width] view whose channels are each
+// one contiguous block, so it can be a GEMM operand of height * width columns
+template<typename T>
+static int planarStride(const TensorView<T>& view)
+{
+    assert(view.stride(2) == 1 && (view.columnLength() == 1 || view.stride(1) == view.rowLength()));
+    return view.stride(0);
+}
+
+// Output rows packed by one task of im2col; large frames split into enough tasks for all cores
+static constexpr int rowBand = 32;
+
+// Range of output columns [begin, end) whose input column x * stride - pad + fx lies inside the image
+static void validColumns(int inputWidth, int outputWidth, int fx, int pad, int stride, int& begin, int& end)
+{
+    begin = std::min(std::max(ceilDiv(pad - fx, stride), 0), outputWidth);
+    end = std::max(std::min(floorDiv(inputWidth - 1 + pad - fx, stride) + 1, outputWidth), begin);
+}
 
-    for (int channel = 0; channel < inputChannels; dataIm += channelSize, channel++)
+// Packs output columns [xBegin, xEnd) of one image row for filter column fx: the padding
+// is written as two zero runs, so the interior copy has no bounds checks
+static float *packRow(const float *imRow, int xBegin, int xEnd, int validBegin, int validEnd, int fx, int pad, int stride, float *dataCol)
+{
+    const int begin = std::min(std::max(validBegin, xBegin), xEnd);
+    const int end = std::max(std::min(validEnd, xEnd), begin);
+
+    dataCol = std::fill_n(dataCol, begin - xBegin, 0.0f);
+    const float *src = imRow + begin * stride - pad + fx;
+    const int n = end - begin;
+    if (stride == 1)
     {
-        for (int fy = 0; fy < filterSize; fy++)
+        dataCol = std::copy(src, src + n, dataCol);
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
         {
-            for (int fx = 0; fx < filterSize; fx++)
-            {
-                int y = -pad + fy;
-                for (int outputRows = 0; outputRows < outputHeight; outputRows++)
-                {
-                    if (y < 0 || y >= inputHeight)
-                    {
-                        for (int outputCols = 0; outputCols < outputWidth; outputCols++)
-                        {
-                            *(dataCol++) = 0;
-                        }
-                    }
-                    else
-                    {
-                        int x = -pad + fx;
-                        for (int outputCols = 0; outputCols < outputWidth; outputCols++)
-                        {
-                            if (x >= 0 && x < inputWidth)
-                            {
-                                *(dataCol++) = im(channel, y, x);
-                            }
-                            else
-                            {
-                                *(dataCol++) = 0;
-                            }
-                            x += stride;
-                        }
-                    }
-                    y += stride;
-                }
-            }
+            dataCol[i] = src[i * stride];
         }
+        dataCol += n;
     }
+    return std::fill_n(dataCol, xEnd - end, 0.0f);
 }
 
-int im2colMasked(const Tensor<float>& im, const Tensor<float>& mask, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col)
+void im2col(TensorView<const float> im, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col)
 {
-    auto dataCol = col.dataAddress();
-    auto dataIm = im.dataAddress();
-    auto dataMask = mask.dataAddress();
+    assert(im.stride(2) == 1);
+    float *dataCol = col.dataAddress();
+    const float *dataIm = im.dataAddress();
     const int outputHeight = (inputHeight + 2 * pad - filterSize) / stride + 1;
     const int outputWidth = (inputWidth + 2 * pad - filterSize) / stride + 1;
-    const int channelSize = inputHeight * inputWidth;
-
-    int patchesToProcess = 0;
-
-    for (int channel = 0; channel < inputChannels; dataIm += channelSize, channel++)
+    const int channelStride = im.stride(0);
+    const int rowStride = im.stride(1);
+    const int colSize = outputHeight * outputWidth;
+    const int rows = inputChannels * filterSize * filterSize;
+    const int bands = (outputHeight + rowBand - 1) / rowBand;
+
+    // Every task fills a band of output rows of one column row: [channel, fy, fx] x [rows]
+    ThreadPool::global().parallelFor(rows * bands, [&](int begin, int end)
     {
-        for (int fy = 0; fy < filterSize; fy++)
+        for (int task = begin; task < end; task++)
         {
-            for (int fx = 0; fx < filterSize; fx++)
+            const int row = task / bands;
+            const int channel = row / (filterSize * filterSize);
+            const int fy = row / filterSize % filterSize;
+            const int fx = row % filterSize;
+            const int rowBegin = (task % bands) * rowBand;
+            const int rowEnd = std::min(rowBegin + rowBand, outputHeight);
+
+            int validBegin, validEnd;
+            validColumns(inputWidth, outputWidth, fx, pad, stride, validBegin, validEnd);
+
+            const float *channelIm = dataIm + channel * channelStride;
+            float *rowCol = dataCol + row * colSize + rowBegin * outputWidth;
+            for (int outputRow = rowBegin; outputRow < rowEnd; outputRow++)
             {
-                int y = -pad + fy;
-                for (int outputRows = 0; outputRows < outputHeight; outputRows++)
+                const int y = outputRow * stride - pad + fy;
+                if (y < 0 || y >= inputHeight)
                 {
-                    if (y < 0 || y >= inputHeight)
-                    {
-                        for (int outputCols = 0; outputCols < outputWidth; outputCols++)
-                        {
-                            if (dataMask[outputRows * outputWidth + outputCols] > 0)
-                            {
-                                patchesToProcess++;
-                                *(dataCol++) = 0;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        int x = -pad + fx;
-                        for (int outputCols = 0; outputCols < outputWidth; outputCols++)
-                        {
-                            // Most important part: just skip if we don't need
-                            // to compute (outputRows, outputCols)
-                            if (dataMask[outputRows * outputWidth + outputCols] > 0)
-                            {
-                                patchesToProcess++;
-                                if (x >= 0 && x < inputWidth)
-                                {
-                                    *(dataCol++) = im(channel, y, x);
-                                }
-                                else
-                                {
-                                    *(dataCol++) = 0;
-                                }
-                            }
-
-                            x += stride;
-                        }
-                    }
-                    y += stride;
+                    rowCol = std::fill_n(rowCol, outputWidth, 0.0f);
+                }
+                else
+                {
+                    rowCol = packRow(channelIm + y * rowStride, 0, outputWidth, validBegin, validEnd, fx, pad, stride, rowCol);
                 }
             }
         }
-    }
-
-    assert(patchesToProcess % inputChannels * filterSize * filterSize == 0);
-    return patchesToProcess / (inputChannels * filterSize * filterSize);
+    });
 }
 
-void col2im(const Tensor<float>& col, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& im)
+int im2colMasked(TensorView<const float> im, const Tensor<float>& mask, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, Tensor<float>& col)
 {
-    im.zero();
+    const int outputWidth = (inputWidth + 2 * pad - filterSize) / stride + 1;
+
+    std::vector<int> index;
+    const int patches = buildMaskIndex(mask, index);
+    im2colIndexed(im, index, inputChannels, inputHeight, inputWidth, outputWidth, filterSize, pad, stride, col.dataAddress());
+    return patches;
+}
 
-    auto dataCol = col.dataAddress();
-    auto dataIm = im.dataAddress();
+void col2im(const float *col, int inputChannels, int inputHeight, int inputWidth, int filterSize, int pad, int stride, TensorView<float> im)
+{
+    assert(im.stride(2) == 1);
+    const float *dataCol = col;
+    float *dataIm = im.dataAddress();
     const int outputHeight = (inputHeight + 2 * pad - filterSize) / stride + 1;
     const int outputWidth = (inputWidth + 2 * pad - filterSize) / stride + 1;
-    const int channelSize = inputHeight * inputWidth;
+    const int rowStride = im.stride(1);
+    const int colSize = outputHeight * outputWidth;
 
-    for (int channel = inputChannels; channel--; dataIm += channelSize)
+    // Channels accumulate independently, all filter offsets of a channel stay in one task
+    ThreadPool::global().parallelFor(inputChannels, [&](int begin, int end)
     {
-        for (int fy = 0; fy < filterSize; fy++)
+        for (int channel = begin; channel < end; channel++)
         {
-            for (int fx = 0; fx < filterSize; fx++)
+            float *channelIm = dataIm + channel * im.stride(0);
+            for (int y = 0; y < inputHeight; y++)
+            {
+                std::fill_n(channelIm + y * rowStride, inputWidth, 0.0f);
+            }
+
+            for (int fy = 0; fy < filterSize; fy++)
             {
-                int y = -pad + fy;
-                for (int outputRows = outputHeight; outputRows; outputRows--)
+                for (int fx = 0; fx < filterSize; fx++)
                 {
-                    if (y < 0 || y >= inputHeight)
-                    {
-                        dataCol += outputWidth;
-                    }
-                    else
+                    int validBegin, validEnd;
+                    validColumns(inputWidth, outputWidth, fx, pad, stride, validBegin, validEnd);
+
+                    const float *rowCol = dataCol + ((channel * filterSize + fy) * filterSize + fx) * colSize;
+                    for (int outputRow = 0; outputRow < outputHeight; outputRow++, rowCol += outputWidth)
                     {
-                        int x = -pad + fx;
-                        for (int outputCols = outputWidth; outputCols; outputCols--)
+                        const int y = outputRow * stride - pad + fy;
+                        if (y < 0 || y >= inputHeight) continue;
+
+                        float *imRow = channelIm + y * rowStride + validBegin * stride - pad + fx;
+                        for (int x = validBegin; x < validEnd; x++, imRow += stride)
                         {
-                            if (x >= 0 && x < inputWidth)
-                            {
-                                dataIm[y * inputWidth + x] += *dataCol;
-                            }
-                            dataCol++;
-                            x += stride;
+                            *imRow += rowCol[x];
                         }
                     }
-                    y += stride;
                 }
             }
         }
-    }
+    });
 }
 
 
@@ -288,15 +302,10 @@ void convolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter,
         throw std::runtime_error("UNDEFINED POSITION");
         break;
     case DataPosition::CPU:
-        colBuffer.toCpu().resize(std::vector<int>{inputChannels*filterSize*filterSize, outputHeight * outputWidth});
-        im2col(input, inputChannels, inputHeight, inputWidth, filterSize, pad, stride, colBuffer);
-        std::cout << colBuffer.toString();
-        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
-                    1.0, filter.dataAddress(), k, colBuffer.dataAddress(),
-                    n, 0., out.dataAddress(), n);
+        convolutionIm2Col(input, PackedWeights(filter), colBuffer, out, filterSize, stride, pad);
         break;
     case DataPosition::GPU:
-        colBuffer.toGpu().resize(std::vector<int>{inputChannels*filterSize*filterSize, outputHeight * outputWidth});
+        colBuffer.toGpu().resize({inputChannels*filterSize*filterSize, outputHeight * outputWidth});
         im2col_gpu(input.gpuDataAddress(), inputChannels, inputHeight, inputWidth, filterSize, pad, stride, colBuffer.gpuDataAddress());
         cublasStatus_t stat;
         cublasHandle_t handle;
@@ -313,51 +322,70 @@ void convolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter,
     }
 }
 
-void transposedConvolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& out, int filterSize, int stride, int pad)
+void convolutionIm2Col(TensorView<const float> input, const PackedWeights& filter, Tensor<float> &colBuffer, TensorView<float> out, int filterSize, int stride, int pad)
 {
-    const int outputChannels = out.dimensions()[0];
+    if (input.dimensionCount() == 4)
+    {
+        // One frame after another through the same columns
+        for (int n = 0; n < input.dimensions()[0]; n++)
+        {
+            convolutionIm2Col(input.frame(n), filter, colBuffer, out.frame(n), filterSize, stride, pad);
+        }
+        return;
+    }
+
     const int outputHeight = out.dimensions()[1];
     const int outputWidth = out.dimensions()[2];
     const int inputChannels = input.dimensions()[0];
     const int inputHeight = input.dimensions()[1];
     const int inputWidth = input.dimensions()[2];
 
-    colBuffer.resize(std::vector<int>{outputChannels*filterSize*filterSize, inputHeight * inputWidth});
+    assert(filter.cols() == inputChannels * filterSize * filterSize);
 
-    int m = outputChannels * filterSize * filterSize;
-    int n = inputHeight * inputWidth;
-    int k = inputChannels;
+    colBuffer.toCpu().resize({inputChannels*filterSize*filterSize, outputHeight * outputWidth});
+    im2col(input, inputChannels, inputHeight, inputWidth, filterSize, pad, stride, colBuffer);
+    const int n = outputHeight * outputWidth;
+    multiplyWeights(filter, n, colBuffer.dataAddress(), n, out.dataAddress(), planarStride(out));
+}
 
-    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, m, n, k,
-                1.0, filter.dataAddress(), m, input.dataAddress(),
-                n, 0., colBuffer.dataAddress(), n);
+void transposedConvolutionIm2Col(const Tensor<float>& input, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& out, int filterSize, int stride, int pad)
+{
+    transposedConvolutionIm2Col(input, PackedWeights::transposedView(filter), colBuffer, out, filterSize, stride, pad);
+}
+
+void transposedConvolutionIm2Col(TensorView<const float> input, const PackedWeights& filter, Tensor<float> &colBuffer, TensorView<float> out, int filterSize, int stride, int pad)
+{
+    const int frames = batchSize(input.dimensions());
+    const int outputChannels = out.channelLength();
+    const int outputHeight = out.columnLength();
+    const int outputWidth = out.rowLength();
+    const int inputChannels = input.channelLength();
+    const int inputHeight = input.columnLength();
+    const int inputWidth = input.rowLength();
+
+    assert(filter.rows() == outputChannels * filterSize * filterSize && filter.cols() == inputChannels);
+
+    // The columns of every frame are kept, [frames, rows, n], for indexed passes on later frames
+    const int m = outputChannels * filterSize * filterSize;
+    const int n = inputHeight * inputWidth;
+    colBuffer.resize((input.dimensionCount() == 4) ? Shape{frames, m, n} : Shape{m, n});
+    for (int f = 0; f < frames; f++)
+    {
+        const TensorView<const float> inputFrame = input.frame(f);
+        float *frameColumns = colBuffer.dataAddress() + f * m * n;
+        multiplyWeights(filter, n, inputFrame.dataAddress(), planarStride(inputFrame), frameColumns, n);
 
-    col2im(colBuffer, outputChannels, outputHeight, outputWidth, filterSize, pad, stride, out);
+        col2im(frameColumns, outputChannels, outputHeight, outputWidth, filterSize, pad, stride, out.frame(f));
+    }
 }
 
 void convolutionIm2ColMasked(const Tensor<float>& input, const Tensor<float>& mask, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, Tensor<float>& out, int filterSize, int stride, int pad)
 {
-    const int outputChannels = out.dimensions()[0];
-    const int outputHeight = out.dimensions()[1];
     const int outputWidth = out.dimensions()[2];
-    const int inputChannels = input.dimensions()[0];
-    const int inputHeight = input.dimensions()[1];
-    const int inputWidth = input.dimensions()[2];
-
-    // Always allocate for the worst case (have to process everything)
-    colBuffer.resize(std::vector<int>{inputChannels*filterSize*filterSize, outputHeight * outputWidth});
-    outBuffer.resize(out.dimensions());
-
-    int patches = im2colMasked(input, mask, inputChannels, inputHeight, inputWidth, filterSize, pad, stride, colBuffer);
 
-    int m = outputChannels;
-    int n = patches;
-    int k = inputChannels * filterSize * filterSize;
-
-    auto outBufferData = outBuffer.dataAddress();
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
-                1.0, filter.dataAddress(), k, colBuffer.dataAddress(),
-                n, 0., outBufferData, n);
+    std::vector<int> index;
+    buildMaskIndex(mask, index);
+    convolutionIm2ColIndexed(input, index, filter, colBuffer, outBuffer, outputWidth, filterSize, stride, pad);
 }
 
 void transposedConvolutionIm2ColMasked(const Tensor<float>& input, Tensor<float>& inputBuffer, const Tensor<float>& prevMask, const Tensor<float>& filter, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& out, int filterSize, int stride, int pad)
@@ -369,8 +397,8 @@ void transposedConvolutionIm2ColMasked(const Tensor<float>& input, Tensor<float>
     const int inputHeight = input.dimensions()[1];
     const int inputWidth = input.dimensions()[2];
 
-    colBuffer.resize(std::vector<int>{outputChannels*filterSize*filterSize, inputHeight * inputWidth});
-    anotherBuffer.resize(std::vector<int>{outputChannels*filterSize*filterSize, inputHeight * inputWidth});
+    colBuffer.resize({outputChannels*filterSize*filterSize, inputHeight * inputWidth});
+    anotherBuffer.resize({outputChannels*filterSize*filterSize, inputHeight * inputWidth});
     inputBuffer.resize(input.dimensions());
     inputBuffer.zero();
     anotherBuffer.zero();
@@ -409,9 +437,8 @@ void transposedConvolutionIm2ColMasked(const Tensor<float>& input, Tensor<float>
     int n = inputHeight * inputWidth;
     int k = inputChannels;
 
-    cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans, m, patches, k,
-                1.0, filter.dataAddress(), m, inputBuffer.dataAddress(),
-                n, 0., anotherBuffer.dataAddress(), patches);
+    blasSgemm(true, false, m, patches, k, filter.dataAddress(), m, inputBuffer.dataAddress(),
+              n, anotherBuffer.dataAddress(), patches);
 
     prevMaskData = prevMask.dataAddress();
     auto anotherBufferData = anotherBuffer.dataAddress();
@@ -428,7 +455,7 @@ void transposedConvolutionIm2ColMasked(const Tensor<float>& input, Tensor<float>
         }
     }
 
-    col2im(colBuffer, outputChannels, outputHeight, outputWidth, filterSize, pad, stride, out);
+    col2im(colBuffer.dataAddress(), outputChannels, outputHeight, outputWidth, filterSize, pad, stride, out);
 }
 
 
@@ -461,49 +488,442 @@ void convolutionIm2ColMaskedPlaceBufferBack(const Tensor<float>& mask, Tensor<fl
 
 
 
-void convolveMaskIm2Col(const Tensor<float>& prevMask, Tensor<float>& mask, Tensor<float>& colBuffer, int filterSize, int stride, int pad)
+// Number of patches gathered together; keeps the per-patch offsets of a block in L1
+// while all rows of the column buffer are filled for it
+static constexpr int patchBlock = 64;
+
+static void ensureCapacity(Tensor<float>& buffer, int rows, int columns)
+{
+    // Buffers only grow, so a frame with fewer active pixels does not reallocate
+    const int blockedColumns = (columns + patchBlock - 1) / patchBlock * patchBlock;
+    if (buffer.position() != DataPosition::CPU || buffer.elementCount() < rows * blockedColumns)
+    {
+        buffer.toCpu().resize({rows, blockedColumns});
+    }
+}
+
+int buildMaskIndex(const Tensor<float>& mask, std::vector<int>& index)
+{
+    const float *maskData = mask.dataAddress();
+    const int els = mask.elementCount();
+
+    index.clear();
+    for (int i = 0; i < els; i++)
+    {
+        if (maskData[i] > 0)
+        {
+            index.push_back(i);
+        }
+    }
+
+    return index.size();
+}
+
+void im2colIndexed(TensorView<const float> im, const std::vector<int>& index, int inputChannels, int inputHeight, int inputWidth, int outputWidth, int filterSize, int pad, int stride, float *col)
+{
+    const int dims = im.dimensionCount();
+    assert(im.stride(dims - 1) == 1);
+    const float *dataIm = im.dataAddress();
+    const int patches = index.size();
+    const int frameStride = (dims == 4) ? im.stride(0) : 0;
+    const int channelStride = im.stride(dims - 3);
+    const int rowStride = im.stride(dims - 2);
+    const int outputHeight = (inputHeight + 2 * pad - filterSize) / stride + 1;
+    const int outputPlane = outputHeight * outputWidth;
+    const int blocks = (patches + patchBlock - 1) / patchBlock;
+
+    // Blocks write disjoint column ranges of every row
+    ThreadPool::global().parallelFor(blocks, [&](int blockBegin, int blockEnd)
+    {
+        int startY[patchBlock];
+        int startX[patchBlock];
+        int frameOffset[patchBlock];
+        int offset[patchBlock];
+
+        for (int block = blockBegin * patchBlock; block < std::min(blockEnd * patchBlock, patches); block += patchBlock)
+        {
+            const int blockSize = std::min(patchBlock, patches - block);
+
+            // A block whose windows all lie inside the image is gathered without bounds checks
+            bool interior = true;
+            for (int p = 0; p < blockSize; p++)
+            {
+                // Indices of a batch run over the output planes of all frames
+                const int pixel = index[block + p] % outputPlane;
+                frameOffset[p] = index[block + p] / outputPlane * frameStride;
+                startY[p] = (pixel / outputWidth) * stride - pad;
+                startX[p] = (pixel % outputWidth) * stride - pad;
+                offset[p] = frameOffset[p] + startY[p] * rowStride + startX[p];
+                interior = interior && startY[p] >= 0 && startY[p] + filterSize <= inputHeight
+                        && startX[p] >= 0 && startX[p] + filterSize <= inputWidth;
+            }
+
+            float *dataCol = col + block;
+            for (int channel = 0; channel < inputChannels; channel++)
+            {
+                const float *channelIm = dataIm + channel * channelStride;
+                for (int fy = 0; fy < filterSize; fy++)
+                {
+                    for (int fx = 0; fx < filterSize; fx++)
+                    {
+                        if (interior)
+                        {
+                            const float *filterIm = channelIm + fy * rowStride + fx;
+                            for (int p = 0; p < blockSize; p++)
+                            {
+                                dataCol[p] = filterIm[offset[p]];
+                            }
+                        }
+                        else
+                        {
+                            for (int p = 0; p < blockSize; p++)
+                            {
+                                const int y = startY[p] + fy;
+                                const int x = startX[p] + fx;
+                                if (y >= 0 && y < inputHeight && x >= 0 && x < inputWidth)
+                                {
+                                    dataCol[p] = channelIm[frameOffset[p] + y * rowStride + x];
+                                }
+                                else
+                                {
+                                    dataCol[p] = 0;
+                                }
+                            }
+                        }
+                        dataCol += patches;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void convolutionIm2ColIndexed(TensorView<const float> input, const std::vector<int>& index, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, int outputWidth, int filterSize, int stride, int pad)
+{
+    const int outputChannels = filter.rows();
+    const int inputChannels = input.channelLength();
+    const int inputHeight = input.columnLength();
+    const int inputWidth = input.rowLength();
+
+    int m = outputChannels;
+    int n = index.size();
+    int k = inputChannels * filterSize * filterSize;
+
+    ensureCapacity(colBuffer, k, n);
+    ensureCapacity(outBuffer, m, n);
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    im2colIndexed(input, index, inputChannels, inputHeight, inputWidth, outputWidth, filterSize, pad, stride, colBuffer.dataAddress());
+    multiplyWeights(filter, n, colBuffer.dataAddress(), outBuffer.dataAddress());
+}
+
+void scatterIndexed(const float *buffer, const std::vector<int>& index, int channels, int channelSize, float *out)
+{
+    const int patches = index.size();
+
+    // Index n * channelSize + p of frame n lands at (n * channels + c) * channelSize + p, that is
+    // at c * channelSize + index + n * (channels - 1) * channelSize; index is sorted, so a
+    // single frame is recognized by its last entry
+    const int *offset = index.data();
+    static thread_local std::vector<int> frameOffsets;
+    if (patches > 0 && index.back() >= channelSize)
+    {
+        frameOffsets.resize(patches);
+        for (int p = 0; p < patches; p++)
+        {
+            frameOffsets[p] = index[p] + index[p] / channelSize * (channels - 1) * channelSize;
+        }
+        offset = frameOffsets.data();
+    }
+
+    ThreadPool::global().parallelFor(channels, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            const float *channelBuffer = buffer + c * patches;
+            float *channelOut = out + c * channelSize;
+            for (int p = 0; p < patches; p++)
+            {
+                channelOut[offset[p]] = channelBuffer[p];
+            }
+        }
+    });
+}
+
+// Assembles only the listed image pixels from the columns: the gather form of col2im,
+// writes [channels x index.size()]. Indices past the first frame read the columns of their frame.
+void col2imIndexed(const Tensor<float>& col, const std::vector<int>& index, int channels, int height, int width, int filterSize, int pad, int stride, float *im)
+{
+    const int colHeight = (height + 2 * pad - filterSize) / stride + 1;
+    const int colWidth = (width + 2 * pad - filterSize) / stride + 1;
+    const int colSize = colHeight * colWidth;
+    const int frameColumns = channels * filterSize * filterSize * colSize;
+    const int patches = index.size();
+
+    ThreadPool::global().parallelFor(patches, [&](int begin, int end)
+    {
+        for (int p = begin; p < end; p++)
+        {
+            const int pixel = index[p] % (height * width);
+            const float *dataCol = col.dataAddress() + index[p] / (height * width) * frameColumns;
+            const int y = pixel / width + pad;
+            const int x = pixel % width + pad;
+
+            for (int c = 0; c < channels; c++)
+            {
+                float sum = 0;
+                for (int fy = 0; fy < filterSize; fy++)
+                {
+                    const int cy = y - fy;
+                    if (cy < 0 || cy % stride != 0 || cy / stride >= colHeight) continue;
+
+                    for (int fx = 0; fx < filterSize; fx++)
+                    {
+                        const int cx = x - fx;
+                        if (cx < 0 || cx % stride != 0 || cx / stride >= colWidth) continue;
+
+                        const int row = (c * filterSize + fy) * filterSize + fx;
+                        sum += dataCol[row * colSize + (cy / stride) * colWidth + cx / stride];
+                    }
+                }
+                im[c * patches + p] = sum;
+            }
+        }
+    }, patchBlock);
+}
+
+// colBuffer has to hold the columns of a previous dense pass: only the columns of the active
+// input pixels are recomputed, and only the active output pixels are assembled into
+// outBuffer [outputChannels x outputIndex.size()]
+void transposedConvolutionIm2ColIndexed(const Tensor<float>& input, const std::vector<int>& inputIndex, const std::vector<int>& outputIndex, const Tensor<float>& filter, Tensor<float>& inputBuffer, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad)
+{
+    transposedConvolutionIm2ColIndexed(input, inputIndex, outputIndex, PackedWeights::transposedView(filter), inputBuffer, colBuffer, anotherBuffer,
+                                       outBuffer, outputHeight, outputWidth, filterSize, stride, pad);
+}
+
+void transposedConvolutionIm2ColIndexed(TensorView<const float> input, const std::vector<int>& inputIndex, const std::vector<int>& outputIndex, const PackedWeights& filter, Tensor<float>& inputBuffer, Tensor<float> &colBuffer, Tensor<float>& anotherBuffer, Tensor<float>& outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad)
 {
-    const int outputHeight = mask.dimensions()[0];
-    const int outputWidth = mask.dimensions()[1];
-    const int inputHeight = prevMask.dimensions()[0];
-    const int inputWidth = prevMask.dimensions()[1];
+    const int outputChannels = filter.rows() / (filterSize * filterSize);
+    const int inputChannels = input.channelLength();
+    const int inputHeight = input.columnLength();
+    const int inputWidth = input.rowLength();
+
+    assert(colBuffer.elementCount() == batchSize(input.dimensions()) * outputChannels * filterSize * filterSize * inputHeight * inputWidth);
+
+    int m = outputChannels * filterSize * filterSize;
+    int n = inputIndex.size();
+    int k = inputChannels;
 
-    mask.zero();
+    ensureCapacity(outBuffer, outputChannels, outputIndex.size());
 
-    Tensor<float> weights(std::vector<int>{1,1,filterSize,filterSize});
-    weights.fillwith(1.0);
+    if (n > 0)
+    {
+        ensureCapacity(inputBuffer, k, n);
+        ensureCapacity(anotherBuffer, m, n);
+
+        im2colIndexed(input, inputIndex, inputChannels, inputHeight, inputWidth, inputWidth, 1, 0, 1, inputBuffer.dataAddress());
+
+        multiplyWeights(filter, n, inputBuffer.dataAddress(), anotherBuffer.dataAddress());
+
+        scatterIndexed(anotherBuffer.dataAddress(), inputIndex, m, inputHeight * inputWidth, colBuffer.dataAddress());
+    }
+
+    col2imIndexed(colBuffer, outputIndex, outputChannels, outputHeight, outputWidth, filterSize, pad, stride, outBuffer.dataAddress());
+}
+
+int buildTileIndex(const TileMask& tiles, int outputHeight, int outputWidth, std::vector<int>& index)
+{
+    const int size = tiles.tileSize();
 
-    const Tensor<float> deepPrevMask(prevMask, shallow_copy{});
-    deepPrevMask.reshape(std::vector<int>{1, inputHeight, inputWidth});
+    index.clear();
+    for (int ty = 0; ty < tiles.tilesY(); ty++)
+    {
+        for (int tx = 0; tx < tiles.tilesX(); tx++)
+        {
+            if (!tiles.occupied(ty, tx)) continue;
 
-    Tensor<float> deepMask(mask, shallow_copy{});
-    deepMask.reshape(std::vector<int>{1, outputHeight, outputWidth});
+            const int y1 = std::min((ty + 1) * size, outputHeight);
+            const int x1 = std::min((tx + 1) * size, outputWidth);
+            for (int y = ty * size; y < y1; y++)
+            {
+                for (int x = tx * size; x < x1; x++)
+                {
+                    index.push_back(y * outputWidth + x);
+                }
+            }
+        }
+    }
 
-    convolutionIm2Col(deepPrevMask, weights, colBuffer, deepMask, filterSize, stride, pad);
+    return index.size();
 }
 
+void im2colTiles(TensorView<const float> im, const TileMask& tiles, int patches, int inputChannels, int inputHeight, int inputWidth, int outputHeight, int outputWidth, int filterSize, int pad, int stride, float *col)
+{
+    assert(im.stride(2) == 1);
+    const float *dataIm = im.dataAddress();
+    const int rowStride = im.stride(1);
+    const int size = tiles.tileSize();
+
+    std::vector<std::pair<int,int>> occupied;
+    for (int ty = 0; ty < tiles.tilesY(); ty++)
+    {
+        for (int tx = 0; tx < tiles.tilesX(); tx++)
+        {
+            if (tiles.occupied(ty, tx))
+            {
+                occupied.emplace_back(ty * size, tx * size);
+            }
+        }
+    }
+
+    // Rows of the column buffer [channel, fy, fx] are independent
+    ThreadPool::global().parallelFor(inputChannels * filterSize * filterSize, [&](int rowBegin, int rowEnd)
+    {
+        for (int row = rowBegin; row < rowEnd; row++)
+        {
+            const int channel = row / (filterSize * filterSize);
+            const int fy = row / filterSize % filterSize;
+            const int fx = row % filterSize;
+            const float *channelIm = dataIm + channel * im.stride(0);
+
+            int validBegin, validEnd;
+            validColumns(inputWidth, outputWidth, fx, pad, stride, validBegin, validEnd);
+
+            float *dataCol = col + row * patches;
+            for (const auto& tile : occupied)
+            {
+                const int y1 = std::min(tile.first + size, outputHeight);
+                const int x0 = tile.second;
+                const int x1 = std::min(x0 + size, outputWidth);
+
+                for (int y = tile.first; y < y1; y++)
+                {
+                    const int inputY = y * stride - pad + fy;
+                    if (inputY < 0 || inputY >= inputHeight)
+                    {
+                        dataCol = std::fill_n(dataCol, x1 - x0, 0.0f);
+                    }
+                    else
+                    {
+                        dataCol = packRow(channelIm + inputY * rowStride, x0, x1, validBegin, validEnd, fx, pad, stride, dataCol);
+                    }
+                }
+            }
+            assert(dataCol - col == (row + 1) * patches);
+        }
+    });
+}
 
-void deconvolveMaskCol2Im(const Tensor<float>& prevMask, Tensor<float>& mask, Tensor<float>& colBuffer, int filterSize, int stride, int pad)
+void convolutionIm2ColTiles(TensorView<const float> input, const TileMask& tiles, int patches, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer, int outputHeight, int outputWidth, int filterSize, int stride, int pad)
 {
-    const int outputHeight = mask.dimensions()[0];
-    const int outputWidth = mask.dimensions()[1];
-    const int inputHeight = prevMask.dimensions()[0];
-    const int inputWidth = prevMask.dimensions()[1];
+    const int outputChannels = filter.rows();
+    const int inputChannels = input.dimensions()[0];
+    const int inputHeight = input.dimensions()[1];
+    const int inputWidth = input.dimensions()[2];
 
-    mask.zero();
+    int m = outputChannels;
+    int n = patches;
+    int k = inputChannels * filterSize * filterSize;
+
+    ensureCapacity(colBuffer, k, n);
+    ensureCapacity(outBuffer, m, n);
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    im2colTiles(input, tiles, patches, inputChannels, inputHeight, inputWidth, outputHeight, outputWidth, filterSize, pad, stride, colBuffer.dataAddress());
+    multiplyWeights(filter, n, colBuffer.dataAddress(), outBuffer.dataAddress());
+}
 
-    Tensor<float> weights(std::vector<int>{1,1,filterSize,filterSize});
-    weights.fillwith(1.0);
 
-    const Tensor<float> deepPrevMask(prevMask, shallow_copy{});
-    deepPrevMask.reshape(std::vector<int>{1, inputHeight, inputWidth});
+bool isPointwiseConvolution(int inputHeight, int inputWidth, int filterSize, int stride, int pad)
+{
+    return pad == 0 && ((filterSize == 1 && stride == 1) || (filterSize == inputHeight && filterSize == inputWidth));
+}
+
+void convolutionPointwise(TensorView<const float> input, const PackedWeights& filter, TensorView<float> out)
+{
+    if (input.dimensionCount() == 4)
+    {
+        for (int f = 0; f < input.dimensions()[0]; f++)
+        {
+            convolutionPointwise(input.frame(f), filter, out.frame(f));
+        }
+        return;
+    }
+
+    const int n = out.elementCount() / filter.rows();
 
-    Tensor<float> deepMask(mask, shallow_copy{});
-    deepMask.reshape(std::vector<int>{1, outputHeight, outputWidth});
+    assert(input.elementCount() == filter.cols() * n);
 
-    transposedConvolutionIm2Col(deepPrevMask, weights, colBuffer, deepMask, filterSize, stride, pad);
+    // A full-window convolution takes the whole input as a single column
+    const int ldb = (n == 1) ? 1 : planarStride(input);
+    assert(n > 1 || input.isContiguous());
+    multiplyWeights(filter, n, input.dataAddress(), ldb, out.dataAddress(), planarStride(out));
 }
 
+// outBuffer gets [outputChannels x index.size()]; only the active columns of a 1x1 convolution
+// are gathered, a full-window one has a single output pixel and multiplies the input as is.
+// The active pixels of all frames of a batch are gathered into the same columns.
+void convolutionPointwiseIndexed(TensorView<const float> input, const std::vector<int>& index, const PackedWeights& filter, Tensor<float> &colBuffer, Tensor<float> &outBuffer)
+{
+    const int m = filter.rows();
+    const int k = filter.cols();
+    const int n = index.size();
+    const int frames = batchSize(input.dimensions());
+    const TensorView<const float> firstFrame = input.frame(0);
+    const int pixels = firstFrame.elementCount() / k;
+    assert(pixels > 1 || firstFrame.isContiguous());
+    const int channelStride = (pixels == 1) ? 1 : planarStride(firstFrame);
+
+    ensureCapacity(outBuffer, m, n);
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    if (n < pixels || frames > 1)
+    {
+        ensureCapacity(colBuffer, k, n);
+        float *dataCol = colBuffer.dataAddress();
+        const float *dataIm = input.dataAddress();
+
+        const int *offset = index.data();
+        static thread_local std::vector<int> frameOffsets;
+        if (frames > 1)
+        {
+            frameOffsets.resize(n);
+            for (int p = 0; p < n; p++)
+            {
+                frameOffsets[p] = index[p] / pixels * input.stride(0) + index[p] % pixels;
+            }
+            offset = frameOffsets.data();
+        }
 
+        ThreadPool::global().parallelFor(k, [&](int begin, int end)
+        {
+            for (int row = begin; row < end; row++)
+            {
+                const float *channelIm = dataIm + row * channelStride;
+                float *rowCol = dataCol + row * n;
+                for (int p = 0; p < n; p++)
+                {
+                    rowCol[p] = channelIm[offset[p]];
+                }
+            }
+        });
+        multiplyWeights(filter, n, dataCol, outBuffer.dataAddress());
+        return;
+    }
+
+    multiplyWeights(filter, n, input.dataAddress(), channelStride, outBuffer.dataAddress(), n);
 }
 
+}
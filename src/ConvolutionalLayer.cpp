@@ -1,5 +1,6 @@
 #include "ConvolutionalLayer.hpp"
 #include "ConvOps.hpp"
+#include "Winograd.hpp"
 #include <cmath>
 
 namespace MaskedCNN {
@@ -31,16 +32,96 @@ BaseConvolutionalLayer::BaseConvolutionalLayer(std::unique_ptr<Activation> activ
     filterSize = dims[2];
 }
 
-std::vector<int> BaseConvolutionalLayer::getOutputDimensions()
+Shape BaseConvolutionalLayer::getOutputDimensions()
 {
+    if (dimensions.size() == 4)
+    {
+        return {batch, outputChannels, outputHeight, outputWidth};
+    }
     return {outputChannels, outputHeight, outputWidth};
 }
 
+// Reads [C, H, W] or an [N, C, H, W] batch; the output has the same rank
+void BaseConvolutionalLayer::setInputDimensions(const Shape& dims)
+{
+    if (dims.size() != 3 && dims.size() != 4)
+    {
+        throw std::runtime_error("Convolution input has to be [C, H, W] or [N, C, H, W]");
+    }
+    dimensions = dims;
+    batch = batchSize(dims);
+    assert(filterDepth == dims[dims.size() - 3]);
+    inputHeight = dims[dims.size() - 2];
+    inputWidth = dims[dims.size() - 1];
+}
+
 int BaseConvolutionalLayer::getNeuronInputNumber() const
 {
     return filterSize * filterSize * filterDepth;
 }
 
+void BaseConvolutionalLayer::setSparseExecution(SparseExecution execution)
+{
+    this->execution = execution;
+}
+
+void BaseConvolutionalLayer::setTileSize(int tileSize)
+{
+    tileMask.setTileSize(tileSize);
+}
+
+// Scattered pixels make a skinny gather with no locality, so when the active pixels are clustered
+// it is cheaper to compute whole tiles, and past the calibrated crossover, all of the output
+void BaseConvolutionalLayer::measureExecution(double seconds, int units, int totalUnits)
+{
+    switch (lastExecution)
+    {
+    case SparseExecution::Dense:
+        crossover.denseMeasured(seconds);
+        tileCrossover.denseMeasured(seconds);
+        break;
+    case SparseExecution::Pixel:
+        crossover.sparseMeasured(seconds, units, totalUnits);
+        break;
+    case SparseExecution::Tile:
+        tileCrossover.sparseMeasured(seconds, units, totalUnits);
+        break;
+    default:
+        break;
+    }
+}
+
+SparseExecution BaseConvolutionalLayer::chooseExecution(double pixelFill)
+{
+    if (execution == SparseExecution::Pixel || execution == SparseExecution::Dense)
+    {
+        return execution;
+    }
+
+    if (execution == SparseExecution::Auto && crossover.preferDense(pixelFill))
+    {
+        return SparseExecution::Dense;
+    }
+    // Tiles are gathered from a single frame; a batch puts all frames' pixels into one GEMM instead
+    if (batch > 1)
+    {
+        return SparseExecution::Pixel;
+    }
+
+    tileMask.build(mask);
+    if (execution == SparseExecution::Tile)
+    {
+        return SparseExecution::Tile;
+    }
+
+    const double tileFill = tileMask.howFilled();
+    if (tileFill > 0 && pixelFill / tileFill >= tileDensityThreshold)
+    {
+        return tileCrossover.preferDense(tileFill) ? SparseExecution::Dense : SparseExecution::Tile;
+    }
+    return SparseExecution::Pixel;
+}
+
 
 
 ConvolutionalLayer::ConvolutionalLayer(std::unique_ptr<Activation> activation, int stride, int filterSize, int pad,
@@ -57,6 +138,60 @@ ConvolutionalLayer::ConvolutionalLayer(std::unique_ptr<Activation> activation, T
 
 }
 
+bool ConvolutionalLayer::winogradShaped() const
+{
+    return isWinogradConvolution(filterSize, stride) && filterDepth >= winogradMinChannels;
+}
+
+void ConvolutionalLayer::packWeights()
+{
+    packedWeights.packConvolution(weights);
+    if (!isTraining && winogradShaped())
+    {
+        winogradTransformFilter(weights, winogradFilter);
+    }
+    else
+    {
+        winogradFilter = Tensor<float>();
+    }
+    // Training changes the weights after this, so inference has to pack them again
+    packed = !isTraining;
+}
+
+void BaseConvolutionalLayer::usePackedWeights(PackedWeights&& weights)
+{
+    if ((int64_t)weights.rows() * weights.cols() != this->weights.elementCount())
+    {
+        throw std::runtime_error("Packed weights don't match the filter of layer " + name);
+    }
+    packedWeights = std::move(weights);
+    packed = true;
+}
+
+void ConvolutionalLayer::usePackedWeights(PackedWeights&& weights)
+{
+    BaseConvolutionalLayer::usePackedWeights(std::move(weights));
+    // Packed counts as ready for inference, which needs the Winograd filter as well
+    if (winogradShaped() && winogradFilter.elementCount() == 0)
+    {
+        winogradTransformFilter(this->weights, winogradFilter);
+    }
+}
+
+void ConvolutionalLayer::useWinogradFilter(Tensor<float>&& filter)
+{
+    if (filter.dimensions() != Shape{16, outputChannels, filterDepth})
+    {
+        throw std::runtime_error("Winograd filter doesn't match the filter of layer " + name);
+    }
+    winogradFilter = std::move(filter);
+}
+
+void ConvolutionalLayer::setWinogradEnabled(bool enabled)
+{
+    winogradEnabled = enabled;
+}
+
 DeconvolutionalLayer::DeconvolutionalLayer(std::unique_ptr<Activation> activation, int stride, int filterSize, int pad,
                                        int filterDepth, int featureMaps, std::string name)
     : BaseConvolutionalLayer(std::move(activation), stride, filterSize, pad, filterDepth, featureMaps)
@@ -75,6 +210,7 @@ DeconvolutionalLayer::DeconvolutionalLayer(std::unique_ptr<Activation> activatio
 void ConvolutionalLayer::forwardPropagate()
 {
     const Tensor<float> &input = *bottoms[0]->getOutput();
+    Workspace &scratch = *workspace;
     auto dims = input.dimensions();
 
     if (!initDone || dims != dimensions)
@@ -84,86 +220,180 @@ void ConvolutionalLayer::forwardPropagate()
             initializeWeightsNormalDistrCorrectedVar();
         }
 
-        dimensions = dims;
-        assert(dims.size() == 3);
-        assert(filterDepth == dims[0]);
-        inputHeight = dims[1];
-        inputWidth = dims[2];
+        setInputDimensions(dims);
 
         outputWidth = std::floor((inputWidth + pad * 2 - filterSize) / (double)stride + 1);
         outputHeight = std::floor((inputHeight + pad * 2  - filterSize) / (double)stride + 1);
 
-        z.resize({outputChannels, outputHeight, outputWidth});
-        dy_dz.resize({outputChannels, outputHeight, outputWidth});
-        delta.resize({outputChannels, outputHeight, outputWidth});
-        output.resize({outputChannels, outputHeight, outputWidth});
-        mask.resize({outputHeight, outputWidth});
-        mask.fillwith(1);
+        output.resize(getOutputDimensions());
+        mask.resize(outputHeight, outputWidth, batch);
+        mask.fill();
+        pointwise = isPointwiseConvolution(inputHeight, inputWidth, filterSize, stride, pad);
 
+        invalidateCache();
         initDone = true;
     }
 
+    if (isTraining && dims.size() != 3)
+    {
+        throw std::runtime_error("Training takes one [C, H, W] frame at a time");
+    }
+    updateTrainingBuffers();
+    if (isTraining || !packed)
+    {
+        packWeights();
+    }
+    // Training backpropagates through im2col; with few input channels
+    // the transforms cost more than the saved multiplications
+    const bool useWinograd = winogradEnabled && !isTraining && winogradShaped();
+
+    const bool incremental = cacheUsable();
+    lastExecution = SparseExecution::Dense;
+    StopWatch watch;
 
-    if (maskEnabled)
+    if (incremental)
     {
-        const Tensor<float> &prevMask = *bottoms[0]->getMask();
-        convolveMaskIm2Col(prevMask, mask, maskColBuffer, filterSize, stride, pad);
-        convolutionIm2ColMasked(input, mask, weights, colBuffer, outBuffer, z, filterSize, stride, pad);
+        const BitMask &prevMask = *bottoms[0]->getMask();
+        mask.convolveFrom(prevMask, filterSize, stride, pad);
+        lastExecution = chooseExecution(mask.howFilled());
+        // Gathering a pixel of a pointwise convolution is already a contiguous read per channel
+        if (pointwise && lastExecution == SparseExecution::Tile)
+        {
+            lastExecution = SparseExecution::Pixel;
+        }
+    }
+    else
+    {
+        mask.fill();
+    }
 
-        activateOutBuffer();
+    if (lastExecution != SparseExecution::Dense && useWinograd && batch == 1)
+    {
+        // Active pixels are computed as whole 2x2 Winograd tiles, tiled execution uses its own tiles
+        const TileMask *tiles = &tileMask;
+        if (lastExecution == SparseExecution::Pixel || tileMask.tileSize() % 2 != 0)
+        {
+            winogradTiles.build(mask);
+            tiles = &winogradTiles;
+        }
+        buildTileIndex(*tiles, outputHeight, outputWidth, activeIndex);
+        winogradConvolutionTiles(input, *tiles, winogradFilter, scratch.winogradInput, scratch.winogradProduct, scratch.product, outputHeight, outputWidth, pad);
 
-        activation->activate(&z[0], &output[0], &dy_dz[0], output.elementCount());
+        activateProduct();
+    }
+    else if (lastExecution == SparseExecution::Pixel)
+    {
+        mask.activeIndex(activeIndex);
+        if (pointwise)
+        {
+            convolutionPointwiseIndexed(input, activeIndex, packedWeights, scratch.columns, scratch.product);
+        }
+        else
+        {
+            convolutionIm2ColIndexed(input, activeIndex, packedWeights, scratch.columns, scratch.product, outputWidth, filterSize, stride, pad);
+        }
+
+        activateProduct();
+    }
+    else if (lastExecution == SparseExecution::Tile)
+    {
+        const int patches = buildTileIndex(tileMask, outputHeight, outputWidth, activeIndex);
+        convolutionIm2ColTiles(input, tileMask, patches, packedWeights, scratch.columns, scratch.product, outputHeight, outputWidth, filterSize, stride, pad);
 
+        activateProduct();
     }
     else
     {
-        convolutionIm2Col(input, weights, colBuffer, z, filterSize, stride, pad);
+        // The mask is kept as propagated even when everything is recomputed, since
+        // downstream layers only need to know what can have changed.
+        // Inference needs neither z nor dy/dz, so the product goes straight into the output.
+        Tensor<float>& result = isTraining ? z : output;
+        if (pointwise)
+        {
+            convolutionPointwise(input, packedWeights, result);
+        }
+        else if (useWinograd)
+        {
+            winogradConvolution(input, winogradFilter, scratch.winogradInput, scratch.winogradProduct, result, pad);
+        }
+        else
+        {
+            convolutionIm2Col(input, packedWeights, scratch.columns, result, filterSize, stride, pad);
+        }
 
-        for (int d = 0; d < outputChannels; d++)
+        const int channelSize = outputHeight * outputWidth;
+        if (isTraining)
         {
-            for (int ay = 0; ay < outputHeight; ay++)
+            for (int d = 0; d < outputChannels; d++)
             {
-                for (int ax = 0; ax < outputWidth; ax++)
+                float *channel = z.dataAddress() + d * channelSize;
+                for (int i = 0; i < channelSize; i++)
                 {
-                    z(d, ay, ax) += biases[d];
+                    channel[i] += biases[d];
                 }
             }
-        }
 
-        activation->activate(&z[0], &output[0], &dy_dz[0], output.elementCount());
+            activation->activateParallel(&z[0], &output[0], &dy_dz[0], output.elementCount());
+        }
+        else
+        {
+            for (int n = 0; n < batch; n++)
+            {
+                float *frame = output.dataAddress() + n * outputChannels * channelSize;
+                biasActivate(*activation, biases.dataAddress(), outputChannels, channelSize, frame, frame);
+            }
+        }
     }
 
+    measureExecution(watch.seconds(), activeIndex.size(), batch * outputHeight * outputWidth);
+    cacheUpdated(!incremental);
 }
 
-void ConvolutionalLayer::activateOutBuffer()
+// The workspace product holds [outputChannels x patches] for the active pixels only, so bias and activation
+// are applied while it is compact and everything is written back in a single scatter
+void ConvolutionalLayer::activateProduct()
 {
-    auto outBufferData = outBuffer.dataAddress();
-    auto outputData = z.dataAddress();
-    const auto& maskData = mask.dataAddress();
+    Workspace &scratch = *workspace;
+    const int patches = activeIndex.size();
+    const int channelSize = outputHeight * outputWidth;
+
+    if (patches == 0)
+    {
+        return;
+    }
+
+    float *productData = scratch.product.dataAddress();
+    if (!isTraining)
+    {
+        biasActivate(*activation, biases.dataAddress(), outputChannels, patches, productData, productData);
+        scatterIndexed(productData, activeIndex, outputChannels, channelSize, output.dataAddress());
+        return;
+    }
+
+    scratch.activeOutput.resize({outputChannels, patches});
+    scratch.activeDerivative.resize({outputChannels, patches});
 
     for (int d = 0; d < outputChannels; d++)
     {
         float bias = biases[d];
-        for (int y = 0; y < outputHeight; y++)
+        float *row = productData + d * patches;
+        for (int p = 0; p < patches; p++)
         {
-            for (int x = 0; x < outputWidth; x++)
-            {
-                if (maskData[y * outputWidth + x] > 0)
-                {
-                    int index = x + outputWidth * (y + outputHeight * d);
-                    outputData[index] = *outBufferData + bias;
-                    outBufferData++;
-                }
-            }
+            row[p] += bias;
         }
     }
 
-    activation->activate(&z[0], &output[0], &dy_dz[0], output.elementCount());
+    activation->activateParallel(productData, scratch.activeOutput.dataAddress(), scratch.activeDerivative.dataAddress(), outputChannels * patches);
+
+    scatterIndexed(productData, activeIndex, outputChannels, channelSize, z.dataAddress());
+    scatterIndexed(scratch.activeOutput.dataAddress(), activeIndex, outputChannels, channelSize, output.dataAddress());
+    scatterIndexed(scratch.activeDerivative.dataAddress(), activeIndex, outputChannels, channelSize, dy_dz.dataAddress());
 }
 
 void DeconvolutionalLayer::forwardPropagate()
 {
     const Tensor<float> &input = *bottoms[0]->getOutput();
+    Workspace &scratch = *workspace;
     auto dims = input.dimensions();
 
     if (!initDone || dims != dimensions)
@@ -173,36 +403,99 @@ void DeconvolutionalLayer::forwardPropagate()
             initializeWeightsNormalDistrCorrectedVar();
         }
 
-        dimensions = dims;
-        assert(dims.size() == 3);
-        assert(filterDepth == dims[0]);
-        inputHeight = dims[1];
-        inputWidth = dims[2];
+        setInputDimensions(dims);
 
         outputWidth = stride * (inputWidth - 1) + filterSize - 2 * pad;
         outputHeight = stride * (inputHeight - 1) + filterSize - 2 * pad;
 
-        z.resize({outputChannels, outputHeight, outputWidth});
-        dy_dz.resize({outputChannels, outputHeight, outputWidth});
-        delta.resize({outputChannels, outputHeight, outputWidth});
-        output.resize({outputChannels, outputHeight, outputWidth});
-        mask.resize({outputHeight, outputWidth});
+        output.resize(getOutputDimensions());
+        mask.resize(outputHeight, outputWidth, batch);
 
+        invalidateCache();
         initDone = true;
     }
 
-    if (maskEnabled)
+    if (isTraining && dims.size() != 3)
+    {
+        throw std::runtime_error("Training takes one [C, H, W] frame at a time");
+    }
+    updateTrainingBuffers();
+    if (isTraining || !packed)
+    {
+        packWeights();
+    }
+
+    // With masks the columns of every input pixel are kept for the next frame, otherwise
+    // they are scratch like everywhere else
+    if (!maskEnabled && colBuffer.elementCount() > 0)
+    {
+        colBuffer = Tensor<float>();
+    }
+    Tensor<float> &columns = maskEnabled ? colBuffer : scratch.columns;
+
+    const bool incremental = cacheUsable();
+    lastExecution = SparseExecution::Dense;
+    StopWatch watch;
+
+    if (incremental)
     {
-        const auto& prevMask = *bottoms[0]->getMask();
-        deconvolveMaskCol2Im(prevMask, mask, maskColBuffer, filterSize, stride, pad);
-        transposedConvolutionIm2ColMasked(input, outBuffer, prevMask, weights, colBuffer, additionalBuffer, z, filterSize, stride, pad);
+        mask.deconvolveFrom(*bottoms[0]->getMask(), filterSize, stride, pad);
+        // The work here follows the changed inputs, not output tiles, so tiling is not used
+        lastExecution = (chooseExecution(bottoms[0]->getMask()->howFilled()) == SparseExecution::Dense) ? SparseExecution::Dense : SparseExecution::Pixel;
     }
     else
     {
-        transposedConvolutionIm2Col(input, weights, colBuffer, z, filterSize, stride, pad);
+        mask.fill();
     }
 
-    activation->activate(&z[0], &output[0], &dy_dz[0], output.elementCount());
+    if (lastExecution == SparseExecution::Pixel)
+    {
+        // columns keeps the columns of every input pixel from earlier frames, so only the
+        // changed input pixels are multiplied and only the affected outputs are reassembled
+        const BitMask& prevMask = *bottoms[0]->getMask();
+        prevMask.activeIndex(inputIndex);
+        mask.activeIndex(activeIndex);
+        transposedConvolutionIm2ColIndexed(input, inputIndex, activeIndex, packedWeights, scratch.gathered, columns,
+                                           scratch.gatheredProduct, scratch.product, outputHeight, outputWidth, filterSize, stride, pad);
+
+        const int patches = activeIndex.size();
+        const int channelSize = outputHeight * outputWidth;
+        if (patches > 0 && !isTraining)
+        {
+            biasActivate(*activation, nullptr, outputChannels, patches, scratch.product.dataAddress(), scratch.product.dataAddress());
+            scatterIndexed(scratch.product.dataAddress(), activeIndex, outputChannels, channelSize, output.dataAddress());
+        }
+        else if (patches > 0)
+        {
+            scratch.activeOutput.resize({outputChannels, patches});
+            scratch.activeDerivative.resize({outputChannels, patches});
+            activation->activateParallel(scratch.product.dataAddress(), scratch.activeOutput.dataAddress(), scratch.activeDerivative.dataAddress(), outputChannels * patches);
+
+            scatterIndexed(scratch.product.dataAddress(), activeIndex, outputChannels, channelSize, z.dataAddress());
+            scatterIndexed(scratch.activeOutput.dataAddress(), activeIndex, outputChannels, channelSize, output.dataAddress());
+            scatterIndexed(scratch.activeDerivative.dataAddress(), activeIndex, outputChannels, channelSize, dy_dz.dataAddress());
+        }
+    }
+    else if (isTraining)
+    {
+        transposedConvolutionIm2Col(input, packedWeights, columns, z, filterSize, stride, pad);
+        activation->activateParallel(&z[0], &output[0], &dy_dz[0], output.elementCount());
+    }
+    else
+    {
+        transposedConvolutionIm2Col(input, packedWeights, columns, output, filterSize, stride, pad);
+        biasActivate(*activation, nullptr, batch * outputChannels, outputHeight * outputWidth, output.dataAddress(), output.dataAddress());
+    }
+
+    // Its sparse work grows with the changed inputs, so the cost is per changed input pixel
+    measureExecution(watch.seconds(), inputIndex.size(), batch * inputHeight * inputWidth);
+    cacheUpdated(!incremental);
+}
+
+void DeconvolutionalLayer::packWeights()
+{
+    packedWeights.packTransposedConvolution(weights);
+    packed = !isTraining;
 }
 
 void DeconvolutionalLayer::backwardPropagate()
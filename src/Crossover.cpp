@@ -0,0 +1,57 @@
+#include "Crossover.hpp"
+#include <algorithm>
+
+namespace MaskedCNN
+{
+
+// Weight of the newest measurement in the running estimates
+static constexpr double smoothing = 0.2;
+// Once the crossover is low enough that no sparse pass gets measured, the sparse estimate could
+// never be corrected. After this many dense passes in a row it gets cheaper by agingRate per pass,
+// until a sparse pass runs again and is measured.
+static constexpr int agingAfter = 16;
+static constexpr double agingRate = 0.02;
+
+Crossover::Crossover(double initialFill)
+    :initialFill(initialFill)
+{
+}
+
+void Crossover::smooth(double& estimate, bool& known, double value)
+{
+    estimate = known ? (1 - smoothing) * estimate + smoothing * value : value;
+    known = true;
+}
+
+void Crossover::denseMeasured(double seconds)
+{
+    smooth(denseSeconds, haveDense, seconds);
+    if (haveSparse && ++densePasses > agingAfter)
+    {
+        sparseSecondsPerFill *= 1 - agingRate;
+    }
+}
+
+void Crossover::sparseMeasured(double seconds, int units, int totalUnits)
+{
+    // Tiny passes are dominated by fixed overheads and would overstate the per-fill cost
+    if (units * 100 < totalUnits)
+    {
+        return;
+    }
+
+    smooth(sparseSecondsPerFill, haveSparse, seconds * totalUnits / units);
+    densePasses = 0;
+}
+
+double Crossover::crossoverFill() const
+{
+    if (!calibrated())
+    {
+        return initialFill;
+    }
+
+    return std::min(1.0, denseSeconds / sparseSecondsPerFill);
+}
+
+}
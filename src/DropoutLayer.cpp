@@ -20,18 +20,27 @@ void DropoutLayer::forwardPropagate()
     const Tensor<float> &input = *bottoms[0]->getOutput();
 
     auto dims = input.dimensions();
+    if (dims != output.dimensions())
+    {
+        invalidateCache();
+    }
     output.resize(dims);
-    dropped.resize({output.elementCount()});
-    delta.resize(dims);
+    updateTrainingBuffers(false);
+    if (isTraining)
+    {
+        dropped.resize({output.elementCount()});
+    }
+
+    const bool incremental = cacheUsable();
 
 
-    Tensor<float> flatInput(input, shallow_copy{});
-    Tensor<float> flatOutput(output, shallow_copy{});
+    const TensorView<const float> flatInput = TensorView<const float>(input).flatten();
+    const TensorView<float> flatOutput = TensorView<float>(output).flatten();
     int elementCount = flatInput.elementCount();
 
     if (isTraining)
     {
-        flatOutput.zero();
+        output.zero();
 
         for (int i = 0; i < elementCount; i++)
         {
@@ -46,6 +55,23 @@ void DropoutLayer::forwardPropagate()
             }
         }
     }
+    else if (incremental)
+    {
+        const BitMask &prevMask = *bottoms[0]->getMask();
+        const int maskWidth = prevMask.width();
+        const int channelSize = prevMask.height() * maskWidth;
+        // Every frame of a batch has elementCount / frames elements over its own mask plane
+        const int frameSize = elementCount / prevMask.batch();
+        for (int i = 0; i < elementCount; i++)
+        {
+            const int pos = i % channelSize;
+            const int frameRow = i / frameSize * prevMask.height();
+            if (prevMask.test(frameRow + pos / maskWidth, pos % maskWidth))
+            {
+                flatOutput[i] = flatInput[i] * (1 - dropProbability);
+            }
+        }
+    }
     else
     {
         for (int i = 0; i < elementCount; i++)
@@ -54,17 +80,18 @@ void DropoutLayer::forwardPropagate()
         }
     }
 
+    cacheUpdated(!incremental);
 }
 
 void DropoutLayer::backwardPropagate()
 {
     Tensor<float> &prevDelta = *bottoms[0]->getDelta();
 
-    Tensor<float> flatPrevDelta(prevDelta, shallow_copy{});
-    Tensor<float> flatDelta(delta, shallow_copy{});
+    const TensorView<float> flatPrevDelta = TensorView<float>(prevDelta).flatten();
+    const TensorView<const float> flatDelta = TensorView<const float>(delta).flatten();
     int elementCount = flatDelta.elementCount();
 
-    flatPrevDelta.zero();
+    prevDelta.zero();
 
     for (int i = 0; i < elementCount; i++)
     {
@@ -75,12 +102,12 @@ void DropoutLayer::backwardPropagate()
     }
 }
 
-std::vector<int> DropoutLayer::getOutputDimensions()
+Shape DropoutLayer::getOutputDimensions()
 {
     return output.dimensions();
 }
 
-Tensor<float> *MaskedCNN::DropoutLayer::getMask()
+BitMask *MaskedCNN::DropoutLayer::getMask()
 {
     return bottoms[0]->getMask();
 }
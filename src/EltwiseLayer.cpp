@@ -1,4 +1,5 @@
- #include "EltwiseLayer.hpp"
+#include "EltwiseLayer.hpp"
+#include "ThreadPool.hpp"
 
 
 namespace MaskedCNN
@@ -9,4 +10,74 @@ EltwiseLayer::EltwiseLayer(std::string name)
     this->name = name;
 }
 
+void EltwiseLayer::forwardPropagate()
+{
+    auto dims = bottoms[0]->getOutput()->dimensions();
+    if (dims != output.dimensions())
+    {
+        output.resize(dims);
+        mask.resize(output.columnLength(), output.rowLength(), batchSize(dims));
+        invalidateCache();
+    }
+    updateTrainingBuffers(false);
+
+    const bool incremental = cacheUsable();
+
+    // Only the union of the bottom masks can have changed
+    if (incremental)
+    {
+        mask.zero();
+        for (const auto& bottom : bottoms)
+        {
+            const auto& bottomMask = *bottom->getMask();
+            mask.merge(bottomMask);
+        }
+    }
+    else
+    {
+        mask.fill();
+    }
+
+    // Output planes of all frames, each with its frame's mask plane
+    const int height = mask.height();
+    const int width = mask.width();
+    const int channels = output.channelLength();
+    ThreadPool::global().parallelFor(batchSize(dims) * channels, [&](int begin, int end)
+    {
+        for (int plane = begin; plane < end; plane++)
+        {
+            const int frameRow = plane / channels * height;
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (!mask.test(frameRow + y, x)) continue;
+
+                    const int i = (plane * height + y) * width + x;
+                    float sum = 0;
+                    for (const auto& bottom : bottoms)
+                    {
+                        const auto& input = *bottom->getOutput();
+                        assert(input.dimensions() == output.dimensions());
+                        sum += input.dataAddress()[i];
+                    }
+                    output.dataAddress()[i] = sum;
+                }
+            }
+        }
+    });
+
+    cacheUpdated(!incremental);
+}
+
+void EltwiseLayer::backwardPropagate()
+{
+    assert(false);
+}
+
+Shape EltwiseLayer::getOutputDimensions()
+{
+    return bottoms[0]->getOutputDimensions();
+}
+
 }
@@ -1,4 +1,5 @@
 #include "FullyConnectedLayer.hpp"
+#include "Gemm.hpp"
 
 namespace MaskedCNN {
 
@@ -8,9 +9,6 @@ namespace MaskedCNN {
 FullyConnectedLayer::FullyConnectedLayer(std::unique_ptr<Activation> activation, int neurons, std::string name)
     :activation(std::move(activation)), neurons(neurons)
 {
-    z.resize({ neurons });
-    dy_dz.resize({ neurons });
-    delta.resize({ neurons });
     output.resize({ neurons });
     this->name = name;
 }
@@ -20,9 +18,6 @@ FullyConnectedLayer::FullyConnectedLayer(std::unique_ptr<Activation> activation,
 {
     neurons = this->weights.columnLength();
     inputCount = this->weights.rowLength();
-    z.resize({ neurons });
-    dy_dz.resize({ neurons });
-    delta.resize({ neurons });
     output.resize({ neurons });
 }
 
@@ -30,12 +25,20 @@ FullyConnectedLayer::FullyConnectedLayer(std::unique_ptr<Activation> activation,
 void FullyConnectedLayer::forwardPropagate()
 {
     const Tensor<float> &input = *bottoms[0]->getOutput();
+    const Shape &dims = input.dimensions();
+
+    // A batch comes as [N, C, H, W] from convolutions or [N, inputs] from another FC layer
+    const int frames = (dims.size() == 4 || dims.size() == 2) ? dims[0] : 1;
 
     if (isTraining)
     {
+        if (frames > 1)
+        {
+            throw std::runtime_error("Training takes one frame at a time");
+        }
         if (!initDone)
         {
-            inputCount = multiplyAllElements(input.dimensions());
+            inputCount = input.elementCount();
 
             weights.resize({neurons, inputCount});
             weight_delta.resize({neurons, inputCount});
@@ -49,21 +52,43 @@ void FullyConnectedLayer::forwardPropagate()
     }
     else
     {
-        assert(inputCount == multiplyAllElements(input.dimensions()));
+        assert(inputCount * frames == input.elementCount());
     }
 
-    Tensor<float> flatInput(const_cast<Tensor<float>&>(input), shallow_copy{});
-    flatInput.flatten();
-    assert(flatInput.elementCount() == weights.rowLength());
+    const Shape outputDims = (frames > 1 || dims.size() == 2) ? Shape{frames, neurons} : Shape{neurons};
+    if (output.dimensions() != outputDims)
+    {
+        output.resize(outputDims);
+    }
+    updateTrainingBuffers();
 
-    cblas_sgemv(CblasRowMajor, CblasNoTrans, weights.columnLength(), weights.rowLength(), 1.0, // z = w*flat_input + b
-                weights.dataAddress(), weights.rowLength(), flatInput.dataAddress(), 1, 0.0, z.dataAddress(), 1);
+    const TensorView<const float> flatInput = TensorView<const float>(input).reshape({frames, inputCount});
+    assert(inputCount == weights.rowLength());
 
-    for (int neuron = 0; neuron < neurons; neuron++)
+    // z = flat_input * w^T + b, one row per frame; inference skips z and dy/dz and activates the output in place
+    float *product = isTraining ? z.dataAddress() : output.dataAddress();
+    blasSgemm(false, true, frames, neurons, inputCount, flatInput.dataAddress(), inputCount,
+              weights.dataAddress(), inputCount, product, neurons);
+
+    if (isTraining)
     {
-        z[neuron] += biases[neuron];
+        for (int neuron = 0; neuron < neurons; neuron++)
+        {
+            z[neuron] += biases[neuron];
+        }
+        activation->activateParallel(z.dataAddress(), output.dataAddress(), dy_dz.dataAddress(), neurons);
+    }
+    else
+    {
+        for (int n = 0; n < frames; n++)
+        {
+            float *frame = output.dataAddress() + n * neurons;
+            biasActivate(*activation, biases.dataAddress(), neurons, 1, frame, frame);
+        }
     }
-    activation->activate(z.dataAddress(), output.dataAddress(), dy_dz.dataAddress(), neurons);
+
+    // Every output depends on every input, there is nothing to update incrementally
+    cacheUpdated(true);
 }
 
 
@@ -73,8 +98,7 @@ void FullyConnectedLayer::backwardPropagate()
     const Tensor<float> &input = *bottoms[0]->getOutput();
     Tensor<float> &prevDelta = *bottoms[0]->getDelta();
 
-    Tensor<float> flatInput(const_cast<Tensor<float>&>(input), shallow_copy{});
-    flatInput.flatten();
+    const TensorView<const float> flatInput = TensorView<const float>(input).flatten();
     assert(flatInput.elementCount() == weights.rowLength());
 
     // de/dz = de/dy * dy/dz
@@ -93,12 +117,13 @@ void FullyConnectedLayer::backwardPropagate()
 
     assert(prevDelta.elementCount() == weights.rowLength());
 
-    cblas_sgemv(CblasRowMajor, CblasTrans, weights.columnLength(), weights.rowLength(), 1.0,
-                weights.dataAddress(), weights.rowLength(), delta.dataAddress(), 1, 0.0, prevDelta.dataAddress(), 1); // setting previous de/dy
+    // setting previous de/dy: prevDelta^T = delta^T * w
+    blasSgemm(false, false, 1, inputCount, neurons, delta.dataAddress(), neurons,
+              weights.dataAddress(), inputCount, prevDelta.dataAddress(), inputCount);
 
 }
 
-std::vector<int> FullyConnectedLayer::getOutputDimensions()
+Shape FullyConnectedLayer::getOutputDimensions()
 {
     return { 1, 1, neurons };
 }
@@ -0,0 +1,219 @@
+#include "Gemm.hpp"
+#include "ThreadPool.hpp"
+#include "Util.hpp"
+#include "Simd.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace MaskedCNN
+{
+
+namespace
+{
+
+// Rows of a register block: the kernel keeps rowsPerBlock x 2 vectors as accumulators,
+// within the 32 AVX-512 or 16 AVX2 registers
+constexpr int rowsPerBlock = (Vec::width == 16) ? 8 : (Vec::width == 8) ? 6 : 4;
+
+// Columns of C computed together: B is packed in panels of this width
+constexpr int panelWidth = 2 * Vec::width;
+
+// Depth of one pass over k: a packed B panel of this depth stays in L1
+constexpr int depthBlock = 256;
+
+// Columns of B sent to the in-house kernel: for each shape of gemmSpeedTest (--gemm-benchmark),
+// BLAS was faster at n = 8 and the kernel from n = 16 to the widest n timed, 8192.
+constexpr int minSmallColumns = 16;
+constexpr int maxSmallColumns = 1024;
+
+// C[rows x cols] (+)= A[rows x depth] * panel, the panel being [depth x panelWidth]
+template<int rows>
+void microKernel(int depth, const float *a, int lda, const float *panel, float *c, int ldc, int cols, bool accumulate)
+{
+    Vec::Type sum[rows][2];
+    for (int r = 0; r < rows; r++)
+    {
+        sum[r][0] = Vec::zero();
+        sum[r][1] = Vec::zero();
+    }
+
+    for (int p = 0; p < depth; p++)
+    {
+        const Vec::Type b0 = Vec::load(panel + p * panelWidth);
+        const Vec::Type b1 = Vec::load(panel + p * panelWidth + Vec::width);
+        for (int r = 0; r < rows; r++)
+        {
+            const Vec::Type ar = Vec::broadcast(a[r * lda + p]);
+            sum[r][0] = Vec::fma(ar, b0, sum[r][0]);
+            sum[r][1] = Vec::fma(ar, b1, sum[r][1]);
+        }
+    }
+
+    float tile[panelWidth];
+    for (int r = 0; r < rows; r++)
+    {
+        float *cRow = c + r * ldc;
+        Vec::store(tile, sum[r][0]);
+        Vec::store(tile + Vec::width, sum[r][1]);
+        if (accumulate)
+        {
+            for (int j = 0; j < cols; j++) cRow[j] += tile[j];
+        }
+        else
+        {
+            std::copy(tile, tile + cols, cRow);
+        }
+    }
+}
+
+template<int rows = rowsPerBlock>
+void runKernel(int count, int depth, const float *a, int lda, const float *panel, float *c, int ldc, int cols, bool accumulate)
+{
+    if (count == rows)
+    {
+        microKernel<rows>(depth, a, lda, panel, c, ldc, cols, accumulate);
+    }
+    else
+    {
+        runKernel<rows - 1>(count, depth, a, lda, panel, c, ldc, cols, accumulate);
+    }
+}
+
+template<>
+void runKernel<0>(int, int, const float *, int, const float *, float *, int, int, bool)
+{
+    assert(false);
+}
+
+// B[depth x n] into panels of panelWidth columns, the last one zero padded
+void packPanels(int depth, int n, const float *b, int ldb, float *packed)
+{
+    const int panels = (n + panelWidth - 1) / panelWidth;
+    ThreadPool::global().parallelFor(panels, [&](int begin, int end)
+    {
+        for (int j = begin; j < end; j++)
+        {
+            const int col = j * panelWidth;
+            const int cols = std::min(panelWidth, n - col);
+            float *panel = packed + j * depth * panelWidth;
+            for (int p = 0; p < depth; p++)
+            {
+                const float *bRow = b + p * ldb + col;
+                float *dst = panel + p * panelWidth;
+                std::copy(bRow, bRow + cols, dst);
+                std::fill(dst + cols, dst + panelWidth, 0.0f);
+            }
+        }
+    });
+}
+
+}
+
+bool smallGemmPreferred(int m, int n, int k)
+{
+    (void)m;
+    (void)k;
+    return n >= minSmallColumns && n <= maxSmallColumns;
+}
+
+void smallGemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+    if (k <= 0)
+    {
+        for (int i = 0; i < m; i++) std::fill(c + i * ldc, c + i * ldc + n, 0.0f);
+        return;
+    }
+
+    const int panels = (n + panelWidth - 1) / panelWidth;
+    const int rowBlocks = (m + rowsPerBlock - 1) / rowsPerBlock;
+
+    // One buffer per calling thread; the workers get its address, naming it would give them their own
+    thread_local std::vector<float> buffer;
+    buffer.resize(panels * std::min(k, depthBlock) * panelWidth);
+    float *packed = buffer.data();
+
+    for (int p0 = 0; p0 < k; p0 += depthBlock)
+    {
+        const int depth = std::min(depthBlock, k - p0);
+        const bool accumulate = p0 > 0;
+        packPanels(depth, n, b + p0 * ldb, ldb, packed);
+
+        // A row block is reused across all panels while it is in L1
+        ThreadPool::global().parallelFor(rowBlocks * panels, [&](int begin, int end)
+        {
+            for (int t = begin; t < end; t++)
+            {
+                const int row = (t / panels) * rowsPerBlock;
+                const int col = (t % panels) * panelWidth;
+                runKernel(std::min(rowsPerBlock, m - row), depth, a + row * lda + p0, lda,
+                          packed + (t % panels) * depth * panelWidth,
+                          c + row * ldc + col, ldc, std::min(panelWidth, n - col), accumulate);
+            }
+        }, 4);
+    }
+}
+
+void sgemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+    if (smallGemmPreferred(m, n, k))
+    {
+        smallGemm(m, n, k, a, lda, b, ldb, c, ldc);
+    }
+    else
+    {
+        blasSgemm(false, false, m, n, k, a, lda, b, ldb, c, ldc);
+    }
+}
+
+// Smallest block of C given to one BLAS call
+constexpr int minBlockColumns = 64;
+constexpr int minBlockRows = 16;
+
+void blasSgemm(bool transA, bool transB, int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::global();
+    const bool byColumns = n >= m;
+    const int length = byColumns ? n : m;
+    const int minBlock = byColumns ? minBlockColumns : minBlockRows;
+    const int blocks = std::max(std::min(pool.size(), length / minBlock), 1);
+    // Blocks of whole vectors, so every call but the last runs full width
+    const int blockLength = (length + blocks - 1) / blocks + Vec::width - 1;
+    const int block = blockLength - blockLength % Vec::width;
+
+    pool.parallelFor(blocks, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const int first = i * block;
+            const int count = std::min(block, length - first);
+            if (count <= 0) continue;
+
+            const float *blockA = a;
+            const float *blockB = b;
+            int blockM = m, blockN = n;
+            if (byColumns)
+            {
+                blockB = transB ? b + first * ldb : b + first;
+                blockN = count;
+            }
+            else
+            {
+                blockA = transA ? a + first : a + first * lda;
+                blockM = count;
+            }
+            cblas_sgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans, transB ? CblasTrans : CblasNoTrans,
+                        blockM, blockN, k, 1.0, blockA, lda, blockB, ldb, 0., byColumns ? c + first : c + first * ldc, ldc);
+        }
+    });
+}
+
+}
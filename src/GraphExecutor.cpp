@@ -0,0 +1,185 @@
+#include "GraphExecutor.hpp"
+#include "ThreadPool.hpp"
+#include <map>
+
+namespace MaskedCNN
+{
+
+GraphExecutor::GraphExecutor(const std::vector<std::unique_ptr<Layer>>& layers)
+{
+    const int count = layers.size();
+    std::map<const Layer*, int> index;
+    for (int i = 0; i < count; i++)
+    {
+        this->layers.push_back(layers[i].get());
+        index.emplace(layers[i].get(), i);
+    }
+
+    consumers.resize(count);
+    dependencies.assign(count, 0);
+    ancestors.assign(count, std::vector<bool>(count, false));
+    int roots = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (Layer *bottom : layers[i]->getBottoms())
+        {
+            const int b = index.at(bottom);
+            if (b >= i)
+            {
+                throw std::runtime_error("Layer " + layers[i]->getName() + " comes before its bottom");
+            }
+
+            // A bottom given twice still releases its consumer once
+            if (ancestors[i][b])
+            {
+                continue;
+            }
+            consumers[b].push_back(i);
+            dependencies[i]++;
+
+            ancestors[i][b] = true;
+            for (int a = 0; a < b; a++)
+            {
+                if (ancestors[b][a])
+                {
+                    ancestors[i][a] = true;
+                }
+            }
+        }
+        roots += dependencies[i] == 0;
+    }
+
+    for (const auto& c : consumers)
+    {
+        chain = chain && c.size() <= 1;
+    }
+    chain = chain && roots <= 1;
+
+    remaining.reset(new std::atomic<int>[count]);
+
+    // One workspace to start with, shared by every layer while they run one at a time
+    workspaces.push_back(std::make_shared<Workspace>());
+    for (Layer *layer : this->layers)
+    {
+        layer->setWorkspace(workspaces[0]);
+    }
+}
+
+void GraphExecutor::forward()
+{
+    if (chain || ThreadPool::global().size() == 1)
+    {
+        for (Layer *layer : layers)
+        {
+            layer->forwardPropagate();
+        }
+        return;
+    }
+
+    int first = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = nullptr;
+        running = 1;
+        freeWorkspaces.clear();
+        for (int w = workspaces.size() - 1; w >= 0; w--)
+        {
+            freeWorkspaces.push_back(w);
+        }
+    }
+    for (int i = 0; i < (int)layers.size(); i++)
+    {
+        remaining[i] = dependencies[i];
+    }
+    for (int i = 0; i < (int)layers.size(); i++)
+    {
+        if (dependencies[i] > 0) continue;
+        if (first < 0)
+        {
+            first = i;
+        }
+        else
+        {
+            launch(i);
+        }
+    }
+
+    runFrom(first);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]{ return running == 0; });
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void GraphExecutor::launch(int layer)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running++;
+    }
+    ThreadPool::global().submit([this, layer]{ runFrom(layer); });
+}
+
+int GraphExecutor::acquireWorkspace(std::shared_ptr<Workspace>& workspace)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeWorkspaces.empty())
+    {
+        freeWorkspaces.push_back(workspaces.size());
+        workspaces.push_back(std::make_shared<Workspace>());
+    }
+    const int w = freeWorkspaces.back();
+    freeWorkspaces.pop_back();
+    workspace = workspaces[w];
+    return w;
+}
+
+// Runs layer, then whatever it releases, until a layer releases nothing
+void GraphExecutor::runFrom(int layer)
+{
+    std::shared_ptr<Workspace> workspace;
+    const int w = acquireWorkspace(workspace);
+    try
+    {
+        while (layer >= 0)
+        {
+            layers[layer]->setWorkspace(workspace);
+            layers[layer]->forwardPropagate();
+
+            int next = -1;
+            for (int consumer : consumers[layer])
+            {
+                if (--remaining[consumer] > 0) continue;
+                if (next < 0)
+                {
+                    next = consumer;
+                }
+                else
+                {
+                    launch(consumer);
+                }
+            }
+            layer = next;
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+        {
+            error = std::current_exception();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    freeWorkspaces.push_back(w);
+    if (--running == 0)
+    {
+        done.notify_all();
+    }
+}
+
+}
@@ -3,8 +3,11 @@
 namespace MaskedCNN
 {
 
+// The input is replaced as a whole every frame, but its mask tells which pixels differ
+// from the previous one, so downstream caches stay usable until it is invalidated
 void InputLayer::forwardPropagate()
 {
+    cacheUpdated(!cacheUsable());
 }
 
 // Doesn't make sense to backprop from the first layer
@@ -13,24 +16,30 @@ void InputLayer::backwardPropagate()
     assert(false);
 }
 
-std::vector<int> InputLayer::getOutputDimensions()
+Shape InputLayer::getOutputDimensions()
 {
     return output.dimensions();
 }
 
-void InputLayer::setInput(const Tensor<float> input)
+void InputLayer::setInput(const Tensor<float>& input)
 {
-    if (!initDone)
+    auto inputDimensions = input.dimensions();
+    if (inputDimensions != output.dimensions())
     {
-        auto inputDiemnsions = input.dimensions();
-        output.resize(inputDiemnsions);
-        delta.resize(inputDiemnsions);
+        output.resize(inputDimensions);
+        invalidateCache();
     }
 
     output = input;
+    updateTrainingBuffers(false);
 }
 
-void InputLayer::setMask(const Tensor<float> mask)
+void InputLayer::setMask(const Tensor<float>& mask)
+{
+    this->mask.assign(mask);
+}
+
+void InputLayer::setMask(const BitMask& mask)
 {
     this->mask = mask;
 }
@@ -16,13 +16,13 @@ static std::random_device rd;
 static std::mt19937 gen(rd());
 
 Layer::Layer()
-    :initDone(false)
+    :isTraining(false), initDone(false)
 {
 }
 
 
 Layer::Layer(Tensor<float> &&weights, Tensor<float> &&biases, std::string name)
-    :weights(std::move(weights)), biases(std::move(biases)), initDone(false)
+    :weights(std::move(weights)), biases(std::move(biases)), isTraining(false), initDone(false)
 {
     this->name = name;
 }
@@ -32,6 +32,46 @@ void Layer::addBottom(Layer *layer)
     bottoms.push_back(layer);
 }
 
+void Layer::setWorkspace(std::shared_ptr<Workspace> workspace)
+{
+    this->workspace = std::move(workspace);
+}
+
+void Layer::shareOutputStorage(Tensor<float>& storage)
+{
+    assert(storage.capacity() >= output.elementCount());
+    Tensor<float> view(storage, shallow_copy{});
+    view.resize(output.dimensions(), uninitialized{});
+    output = std::move(view);
+}
+
+void Layer::ownOutputStorage()
+{
+    output = Tensor<float>(output.dimensions());
+}
+
+void Layer::updateTrainingBuffers(bool withActivation)
+{
+    if (isTraining)
+    {
+        if (!delta.sameShape(output))
+        {
+            delta.resize(output.dimensions());
+        }
+        if (withActivation && !z.sameShape(output))
+        {
+            z.resize(output.dimensions());
+            dy_dz.resize(output.dimensions());
+        }
+    }
+    else if (z.elementCount() > 0 || delta.elementCount() > 0)
+    {
+        z = Tensor<float>();
+        dy_dz = Tensor<float>();
+        delta = Tensor<float>();
+    }
+}
+
 std::string Layer::getName() const
 {
     return name;
@@ -72,6 +112,11 @@ void Layer::updateParameters()
     }
 }
 
+double Layer::getCrossoverFill() const
+{
+    return crossover.crossoverFill();
+}
+
 std::pair<std::string, cv::Mat> Layer::displayMask()
 {
     getMask();
@@ -89,11 +134,11 @@ Tensor<float>* Layer::getDelta()
     return &delta;
 }
 
-Tensor<float> *Layer::getMask()
+BitMask *Layer::getMask()
 {
     if (!maskEnabled)
     {
-        mask.fillwith(1.0);
+        mask.fill();
     }
     return &mask;
 }
@@ -105,9 +150,57 @@ void Layer::setTrainingMode(bool isTraining)
 
 void Layer::setMaskEnabled(bool maskEnabled)
 {
+    if (this->maskEnabled != maskEnabled)
+    {
+        invalidateCache();
+    }
     this->maskEnabled = maskEnabled;
 }
 
+void Layer::invalidateCache()
+{
+    cacheValid = false;
+}
+
+long Layer::getCacheVersion() const
+{
+    return cacheVersion;
+}
+
+bool Layer::cacheUsable() const
+{
+    if (!maskEnabled || isTraining || !cacheValid)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < bottoms.size(); i++)
+    {
+        if (bottoms[i]->getCacheVersion() != bottomVersions[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Layer::cacheUpdated(bool dense)
+{
+    if (dense)
+    {
+        cacheVersion++;
+    }
+
+    bottomVersions.resize(bottoms.size());
+    for (size_t i = 0; i < bottoms.size(); i++)
+    {
+        bottomVersions[i] = bottoms[i]->getCacheVersion();
+    }
+
+    cacheValid = true;
+}
+
 void Layer::initializeWeightsStandardDistr()
 {
     std::normal_distribution<double> d(0.0, 1.0);
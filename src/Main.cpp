@@ -2,6 +2,11 @@
 #include "Visuals.hpp"
 #include "DataLoader.hpp"
 #include "Statistics.hpp"
+#include "Gemm.hpp"
+#include "Crossover.hpp"
+#include "VideoPipeline.hpp"
+#include "MaskGenerator.hpp"
+#include <random>
 #include <iostream>
 #include <fstream>
 #include <ostream>
@@ -16,13 +21,25 @@ void fullSpeedTest(Network &net, std::string filename);
 void layerSpeedTest();
 double layerSpeedTest(Network& net, int percent, int layers);
 void fullLayerSpeedTest(Network& net, std::string filename, int layers);
+void gemmSpeedTest();
+void pipelineSpeedTest(Network& net, std::string filename);
+void maskGeneratorTest(std::string filename, int threshold, double noise);
 
-int main()
+int main(int argc, char **argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "--gemm-benchmark")
+    {
+        gemmSpeedTest();
+        return 0;
+    }
+
     std::string filename = "/home/oleg/cctv.avi";
     std::string noisy = filename + ".noisy.avi";
     DenoiseVideo(filename, 3);
     //layerSpeedTest();
+    //Network net("/home/oleg/Deep_learning/fcn/fcn.berkeleyvision.org/voc-fcn32s/fcn32s-heavy-pascal.caffemodel", 0);
+    //pipelineSpeedTest(net, filename);
+    //maskGeneratorTest(filename, 30, 0.01);
     return 0;
 }
 
@@ -59,6 +76,112 @@ void layerSpeedTest()
 }
 
 
+// Times the in-house GEMM kernel against the BLAS path of sgemm for convolution shapes
+// (m = output channels, k = input channels * 3 * 3) over growing numbers of masked columns n.
+// minSmallColumns and maxSmallColumns in Gemm.cpp are set from its output.
+void gemmSpeedTest()
+{
+    const std::vector<std::pair<int, int>> shapes = {{64, 576}, {128, 1152}, {256, 2304}, {512, 4608}, {21, 4096}};
+    const std::vector<int> columns = {8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192};
+
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> distr(-1, 1);
+
+    std::cout << "m,k,n,own,blas" << std::endl;
+    for (auto& shape : shapes)
+    {
+        const int m = shape.first;
+        const int k = shape.second;
+        int ownFrom = -1, ownTo = -1;
+        for (int n : columns)
+        {
+            std::vector<float> a(m * k), b(k * n), c(m * n);
+            for (auto& x : a) x = distr(gen);
+            for (auto& x : b) x = distr(gen);
+            const int repeats = std::max(1, (int)(1e9 / (2.0 * m * n * k)));
+
+            StopWatch own;
+            for (int i = 0; i < repeats; i++)
+            {
+                smallGemm(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+            }
+            const double ownTime = own.seconds() / repeats;
+
+            StopWatch blas;
+            for (int i = 0; i < repeats; i++)
+            {
+                blasSgemm(false, false, m, n, k, a.data(), k, b.data(), n, c.data(), n);
+            }
+            const double blasTime = blas.seconds() / repeats;
+
+            if (ownTime < blasTime)
+            {
+                ownFrom = ownFrom < 0 ? n : ownFrom;
+                ownTo = n;
+            }
+            std::cout << m << "," << k << "," << n << "," << ownTime << "," << blasTime << std::endl;
+        }
+        std::cout << "m " << m << " k " << k << ": in-house kernel faster from n = " << ownFrom << " to " << ownTo << std::endl;
+    }
+}
+
+// Frame rate of a video through the staged pipeline, and where the time goes
+void pipelineSpeedTest(Network& net, std::string filename)
+{
+    cv::VideoCapture cap(filename);
+    net.setMaskEnabled(true);
+    VideoPipeline pipeline(net, 30);
+
+    int frames = 0;
+    StopWatch watch;
+    pipeline.run([&](cv::Mat& frame) { return cap.read(frame); },
+                 [&](const cv::Mat&, const Tensor<float>&) { frames++; });
+    const double seconds = watch.seconds();
+
+    std::cout << frames << " frames, " << frames / seconds << " fps, latency "
+              << pipeline.meanLatencySeconds() * 1000 << " ms" << std::endl;
+    std::cout << "stage,frames,busy ms/frame,wait ms/frame,max ms" << std::endl;
+    for (const auto& stage : pipeline.stageStats())
+    {
+        const double perFrame = 1000.0 / std::max<uint64_t>(stage.frames, 1);
+        std::cout << stage.name << "," << stage.frames << "," << stage.busySeconds * perFrame << ","
+                  << stage.waitSeconds * perFrame << "," << stage.maxFrameSeconds * 1000 << std::endl;
+    }
+}
+
+// Cost and fill ratio of the mask generators on the same frames, optionally with salt and pepper
+// noise. The tile fill is what the masked convolutions see with 8 x 8 tiles.
+void maskGeneratorTest(std::string filename, int threshold, double noise)
+{
+    constexpr int maxFrames = 300;
+    cv::VideoCapture cap(filename);
+    std::vector<cv::Mat> frames;
+    cv::Mat frame;
+    while ((int)frames.size() < maxFrames && cap.read(frame))
+    {
+        frames.push_back(noise > 0 ? saltAndPepper(frame, noise) : frame.clone());
+    }
+
+    const std::vector<std::string> names = {"pixel", "pixel+open", "block", "block+open", "background", "background+open"};
+    std::cout << "generator,ms/frame,fill,tile fill" << std::endl;
+    for (const auto& name : names)
+    {
+        auto generator = makeMaskGenerator(name, threshold);
+        generator->setReference(frames[0]);
+
+        double seconds = 0, fill = 0, tileFill = 0;
+        for (size_t i = 1; i < frames.size(); i++)
+        {
+            StopWatch watch;
+            const BitMask& mask = generator->detect(frames[i]);
+            seconds += watch.seconds();
+            fill += mask.howFilled();
+            tileFill += generator->tiles(8).howFilled();
+        }
+        const double n = std::max<double>(frames.size() - 1, 1);
+        std::cout << name << "," << seconds / n * 1000 << "," << fill / n << "," << tileFill / n << std::endl;
+    }
+}
 
 void fullSpeedTest(Network& net, std::string filename)
 {
@@ -0,0 +1,40 @@
+#include "MaskGenerator.hpp"
+#include "ChangeDetector.hpp"
+#include "BlockSadDetector.hpp"
+#include "BackgroundSubtractor.hpp"
+#include "MorphologicalFilter.hpp"
+
+namespace MaskedCNN
+{
+
+const TileMask& MaskGenerator::tiles(int tileSize)
+{
+    tileMask.setTileSize(tileSize);
+    tileMask.build(mask());
+    return tileMask;
+}
+
+std::unique_ptr<MaskGenerator> makeMaskGenerator(const std::string &name, int threshold)
+{
+    const std::string suffix = "+open";
+    if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+    {
+        return std::make_unique<MorphologicalFilter>(makeMaskGenerator(name.substr(0, name.size() - suffix.size()), threshold));
+    }
+
+    if (name == "pixel")
+    {
+        return std::make_unique<ChangeDetector>(threshold);
+    }
+    if (name == "block")
+    {
+        return std::make_unique<BlockSadDetector>(threshold);
+    }
+    if (name == "background")
+    {
+        return std::make_unique<BackgroundSubtractor>(threshold);
+    }
+    throw std::runtime_error("Unknown mask generator " + name);
+}
+
+}
@@ -0,0 +1,506 @@
+#include "ModelFile.hpp"
+#include "ConvolutionalLayer.hpp"
+#include "InputLayer.hpp"
+#include "FullyConnectedLayer.hpp"
+#include "DropoutLayer.hpp"
+#include "PoolLayer.hpp"
+#include "PipeLayer.hpp"
+#include "EltwiseLayer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MaskedCNN
+{
+
+static constexpr char magic[4] = {'M', 'C', 'N', 'N'};
+static constexpr uint32_t version = 1;
+static constexpr size_t blobAlignment = 64;
+
+// The first blobAlignment bytes of a file
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t descriptionOffset;
+    uint64_t descriptionSize;
+};
+static_assert(sizeof(FileHeader) <= blobAlignment, "The header has to end before the first blob");
+
+enum class LayerKind : uint32_t
+{
+    Input,
+    Convolution,
+    Deconvolution,
+    Pool,
+    Dropout,
+    Pipe,
+    Eltwise,
+    FullyConnected
+};
+
+enum class ActivationKind : int32_t
+{
+    Id,
+    ReLu
+};
+
+static ActivationKind activationKind(const Activation &activation, const std::string &layer)
+{
+    if (dynamic_cast<const ReLu*>(&activation))
+    {
+        return ActivationKind::ReLu;
+    }
+    if (dynamic_cast<const Id*>(&activation))
+    {
+        return ActivationKind::Id;
+    }
+    throw std::runtime_error("Layer " + layer + ": only ReLU and identity activations can be stored");
+}
+
+static std::unique_ptr<Activation> makeActivation(ActivationKind kind)
+{
+    switch (kind)
+    {
+    case ActivationKind::Id:
+        return std::make_unique<Id>();
+    case ActivationKind::ReLu:
+        return std::make_unique<ReLu>();
+    }
+    throw std::runtime_error("Unknown activation in model file");
+}
+
+static LayerKind layerKind(const Layer *layer)
+{
+    if (dynamic_cast<const InputLayer*>(layer)) return LayerKind::Input;
+    if (dynamic_cast<const ConvolutionalLayer*>(layer)) return LayerKind::Convolution;
+    if (dynamic_cast<const DeconvolutionalLayer*>(layer)) return LayerKind::Deconvolution;
+    if (dynamic_cast<const PoolLayer*>(layer)) return LayerKind::Pool;
+    if (dynamic_cast<const DropoutLayer*>(layer)) return LayerKind::Dropout;
+    if (dynamic_cast<const PipeLayer*>(layer)) return LayerKind::Pipe;
+    if (dynamic_cast<const EltwiseLayer*>(layer)) return LayerKind::Eltwise;
+    if (dynamic_cast<const FullyConnectedLayer*>(layer)) return LayerKind::FullyConnected;
+    throw std::runtime_error("Layer " + layer->getName() + " can't be stored in a model file");
+}
+
+// Blobs go to the file as they come, the description is collected and appended at the end
+class ModelWriter
+{
+public:
+    explicit ModelWriter(const std::string &path)
+        :file(path, std::ios::binary | std::ios::trunc)
+    {
+        if (!file)
+        {
+            throw std::runtime_error("Could not open " + path + " for writing");
+        }
+        const char header[blobAlignment] = {};
+        file.write(header, sizeof(header));
+    }
+
+    template<typename T>
+    void put(const T &value)
+    {
+        const char *bytes = reinterpret_cast<const char*>(&value);
+        description.insert(description.end(), bytes, bytes + sizeof(T));
+    }
+
+    void putString(const std::string &text)
+    {
+        put<uint32_t>(text.size());
+        description.insert(description.end(), text.begin(), text.end());
+    }
+
+    // Shape and offset, an empty shape for none
+    void putTensor(const Tensor<float> &tensor)
+    {
+        const Shape &dims = tensor.dimensions();
+        put<uint32_t>(dims.size());
+        for (int d : dims)
+        {
+            put<int32_t>(d);
+        }
+        if (!dims.empty())
+        {
+            put<uint64_t>(writeBlob(tensor.dataAddress(), tensor.elementCount()));
+        }
+    }
+
+    // Rows, columns and stride as laid out, rows = 0 for none
+    void putPacked(const PackedWeights &weights)
+    {
+        const bool stored = !weights.empty() && !weights.transposed();
+        put<int32_t>(stored ? weights.rows() : 0);
+        if (stored)
+        {
+            put<int32_t>(weights.cols());
+            put<int32_t>(weights.stride());
+            // Rows with their padding, as the kernels read them
+            const size_t count = (size_t)weights.rows() * weights.stride();
+            put<uint64_t>(writeBlob(weights.data(), count));
+        }
+    }
+
+    void finish()
+    {
+        FileHeader header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.descriptionOffset = file.tellp();
+        header.descriptionSize = description.size();
+
+        file.write(description.data(), description.size());
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!file.flush())
+        {
+            throw std::runtime_error("Could not write the model file");
+        }
+    }
+
+private:
+    uint64_t writeBlob(const float *data, size_t count)
+    {
+        const char padding[blobAlignment] = {};
+        const size_t position = file.tellp();
+        file.write(padding, (blobAlignment - position % blobAlignment) % blobAlignment);
+
+        const uint64_t offset = file.tellp();
+        file.write(reinterpret_cast<const char*>(data), count * sizeof(float));
+        return offset;
+    }
+
+    std::ofstream file;
+    std::vector<char> description;
+};
+
+// Reads the description, checking every read and blob against the size of the file
+class ModelReader
+{
+public:
+    ModelReader(uint8_t *base, size_t length, uint64_t offset, uint64_t size)
+        :base(base), length(length), position(offset), end(offset + size)
+    {
+        if (end > length || end < offset)
+        {
+            throw std::runtime_error("Truncated model file");
+        }
+    }
+
+    template<typename T>
+    T get()
+    {
+        if (end - position < sizeof(T))
+        {
+            throw std::runtime_error("Truncated model file");
+        }
+        T value;
+        std::memcpy(&value, base + position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    std::string getString()
+    {
+        const uint32_t size = get<uint32_t>();
+        if (end - position < size)
+        {
+            throw std::runtime_error("Truncated model file");
+        }
+        std::string text(reinterpret_cast<const char*>(base + position), size);
+        position += size;
+        return text;
+    }
+
+    // A view of the blob, an empty tensor for none
+    Tensor<float> getTensor()
+    {
+        const uint32_t count = get<uint32_t>();
+        if (count > Shape::maxDims)
+        {
+            throw std::runtime_error("Corrupt model file");
+        }
+        std::vector<int> dims(count);
+        int64_t elements = 1;
+        for (auto &d : dims)
+        {
+            d = get<int32_t>();
+            // Bounded by the int a tensor counts its elements in, so the product can't overflow
+            if (d <= 0 || elements * d > std::numeric_limits<int>::max())
+            {
+                throw std::runtime_error("Corrupt model file");
+            }
+            elements *= d;
+        }
+        if (dims.empty())
+        {
+            return Tensor<float>();
+        }
+        return Tensor<float>(blob(get<uint64_t>(), elements), Shape(dims), shallow_copy{});
+    }
+
+    // Empty if none was stored
+    PackedWeights getPacked()
+    {
+        const int rows = get<int32_t>();
+        if (rows == 0)
+        {
+            return PackedWeights();
+        }
+        const int cols = get<int32_t>();
+        const int stride = get<int32_t>();
+        if (rows < 0 || cols <= 0 || stride < cols)
+        {
+            throw std::runtime_error("Corrupt model file");
+        }
+        const size_t count = (size_t)rows * stride;
+        return PackedWeights::packedView(blob(get<uint64_t>(), count), rows, cols, stride);
+    }
+
+private:
+    float *blob(uint64_t offset, size_t count)
+    {
+        if (offset % blobAlignment != 0 || offset > length || (length - offset) / sizeof(float) < count)
+        {
+            throw std::runtime_error("Corrupt model file");
+        }
+        return reinterpret_cast<float*>(base + offset);
+    }
+
+    uint8_t *base;
+    size_t length;
+    uint64_t position;
+    uint64_t end;
+};
+
+ModelFile::ModelFile(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < blobAlignment)
+    {
+        close(fd);
+        throw std::runtime_error(path + " is not a model file");
+    }
+    length = info.st_size;
+
+    // Writable but private: shared with every other mapping until a page is written
+    void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map " + path);
+    }
+    address = static_cast<uint8_t*>(mapped);
+
+    FileHeader header;
+    std::memcpy(&header, address, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+    {
+        munmap(address, length);
+        throw std::runtime_error(path + " is not a model file of version " + std::to_string(version));
+    }
+}
+
+ModelFile::~ModelFile()
+{
+    munmap(address, length);
+}
+
+bool ModelFile::isModelPath(const std::string &path)
+{
+    const std::string extension = ".mcnn";
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+void ModelFile::save(const std::vector<std::unique_ptr<Layer>> &layers, const std::string &path)
+{
+    std::map<const Layer*, int> index;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        index.emplace(layers[i].get(), i);
+    }
+
+    ModelWriter writer(path);
+    writer.put<uint32_t>(layers.size());
+    for (const auto &layer : layers)
+    {
+        const Layer *l = layer.get();
+        const std::string name = l->getName();
+
+        const LayerKind kind = layerKind(l);
+        writer.put(kind);
+        writer.putString(name);
+        writer.put<uint32_t>(l->getBottoms().size());
+        for (const Layer *bottom : l->getBottoms())
+        {
+            writer.put<int32_t>(index.at(bottom));
+        }
+
+        switch (kind)
+        {
+        case LayerKind::Convolution:
+        case LayerKind::Deconvolution:
+        {
+            const auto *conv = static_cast<const BaseConvolutionalLayer*>(l);
+            writer.put(activationKind(conv->getActivation(), name));
+            writer.put<int32_t>(conv->getStride());
+            writer.put<int32_t>(conv->getPad());
+            writer.putTensor(conv->getWeights());
+            writer.putTensor(conv->getBiases());
+            writer.putPacked(conv->getPackedWeights());
+            if (kind == LayerKind::Convolution)
+            {
+                writer.putTensor(static_cast<const ConvolutionalLayer*>(l)->getWinogradFilter());
+            }
+            break;
+        }
+        case LayerKind::Pool:
+            writer.put<int32_t>(static_cast<const PoolLayer*>(l)->getWindowSize());
+            break;
+        case LayerKind::Dropout:
+            writer.put<double>(static_cast<const DropoutLayer*>(l)->getDropProbability());
+            break;
+        case LayerKind::FullyConnected:
+        {
+            const auto *fc = static_cast<const FullyConnectedLayer*>(l);
+            writer.put(activationKind(fc->getActivation(), name));
+            writer.putTensor(fc->getWeights());
+            writer.putTensor(fc->getBiases());
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    writer.finish();
+}
+
+std::vector<std::unique_ptr<Layer>> ModelFile::createLayers() const
+{
+    FileHeader header;
+    std::memcpy(&header, address, sizeof(header));
+    ModelReader reader(address, length, header.descriptionOffset, header.descriptionSize);
+
+    std::vector<std::unique_ptr<Layer>> result;
+    const uint32_t count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const LayerKind kind = reader.get<LayerKind>();
+        const std::string name = reader.getString();
+        std::vector<int> bottoms(reader.get<uint32_t>());
+        for (auto &bottom : bottoms)
+        {
+            bottom = reader.get<int32_t>();
+            if (bottom < 0 || bottom >= (int)i)
+            {
+                throw std::runtime_error("Layer " + name + " of the model file reads a layer after it");
+            }
+        }
+
+        switch (kind)
+        {
+        case LayerKind::Input:
+            result.emplace_back(new InputLayer(name));
+            break;
+        case LayerKind::Convolution:
+        case LayerKind::Deconvolution:
+        {
+            auto activation = makeActivation(reader.get<ActivationKind>());
+            const int stride = reader.get<int32_t>();
+            const int pad = reader.get<int32_t>();
+            Tensor<float> weights = reader.getTensor();
+            Tensor<float> biases = reader.getTensor();
+            const Shape &dims = weights.dimensions();
+            if (dims.size() != 4)
+            {
+                throw std::runtime_error("Layer " + name + " of the model file has no filter");
+            }
+            if (dims[2] != dims[3] || biases.dimensions() != Shape{dims[0]})
+            {
+                throw std::runtime_error("Corrupt model file");
+            }
+            PackedWeights packed = reader.getPacked();
+            if (!packed.empty() && (int64_t)packed.rows() * packed.cols() != weights.elementCount())
+            {
+                throw std::runtime_error("Corrupt model file");
+            }
+
+            std::unique_ptr<BaseConvolutionalLayer> conv;
+            if (kind == LayerKind::Convolution)
+            {
+                Tensor<float> winogradFilter = reader.getTensor();
+                if (winogradFilter.elementCount() > 0 && winogradFilter.dimensions() != Shape{16, dims[0], dims[1]})
+                {
+                    throw std::runtime_error("Corrupt model file");
+                }
+                auto layer = std::make_unique<ConvolutionalLayer>(std::move(activation), std::move(weights), std::move(biases), stride, pad, name);
+                if (winogradFilter.elementCount() > 0)
+                {
+                    layer->useWinogradFilter(std::move(winogradFilter));
+                }
+                conv = std::move(layer);
+            }
+            else
+            {
+                conv = std::make_unique<DeconvolutionalLayer>(std::move(activation), std::move(weights), std::move(biases), stride, pad, name);
+            }
+
+            if (packed.empty())
+            {
+                conv->packWeights();
+            }
+            else
+            {
+                conv->usePackedWeights(std::move(packed));
+            }
+            result.push_back(std::move(conv));
+            break;
+        }
+        case LayerKind::Pool:
+            result.emplace_back(new PoolLayer(reader.get<int32_t>(), name));
+            break;
+        case LayerKind::Dropout:
+            result.emplace_back(new DropoutLayer(reader.get<double>(), name));
+            break;
+        case LayerKind::Pipe:
+            result.emplace_back(new PipeLayer(name));
+            break;
+        case LayerKind::Eltwise:
+            result.emplace_back(new EltwiseLayer(name));
+            break;
+        case LayerKind::FullyConnected:
+        {
+            auto activation = makeActivation(reader.get<ActivationKind>());
+            Tensor<float> weights = reader.getTensor();
+            Tensor<float> biases = reader.getTensor();
+            if (weights.dimensions().size() != 2 || biases.dimensions() != Shape{weights.columnLength()})
+            {
+                throw std::runtime_error("Corrupt model file");
+            }
+            result.emplace_back(new FullyConnectedLayer(std::move(activation), std::move(weights), std::move(biases), name));
+            break;
+        }
+        default:
+            throw std::runtime_error("Unknown layer kind in model file");
+        }
+
+        for (int bottom : bottoms)
+        {
+            result.back()->addBottom(result[bottom].get());
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,51 @@
+#include "MorphologicalFilter.hpp"
+
+namespace MaskedCNN
+{
+
+MorphologicalFilter::MorphologicalFilter(std::unique_ptr<MaskGenerator> source, int openRadius, int growRadius)
+    :source(std::move(source)), openRadius(openRadius), growRadius(growRadius)
+{
+    if (openRadius < 0 || growRadius < 0 || openRadius + growRadius >= 64)
+    {
+        throw std::runtime_error("Morphology radii have to be non-negative and below 64 together");
+    }
+}
+
+void MorphologicalFilter::setThreshold(int threshold)
+{
+    source->setThreshold(threshold);
+}
+
+void MorphologicalFilter::setReference(const cv::Mat &frame)
+{
+    source->setReference(frame);
+    cleaned.resize(frame.rows, frame.cols);
+}
+
+const BitMask& MorphologicalFilter::detect(const cv::Mat &frame)
+{
+    const BitMask& raw = source->detect(frame);
+    if (openRadius == 0)
+    {
+        cleaned.dilateFrom(raw, growRadius);
+        return cleaned;
+    }
+
+    // Dilating by openRadius completes the opening, by growRadius more grows its result
+    eroded.erodeFrom(raw, openRadius);
+    cleaned.dilateFrom(eroded, openRadius + growRadius);
+    return cleaned;
+}
+
+std::unique_ptr<MaskGenerator> MorphologicalFilter::clone() const
+{
+    return std::make_unique<MorphologicalFilter>(source->clone(), openRadius, growRadius);
+}
+
+std::string MorphologicalFilter::name() const
+{
+    return source->name() + "+open";
+}
+
+}
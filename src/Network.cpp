@@ -7,6 +7,9 @@
 #include <iomanip>
 #include <array>
 #include <deque>
+#include <limits>
+#include <map>
+#include <set>
 
 #include <fstream>
 #include "NetworkLoader.hpp"
@@ -20,7 +23,8 @@ namespace MaskedCNN
 {
 
 Network::Network(std::vector<std::unique_ptr<Layer>> layers, int threshold)
-    :layers(std::move(layers)), threshold(threshold)
+    :layers(std::move(layers)), executor(this->layers), maskEnabled(false),
+      initDone(false), threshold(threshold), generator(std::make_unique<ChangeDetector>(threshold))
 {
     displayMaskSwitch.resize(this->layers.size());
     for (uint32_t i = 0; i < this->layers.size(); i++)
@@ -30,9 +34,14 @@ Network::Network(std::vector<std::unique_ptr<Layer>> layers, int threshold)
     }
 }
 
+static std::unique_ptr<ModelFile> openModel(const std::string &path)
+{
+    return ModelFile::isModelPath(path) ? std::make_unique<ModelFile>(path) : nullptr;
+}
+
 Network::Network(std::string modelPath, int threshold)
-    :layers(loadCaffeNet(modelPath)), maskEnabled(false),
-      initDone(false), maskInitDone(false), threshold(threshold)
+    :model(openModel(modelPath)), layers(model ? model->createLayers() : loadCaffeNet(modelPath)), executor(layers), maskEnabled(false),
+      initDone(false), threshold(threshold), generator(std::make_unique<ChangeDetector>(threshold))
 {
     displayMaskSwitch.resize(layers.size());
     for (uint32_t i = 0; i < layers.size(); i++)
@@ -57,88 +66,243 @@ void Network::setDisplayMask(std::string name, bool display)
     }
 }
 
+// Toggling the mask invalidates the layer caches, so the next frame is computed densely
+// and the ones after it incrementally
 void Network::setMaskEnabled(bool enabled)
 {
     maskEnabled = enabled;
-    maskInitDone = false;
+    if (enabled)
+    {
+        releaseMemoryPlan();
+    }
 
     for (uint32_t i = 0; i < layers.size(); i++)
     {
-        layers[i]->setMaskEnabled(false);
+        layers[i]->setMaskEnabled(enabled);
+    }
+}
+
+void Network::invalidateCaches()
+{
+    for (uint32_t i = 0; i < layers.size(); i++)
+    {
+        layers[i]->invalidateCache();
     }
 }
 
 void Network::setThreshold(int threshold)
 {
     this->threshold = threshold;
+    generator->setThreshold(threshold);
+    for (auto& streamGenerator : streamGenerators)
+    {
+        if (streamGenerator)
+        {
+            streamGenerator->setThreshold(threshold);
+        }
+    }
 }
 
-std::vector<std::pair<std::string, cv::Mat>> Network::forward(const cv::Mat& input)
+void Network::setMaskGenerator(std::unique_ptr<MaskGenerator> generator)
 {
-    Tensor<float> image;
-    Tensor<float> mask;
+    if (!generator)
+    {
+        throw std::runtime_error("No mask generator");
+    }
+    // Without a reference its first mask is empty, so the caches can't be trusted for that frame
+    this->generator = std::move(generator);
+    // Clones of the old default are replaced, generators set for a stream are kept
+    for (size_t i = 0; i < streamGenerators.size(); i++)
+    {
+        if (!streamGeneratorSet[i])
+        {
+            streamGenerators[i].reset();
+        }
+    }
+    batchFrameSize = cv::Size();
+    invalidateCaches();
+}
+
+void Network::setMaskGenerator(int stream, std::unique_ptr<MaskGenerator> generator)
+{
+    if (!generator || stream < 0)
+    {
+        throw std::runtime_error("No mask generator or no such stream");
+    }
+    if (stream >= (int)streamGenerators.size())
+    {
+        streamGenerators.resize(stream + 1);
+        streamGeneratorSet.resize(stream + 1, false);
+    }
+    streamGenerators[stream] = std::move(generator);
+    streamGeneratorSet[stream] = true;
+    batchFrameSize = cv::Size();
+}
+
+// Per channel means of the training images, in BGR order
+static const float inputMean[3] = {104.00699f, 116.66877f, 122.67892f};
 
-    if (!initDone || prevFrame.size() != input.size())
+std::vector<std::pair<std::string, cv::Mat>> Network::forward(const cv::Mat& input)
+{
+    if (!initDone || currentFrame.size() != input.size())
     {
-        mask.resize({input.rows, input.cols});
         image.resize({3, input.rows, input.cols});
-        input.copyTo(prevFrame);
-        accumMatrix.resize({input.rows, input.cols});
-        accumMatrix.zero();
+        invalidateCaches();
+        releaseMemoryPlan();
         initDone = true;
     }
 
     input.copyTo(currentFrame);
-    mask = diffFrames(currentFrame, prevFrame, accumMatrix, threshold);
-    image = matToTensor(currentFrame);
-    image.add(-104.00699, -116.66877, -122.67892);
+    const BitMask& mask = generator->detect(currentFrame);
+    toInput(currentFrame, image);
     std::cout << "Mask filled:" << mask.howFilled() << std::endl;
-    dynamic_cast<InputLayer*>(layers[0].get())->setInput(image);
-    dynamic_cast<InputLayer*>(layers[0].get())->setMask(mask);
+    infer(image, mask);
+
+    std::vector<std::pair<std::string, cv::Mat>> result;
 
-    times(&beginTime);
     for (uint32_t i = 0; i < layers.size(); i++)
     {
-        layers[i]->forwardPropagate();
+        if (displayMaskSwitch[i])
+        {
+            std::cout << layers[i]->getName() << ":" << layers[i]->getMask()->howFilled()
+                      << " (dense above " << layers[i]->getCrossoverFill() << ")" << std::endl;
+            result.emplace_back(layers[i]->displayMask());
+        }
+    }
+
+    result.emplace_back("Result", visualizeOutput(classes(currentFrame.size())));
+    return result;
+}
+
+void Network::toInput(const cv::Mat& frame, Tensor<float>& image)
+{
+    image.resize({3, frame.rows, frame.cols}, uninitialized{});
+    toInput(frame, TensorView<float>(image));
+}
+
+void Network::toInput(const cv::Mat& frame, TensorView<float> image)
+{
+    bgrToTensor(frame, image, inputMean);
+}
+
+void Network::infer(const Tensor<float>& input, const Tensor<float>& inputMask)
+{
+    dynamic_cast<InputLayer*>(layers[0].get())->setMask(inputMask);
+    runLayers(input);
+}
+
+void Network::infer(const Tensor<float>& input, const BitMask& inputMask)
+{
+    dynamic_cast<InputLayer*>(layers[0].get())->setMask(inputMask);
+    runLayers(input);
+}
+
+void Network::runLayers(const Tensor<float>& input)
+{
+    // The plan was made for the sizes of the last input
+    if (input.dimensions() != inferredDimensions)
+    {
+        releaseMemoryPlan();
+        inferredDimensions = input.dimensions();
     }
+
+    dynamic_cast<InputLayer*>(layers[0].get())->setInput(input);
+
+    times(&beginTime);
+    executor.forward();
     times(&endTime);
 
-    std::vector<std::pair<std::string, cv::Mat>> result;
+    if (!maskEnabled && !memoryPlanned)
+    {
+        planMemory();
+    }
+}
 
-    for (uint32_t i = 0; i < layers.size(); i++)
+Tensor<float> Network::classes(cv::Size size)
+{
+    return maxarg(TensorView<const float>(*layers.back()->getOutput()).crop(8, 8, size.height, size.width));
+}
+
+std::vector<Tensor<float>> Network::forwardBatch(const std::vector<cv::Mat> &inputs)
+{
+    auto present = std::find_if(inputs.begin(), inputs.end(), [](const cv::Mat& input) { return !input.empty(); });
+    if (present == inputs.end())
     {
-        if (displayMaskSwitch[i])
+        throw std::runtime_error("Empty batch");
+    }
+    const int frames = inputs.size();
+    const cv::Size size = present->size();
+    for (const auto& input : inputs)
+    {
+        if (!input.empty() && input.size() != size)
         {
-            std::cout << layers[i]->getName() << ":" << layers[i]->getMask()->howFilled() << std::endl;
-            result.emplace_back(layers[i]->displayMask());
+            throw std::runtime_error("Frames of a batch have to be of the same size");
         }
     }
 
-    currentFrame.copyTo(prevFrame);
+    if (batchMask.batch() != frames || batchFrameSize != size)
+    {
+        // Streams past this batch keep their generators for a larger one
+        if ((int)streamGenerators.size() < frames)
+        {
+            streamGenerators.resize(frames);
+            streamGeneratorSet.resize(frames, false);
+        }
+        for (int n = 0; n < frames; n++)
+        {
+            if (!streamGenerators[n])
+            {
+                streamGenerators[n] = generator->clone();
+            }
+        }
+        batchFrameSize = size;
+        batchImage.resize({frames, 3, size.height, size.width});
+        batchMask.resize(size.height, size.width, frames);
+        invalidateCaches();
 
-    if (maskEnabled && !maskInitDone)
+        // A slot without a frame yet starts black
+        const cv::Mat black = cv::Mat::zeros(size, CV_8UC3);
+        for (int n = 0; n < frames; n++)
+        {
+            const cv::Mat& first = inputs[n].empty() ? black : inputs[n];
+            streamGenerators[n]->setReference(first);
+            toInput(first, TensorView<float>(batchImage).frame(n));
+        }
+    }
+
+    for (int n = 0; n < frames; n++)
     {
-        for (uint32_t i = 0; i < layers.size(); i++)
+        uint64_t *maskPlane = batchMask.row(n * size.height);
+        const int planeWords = size.height * batchMask.wordsPerRow();
+        if (inputs[n].empty())
         {
-            layers[i]->setMaskEnabled(true);
+            // Nothing changed: the slot keeps its image and costs no work
+            std::fill_n(maskPlane, planeWords, 0);
+            continue;
+        }
+
+        const BitMask& frameMask = streamGenerators[n]->detect(inputs[n]);
+        std::copy_n(frameMask.row(0), planeWords, maskPlane);
+        toInput(inputs[n], TensorView<float>(batchImage).frame(n));
+    }
+
+    infer(batchImage, batchMask);
+
+    const TensorView<const float> output(*layers.back()->getOutput());
+    std::vector<Tensor<float>> result(frames);
+    for (int n = 0; n < frames; n++)
+    {
+        if (!inputs[n].empty())
+        {
+            result[n] = maxarg(output.frame(n).crop(8, 8, size.height, size.width));
         }
-        maskInitDone = true;
     }
-    result.emplace_back("Result", cropLike(visualizeOutput(maxarg(*layers.back()->getOutput())), currentFrame, 8));
     return result;
 }
 
 void Network::dummyForward(const Tensor<float> &input, const Tensor<float>& mask)
 {
-    dynamic_cast<InputLayer*>(layers[0].get())->setInput(input);
-    dynamic_cast<InputLayer*>(layers[0].get())->setMask(mask);
-
-    times(&beginTime);
-    for (uint32_t i = 0; i < layers.size(); i++)
-    {
-        layers[i]->forwardPropagate();
-    }
-    times(&endTime);
+    infer(input, mask);
 }
 
 std::vector<std::string> Network::layerNames() const
@@ -160,7 +324,132 @@ std::vector<std::string> Network::layerNames() const
 
 Tensor<float> Network::getOutput()
 {
-    return cropLike(maxarg(*layers.back()->getOutput()), currentFrame, 8);
+    return classes(currentFrame.size());
+}
+
+void Network::planMemory()
+{
+    releaseMemoryPlan();
+
+    // The layer whose output each layer reads: pipes hand on their bottom's output
+    const int count = layers.size();
+    std::map<const Tensor<float>*, int> producer;
+    for (int i = 0; i < count; i++)
+    {
+        producer.emplace(layers[i]->getOutput(), i);
+    }
+
+    std::vector<std::vector<int>> readers(count);
+    for (int i = 0; i < count; i++)
+    {
+        for (Layer *bottom : layers[i]->getBottoms())
+        {
+            readers[producer.at(bottom->getOutput())].push_back(i);
+        }
+    }
+
+    // Branches run concurrently, so an output is only dead for a layer that all of its readers
+    // precede. Outputs nobody reads are results of the network and stay alive.
+    auto deadFor = [&](int p, int i)
+    {
+        return !readers[p].empty() && std::all_of(readers[p].begin(), readers[p].end(),
+                                                  [&](int reader) { return executor.precedes(reader, i); });
+    };
+
+    // Greedy in layer order: the smallest free buffer that fits, else the largest free one grown
+    std::vector<int> assigned(count, -1);
+    std::vector<int> occupant;
+    std::vector<int> storageSize;
+    for (int i = 0; i < count; i++)
+    {
+        if (producer.at(layers[i]->getOutput()) != i)
+        {
+            continue;
+        }
+
+        const int size = layers[i]->getOutput()->elementCount();
+        int best = -1;
+        for (int b = 0; b < (int)occupant.size(); b++)
+        {
+            if (!deadFor(occupant[b], i))
+            {
+                continue;
+            }
+            const bool fits = storageSize[b] >= size;
+            if (best < 0
+                    || (fits && (storageSize[best] < size || storageSize[b] < storageSize[best]))
+                    || (!fits && storageSize[best] < size && storageSize[b] > storageSize[best]))
+            {
+                best = b;
+            }
+        }
+        if (best < 0)
+        {
+            best = occupant.size();
+            occupant.push_back(i);
+            storageSize.push_back(0);
+        }
+        occupant[best] = i;
+        storageSize[best] = std::max(storageSize[best], size);
+        assigned[i] = best;
+    }
+
+    for (int size : storageSize)
+    {
+        outputStorage.emplace_back(Shape{size}, uninitialized{});
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (assigned[i] >= 0)
+        {
+            // The results of this frame are still to be read; nothing else shares their buffers
+            if (readers[i].empty())
+            {
+                const Tensor<float> *result = layers[i]->getOutput();
+                std::copy_n(result->dataAddress(), result->elementCount(), outputStorage[assigned[i]].dataAddress());
+            }
+            layers[i]->shareOutputStorage(outputStorage[assigned[i]]);
+            plannedLayers.push_back(layers[i].get());
+        }
+    }
+
+    // The outputs just replaced went back to the pool
+    if (auto pool = dynamic_cast<PoolAllocator*>(&TensorAllocator::current()))
+    {
+        pool->release();
+    }
+    memoryPlanned = true;
+}
+
+void Network::releaseMemoryPlan()
+{
+    if (!memoryPlanned)
+    {
+        return;
+    }
+
+    for (Layer *layer : plannedLayers)
+    {
+        layer->ownOutputStorage();
+    }
+    plannedLayers.clear();
+    outputStorage.clear();
+    memoryPlanned = false;
+}
+
+size_t Network::outputBytes() const
+{
+    std::set<const float*> counted;
+    size_t bytes = 0;
+    for (const auto& layer : layers)
+    {
+        const Tensor<float> *output = layer->getOutput();
+        if (counted.insert(output->dataAddress()).second)
+        {
+            bytes += output->capacity() * sizeof(float);
+        }
+    }
+    return bytes;
 }
 
 long Network::forwardTime() const
@@ -258,10 +258,25 @@ std::vector<std::unique_ptr<Layer>> loadCaffeNet(std::string path)
         }
         else if (p.type() == "Eltwise")
         {
-
+            const auto& param = p.eltwise_param();
+            if (param.operation() != caffe::EltwiseParameter_EltwiseOp_SUM || param.coeff_size() > 0)
+            {
+                throw std::runtime_error("Eltwise layer " + name + ": only a plain sum is supported");
+            }
+            result.emplace_back(new EltwiseLayer(name));
+            for (int b = 0; b < p.bottom_size(); b++)
+            {
+                AddBottom(p.bottom(b), result);
+            }
         }
     }
 
+    // The weights are final from here on, lay them out for inference once
+    for (auto& layer : result)
+    {
+        layer->packWeights();
+    }
+
     return result;
 }
 
@@ -0,0 +1,87 @@
+#include "PackedWeights.hpp"
+#include <cstdint>
+
+namespace MaskedCNN
+{
+
+// Floats per 64-byte cache line
+static constexpr int lineFloats = 16;
+
+PackedWeights::PackedWeights(const Tensor<float>& filter)
+{
+    m = filter.dimensions()[0];
+    k = filter.elementCount() / m;
+    ld = k;
+    matrix = filter.dataAddress();
+}
+
+PackedWeights PackedWeights::transposedView(const Tensor<float>& filter)
+{
+    PackedWeights result;
+    result.k = filter.dimensions()[0];
+    result.m = filter.elementCount() / result.k;
+    result.ld = result.m;
+    result.trans = true;
+    result.matrix = filter.dataAddress();
+    return result;
+}
+
+PackedWeights PackedWeights::packedView(const float *matrix, int rows, int cols, int stride)
+{
+    assert(stride >= cols);
+    PackedWeights result;
+    result.m = rows;
+    result.k = cols;
+    result.ld = stride;
+    result.matrix = matrix;
+    return result;
+}
+
+void PackedWeights::allocate(int rows, int cols)
+{
+    m = rows;
+    k = cols;
+    ld = (cols + lineFloats - 1) / lineFloats * lineFloats;
+    trans = false;
+
+    // One extra line of slack to start the matrix on a line boundary
+    storage.assign(m * ld + lineFloats, 0.0f);
+    const uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+    const uintptr_t aligned = (address + lineFloats * sizeof(float) - 1) & ~(uintptr_t)(lineFloats * sizeof(float) - 1);
+    matrix = storage.data() + (aligned - address) / sizeof(float);
+}
+
+// [out, in * f * f] as it is, only realigned
+void PackedWeights::packConvolution(const Tensor<float>& filter)
+{
+    const int rows = filter.dimensions()[0];
+    const int cols = filter.elementCount() / rows;
+    allocate(rows, cols);
+
+    float *dst = const_cast<float*>(matrix);
+    const float *src = filter.dataAddress();
+    for (int r = 0; r < rows; r++)
+    {
+        std::copy(src + r * cols, src + (r + 1) * cols, dst + r * ld);
+    }
+}
+
+// [in, out * f * f] is stored transposed, so the column GEMM needs no transposition
+void PackedWeights::packTransposedConvolution(const Tensor<float>& filter)
+{
+    const int cols = filter.dimensions()[0];
+    const int rows = filter.elementCount() / cols;
+    allocate(rows, cols);
+
+    float *dst = const_cast<float*>(matrix);
+    const float *src = filter.dataAddress();
+    for (int c = 0; c < cols; c++)
+    {
+        for (int r = 0; r < rows; r++)
+        {
+            dst[r * ld + c] = src[c * rows + r];
+        }
+    }
+}
+
+}
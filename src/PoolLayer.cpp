@@ -1,6 +1,7 @@
 #include "PoolLayer.hpp"
 #include <limits>
 #include "ConvOps.hpp"
+#include "ThreadPool.hpp"
 namespace MaskedCNN {
 
 PoolLayer::PoolLayer(int windowSize, std::string name)
@@ -12,61 +13,99 @@ PoolLayer::PoolLayer(int windowSize, std::string name)
 void PoolLayer::forwardPropagate()
 {
     const Tensor<float> &input = *bottoms[0]->getOutput();
-    const Tensor<float> &prevMask = *bottoms[0]->getMask();
 
+    auto dims = input.dimensions();
 
-    if (!initDone)
+    if (!initDone || dims != inputDimensions)
     {
-        auto dims = input.dimensions();
-
-        channels = dims[0];
-        inputHeight = dims[1];
-        inputWidth = dims[2];
+        // [C, H, W] or an [N, C, H, W] batch
+        inputDimensions = dims;
+        batch = batchSize(dims);
+        channels = dims[dims.size() - 3];
+        inputHeight = dims[dims.size() - 2];
+        inputWidth = dims[dims.size() - 1];
         outputHeight = std::floor((inputHeight - windowSize) / (double)windowSize + 1);
         outputWidth = std::floor((inputWidth - windowSize) / (double)windowSize + 1);
-        output.resize({channels, outputHeight, outputWidth});
-        delta.resize({channels, outputHeight, outputWidth});
-        mask.resize({outputHeight, outputWidth});
+        output.resize((dims.size() == 4) ? Shape{batch, channels, outputHeight, outputWidth}
+                                         : Shape{channels, outputHeight, outputWidth});
+        mask.resize(outputHeight, outputWidth, batch);
 
+        invalidateCache();
         initDone = true;
     }
+    updateTrainingBuffers(false);
 
-    mask.zero();
-    convolveMaskIm2Col(prevMask, mask, buf, windowSize, windowSize, 0);
+    const bool incremental = cacheUsable();
+    bool sparse = false;
+    StopWatch watch;
 
-    for (int j = 0; j < outputHeight; j++)
+    if (incremental)
+    {
+        // Only asked for when masked: unmasked, getMask() refills the bottom's mask, which would
+        // race with the other consumers of a split
+        mask.convolveFrom(*bottoms[0]->getMask(), windowSize, windowSize, 0);
+        sparse = !crossover.preferDense(mask.howFilled());
+    }
+    else
     {
-        for (int k = 0; k < outputWidth; k++)
+        mask.fill();
+    }
+
+    const TensorView<const float> inputView(input);
+    const TensorView<float> outputView(output);
+
+    // Output rows of all frames are independent
+    ThreadPool::global().parallelFor(batch * outputHeight, [&](int begin, int end)
+    {
+        for (int row = begin; row < end; row++)
         {
-            if (maskEnabled && mask(j,k) == 0) continue;
-            for (int i = 0; i < output.channelLength(); i++)
+            const int n = row / outputHeight;
+            const int j = row % outputHeight;
+            const TensorView<const float> inputFrame = inputView.frame(n);
+            const TensorView<float> outputFrame = outputView.frame(n);
+
+            for (int k = 0; k < outputWidth; k++)
             {
-                float max_float = std::numeric_limits<float>::lowest();
-                for (int dy = 0; dy < windowSize; dy++)
+                if (sparse && !mask.test(row, k)) continue;
+                for (int i = 0; i < channels; i++)
                 {
-                    for (int dx = 0; dx < windowSize; dx++)
+                    float max_float = std::numeric_limits<float>::lowest();
+                    for (int dy = 0; dy < windowSize; dy++)
                     {
-                        int y = j * windowSize + dy;
-                        int x = k * windowSize + dx;
+                        for (int dx = 0; dx < windowSize; dx++)
+                        {
+                            int y = j * windowSize + dy;
+                            int x = k * windowSize + dx;
 
-                        float currentEl = 0;
+                            float currentEl = 0;
 
-                        if (y >= 0 && y < inputHeight && x >= 0 && x < inputWidth)
-                        {
-                            currentEl = input(i, j * windowSize + dy, k * windowSize + dx);
-                        }
+                            if (y >= 0 && y < inputHeight && x >= 0 && x < inputWidth)
+                            {
+                                currentEl = inputFrame(i, y, x);
+                            }
 
-                        if (currentEl > max_float)
-                        {
-                            max_float = currentEl;
+                            if (currentEl > max_float)
+                            {
+                                max_float = currentEl;
+                            }
                         }
                     }
+                    outputFrame(i, j, k) = max_float;
                 }
-                output(i,j,k) = max_float;
             }
         }
+    });
+
+    if (sparse)
+    {
+        crossover.sparseMeasured(watch.seconds(), mask.count(), batch * outputHeight * outputWidth);
+    }
+    else
+    {
+        crossover.denseMeasured(watch.seconds());
     }
 
+    cacheUpdated(!incremental);
 }
 
 void PoolLayer::backwardPropagate()
@@ -74,7 +113,7 @@ void PoolLayer::backwardPropagate()
     const Tensor<float> &input = *bottoms[0]->getOutput();
     Tensor<float> &prevDelta = *bottoms[0]->getDelta();
 
-    assert(prevDelta.dimensions() == std::vector<int>({channels, inputHeight, inputWidth}));
+    assert((prevDelta.dimensions() == Shape{channels, inputHeight, inputWidth}));
 
     for (int i = 0; i < output.channelLength(); i++)
     {
@@ -103,7 +142,7 @@ void PoolLayer::backwardPropagate()
     }
 }
 
-std::vector<int> PoolLayer::getOutputDimensions()
+Shape PoolLayer::getOutputDimensions()
 {
     return output.dimensions();
 }
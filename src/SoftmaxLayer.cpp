@@ -16,14 +16,23 @@ SoftmaxLayer::SoftmaxLayer(int numClasses)
 void SoftmaxLayer::forwardPropagate()
 {
     const Tensor<float> &input = *bottoms[0]->getOutput();
-    assert(input.dimensions() == std::vector<int>{numClasses});
-    softmax(&input[0], &output[0], numClasses);
+    assert(input.rowLength() == numClasses);
+
+    // [numClasses], or [N, numClasses] with a distribution per frame
+    if (output.dimensions() != input.dimensions())
+    {
+        output.resize(input.dimensions());
+    }
+    for (int offset = 0; offset < input.elementCount(); offset += numClasses)
+    {
+        softmax(input.dataAddress() + offset, output.dataAddress() + offset, numClasses);
+    }
 }
 
 void SoftmaxLayer::backwardPropagate()
 {
     Tensor<float> &prevDelta = *bottoms[0]->getDelta();
-    assert(prevDelta.dimensions() == std::vector<int>{numClasses});
+    assert(prevDelta.dimensions() == Shape{numClasses});
     prevDelta.zero();
 
     for (int i = 0; i < numClasses; i++)
@@ -35,7 +44,7 @@ void SoftmaxLayer::backwardPropagate()
     loss = -std::log(output[groundTruth] + 1e-9);
 }
 
-std::vector<int> SoftmaxLayer::getOutputDimensions()
+Shape SoftmaxLayer::getOutputDimensions()
 {
     return {1};
 }
@@ -0,0 +1,131 @@
+#include "TensorAllocator.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace MaskedCNN
+{
+
+static void *alignedAllocate(size_t bytes)
+{
+    void *pointer = nullptr;
+    if (posix_memalign(&pointer, TensorAllocator::alignment, std::max<size_t>(bytes, 1)) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+static TensorAllocator *defaultAllocator()
+{
+    // Never destroyed: tensors with static storage may be freed after everything else
+    static TensorAllocator *pool = new PoolAllocator();
+    return pool;
+}
+
+static TensorAllocator *selected = nullptr;
+
+TensorAllocator& TensorAllocator::current()
+{
+    return selected ? *selected : *defaultAllocator();
+}
+
+void TensorAllocator::setCurrent(TensorAllocator& allocator)
+{
+    selected = &allocator;
+}
+
+
+void *AlignedAllocator::allocate(size_t bytes)
+{
+    return alignedAllocate(bytes);
+}
+
+void AlignedAllocator::deallocate(void *pointer, size_t)
+{
+    std::free(pointer);
+}
+
+
+PoolAllocator::~PoolAllocator()
+{
+    release();
+}
+
+// Class c holds blocks of (4 + c % 4) << (c / 4 + 4) bytes: 64, 80, 96, 112, 128, 160, ...
+int PoolAllocator::sizeClass(size_t bytes)
+{
+    int c = 0;
+    while (classBytes(c) < bytes)
+    {
+        c++;
+    }
+    return c;
+}
+
+size_t PoolAllocator::classBytes(int sizeClass)
+{
+    return (size_t)(4 + sizeClass % 4) << (sizeClass / 4 + 4);
+}
+
+void *PoolAllocator::allocate(size_t bytes)
+{
+    const int c = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (c < (int)freeLists.size() && !freeLists[c].empty())
+        {
+            void *pointer = freeLists[c].back();
+            freeLists[c].pop_back();
+            cached -= classBytes(c);
+            return pointer;
+        }
+        allocations++;
+    }
+    return alignedAllocate(classBytes(c));
+}
+
+void PoolAllocator::deallocate(void *pointer, size_t bytes)
+{
+    if (!pointer)
+    {
+        return;
+    }
+
+    const int c = sizeClass(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (c >= (int)freeLists.size())
+    {
+        freeLists.resize(c + 1);
+    }
+    freeLists[c].push_back(pointer);
+    cached += classBytes(c);
+}
+
+void PoolAllocator::release()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& list : freeLists)
+    {
+        for (void *pointer : list)
+        {
+            std::free(pointer);
+        }
+        list.clear();
+    }
+    cached = 0;
+}
+
+size_t PoolAllocator::systemAllocations() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocations;
+}
+
+size_t PoolAllocator::cachedBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cached;
+}
+
+}
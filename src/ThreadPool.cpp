@@ -0,0 +1,222 @@
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <cblas.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace MaskedCNN
+{
+
+static thread_local bool insideParallelFor = false;
+
+// The index-th CPU of the process' affinity set, wrapping around
+static void pinToCore(int index)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return;
+    }
+    const int cores = CPU_COUNT(&allowed);
+    int seen = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (seen++ == index % cores)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+int ThreadPool::availableCores()
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        return std::max(CPU_COUNT(&allowed), 1);
+    }
+#endif
+    return std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+ThreadPool::ThreadPool(int threads, bool pinned)
+{
+    if (threads <= 0)
+    {
+        threads = availableCores();
+    }
+    for (int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i, pinned);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop(int index, bool pinned)
+{
+    if (pinned)
+    {
+        pinToCore(index);
+    }
+
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return stopping || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)>& body, int grain)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // A few chunks per thread evens out uneven chunks without much scheduling overhead
+    const int chunks = std::min((count + grain - 1) / grain, 4 * size());
+    if (chunks <= 1 || workers.empty() || insideParallelFor)
+    {
+        body(0, count);
+        return;
+    }
+
+    struct Job
+    {
+        std::atomic<int> next{0};
+        int finished = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto job = std::make_shared<Job>();
+    const int chunkSize = (count + chunks - 1) / chunks;
+
+    // body is only touched while chunks are left, and those keep the caller waiting
+    auto run = [job, &body, chunks, chunkSize, count]()
+    {
+        insideParallelFor = true;
+        int chunk;
+        while ((chunk = job->next++) < chunks)
+        {
+            const int begin = chunk * chunkSize;
+            if (begin < count)
+            {
+                body(begin, std::min(begin + chunkSize, count));
+            }
+
+            std::lock_guard<std::mutex> lock(job->mutex);
+            if (++job->finished == chunks)
+            {
+                job->done.notify_one();
+            }
+        }
+        insideParallelFor = false;
+    };
+
+    const int helpers = std::min<int>(workers.size(), chunks - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < helpers; i++)
+        {
+            tasks.emplace_back(run);
+        }
+    }
+    wake.notify_all();
+
+    run();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->done.wait(lock, [&]{ return job->finished == chunks; });
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    if (workers.empty())
+    {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+static std::mutex globalMutex;
+static std::atomic<ThreadPool*> globalPool{nullptr};
+
+// BLAS runs on the pool's threads, see blasSgemm, and mustn't start threads of its own
+static ThreadPool *makeGlobal(int threads, bool pinned)
+{
+    openblas_set_num_threads(1);
+    return new ThreadPool(threads, pinned);
+}
+
+ThreadPool& ThreadPool::global()
+{
+    ThreadPool *pool = globalPool.load(std::memory_order_acquire);
+    if (pool)
+    {
+        return *pool;
+    }
+
+    std::lock_guard<std::mutex> lock(globalMutex);
+    pool = globalPool.load(std::memory_order_relaxed);
+    if (!pool)
+    {
+        const char *threads = std::getenv("MASKEDCNN_THREADS");
+        const char *pinned = std::getenv("MASKEDCNN_PIN_THREADS");
+        // Never destroyed, like the default tensor allocator: static tensors may still use it at exit
+        pool = makeGlobal(threads ? std::atoi(threads) : 0, pinned && std::atoi(pinned) == 1);
+        globalPool.store(pool, std::memory_order_release);
+    }
+    return *pool;
+}
+
+void ThreadPool::configureGlobal(int threads, bool pinned)
+{
+    std::lock_guard<std::mutex> lock(globalMutex);
+    delete globalPool.exchange(makeGlobal(threads, pinned), std::memory_order_acq_rel);
+}
+
+}
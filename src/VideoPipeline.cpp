@@ -0,0 +1,215 @@
+#include "VideoPipeline.hpp"
+#include <thread>
+
+namespace MaskedCNN
+{
+
+static const char *stageNames[] = {"decode", "mask", "convert", "infer", "output"};
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Spins briefly, then yields, then sleeps, so an idle stage doesn't take a core from the kernels
+static void backOff(int attempt)
+{
+    if (attempt < 64)
+    {
+        return;
+    }
+    if (attempt < 128)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+VideoPipeline::VideoPipeline(Network &network, int threshold, int depth)
+    :VideoPipeline(network, std::make_unique<ChangeDetector>(threshold), depth)
+{
+}
+
+VideoPipeline::VideoPipeline(Network &network, std::unique_ptr<MaskGenerator> generator, int depth)
+    :network(network), slots(depth), generator(std::move(generator))
+{
+    if (depth < 1)
+    {
+        throw std::runtime_error("A pipeline needs at least one frame slot");
+    }
+    if (!this->generator)
+    {
+        throw std::runtime_error("No mask generator");
+    }
+}
+
+void VideoPipeline::run(Source source, Sink sink)
+{
+    queues.clear();
+    for (int s = 0; s < StageCount; s++)
+    {
+        queues.emplace_back(new SpscQueue<Slot*>(slots.size()));
+    }
+    for (auto &slot : slots)
+    {
+        slot.last = false;
+        queues[Decode]->tryPush(&slot);
+    }
+    for (auto &c : counters)
+    {
+        c.frames = 0;
+        c.busyNanos = 0;
+        c.waitNanos = 0;
+        c.maxNanos = 0;
+    }
+    latencyNanos = 0;
+    failed = false;
+    error = nullptr;
+
+    // The first frame of the clip gets an empty mask, so no output of an earlier clip may be kept
+    generator = generator->clone();
+    network.invalidateCaches();
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]
+    {
+        runStage(Decode, [&](Slot &slot)
+        {
+            slot.decoded = std::chrono::steady_clock::now();
+            slot.last = !source(slot.frame);
+        });
+    });
+    threads.emplace_back([&]
+    {
+        runStage(Mask, [&](Slot &slot)
+        {
+            slot.mask = generator->detect(slot.frame);
+        });
+    });
+    threads.emplace_back([&]
+    {
+        runStage(Convert, [&](Slot &slot)
+        {
+            Network::toInput(slot.frame, slot.image);
+        });
+    });
+    threads.emplace_back([&]
+    {
+        runStage(Infer, [&](Slot &slot)
+        {
+            network.infer(slot.image, slot.mask);
+            slot.classes = network.classes(slot.frame.size());
+        });
+    });
+
+    // On the calling thread, so the sink may use the GUI
+    runStage(Output, [&](Slot &slot)
+    {
+        sink(slot.frame, slot.classes);
+        latencyNanos += nanosSince(slot.decoded);
+    });
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void VideoPipeline::runStage(Stage stage, const std::function<void(Slot&)> &work)
+{
+    Counters &c = counters[stage];
+    const Stage next = (stage == Output) ? Decode : Stage(stage + 1);
+    try
+    {
+        while (true)
+        {
+            Slot *slot = pop(stage);
+            if (!slot)
+            {
+                return;
+            }
+
+            // The decode stage is the one that finds the end
+            if (!slot->last || stage == Decode)
+            {
+                const auto begin = std::chrono::steady_clock::now();
+                work(*slot);
+                if (!slot->last)
+                {
+                    const uint64_t nanos = nanosSince(begin);
+                    c.frames++;
+                    c.busyNanos += nanos;
+                    if (nanos > c.maxNanos)
+                    {
+                        c.maxNanos = nanos;
+                    }
+                }
+            }
+
+            const bool last = slot->last;
+            push(next, slot);
+            if (last)
+            {
+                return;
+            }
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error)
+        {
+            error = std::current_exception();
+        }
+        failed = true;
+    }
+}
+
+// Null once another stage has failed
+VideoPipeline::Slot *VideoPipeline::pop(Stage stage)
+{
+    const auto begin = std::chrono::steady_clock::now();
+    Slot *slot = nullptr;
+    for (int attempt = 0; !queues[stage]->tryPop(slot); attempt++)
+    {
+        if (failed)
+        {
+            return nullptr;
+        }
+        backOff(attempt);
+    }
+    counters[stage].waitNanos += nanosSince(begin);
+    return slot;
+}
+
+// Every queue has room for all the slots, so pushing never waits
+void VideoPipeline::push(Stage stage, Slot *slot)
+{
+    const bool pushed = queues[stage]->tryPush(slot);
+    assert(pushed);
+    (void)pushed;
+}
+
+std::vector<VideoPipeline::StageStats> VideoPipeline::stageStats() const
+{
+    std::vector<StageStats> result;
+    for (int s = 0; s < StageCount; s++)
+    {
+        const Counters &c = counters[s];
+        result.push_back({stageNames[s], c.frames, c.busyNanos * 1e-9, c.waitNanos * 1e-9, c.maxNanos * 1e-9});
+    }
+    return result;
+}
+
+double VideoPipeline::meanLatencySeconds() const
+{
+    const uint64_t frames = counters[Output].frames;
+    return frames ? latencyNanos * 1e-9 / frames : 0;
+}
+
+}
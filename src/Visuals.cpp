@@ -1,4 +1,6 @@
 #include "Visuals.hpp"
+#include "ThreadPool.hpp"
+#include "Simd.hpp"
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <random>
@@ -12,22 +14,76 @@ namespace MaskedCNN {
 
 Tensor<float> matToTensor(const cv::Mat& image)
 {
-    cv::Mat BGR[3];
-    cv::split(image, BGR);
+    Tensor<float> result;
+    matToTensor(image, result);
+    return result;
+}
 
-    Tensor<float> result(std::vector<int>({3, image.rows, image.cols}));
+void matToTensor(const cv::Mat& image, Tensor<float>& result)
+{
+    result.resize({3, image.rows, image.cols}, uninitialized{});
+    matToTensor(image, TensorView<float>(result));
+}
 
-    for (int y = 0; y < image.rows; y++)
+void matToTensor(const cv::Mat& image, TensorView<float> result)
+{
+    const float noMean[3] = {0, 0, 0};
+    bgrToTensor(image, result, noMean, 1.0f);
+}
+
+// (value - mean) * scale of a row of interleaved BGR bytes into three float rows
+static void convertRow(const uchar *bgr, float *const planes[3], int width, const float mean[3], float scale)
+{
+    int x = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 scaleVec = _mm256_set1_ps(scale);
+    __m256 offset[3];
+    for (int c = 0; c < 3; c++)
     {
-        for (int x = 0; x < image.cols; x++)
+        offset[c] = _mm256_set1_ps(-mean[c] * scale);
+    }
+
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i blocks[3] = {
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgr + 3 * x)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgr + 3 * x + 16)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgr + 3 * x + 32))};
+
+        const __m128i channels[3] = {bgrChannel<0>(blocks), bgrChannel<1>(blocks), bgrChannel<2>(blocks)};
+        for (int c = 0; c < 3; c++)
+        {
+            const __m128i channel = channels[c];
+            const __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(channel));
+            const __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(channel, 8)));
+            _mm256_storeu_ps(planes[c] + x, _mm256_fmadd_ps(low, scaleVec, offset[c]));
+            _mm256_storeu_ps(planes[c] + x + 8, _mm256_fmadd_ps(high, scaleVec, offset[c]));
+        }
+    }
+#endif
+    for (; x < width; x++)
+    {
+        for (int c = 0; c < 3; c++)
         {
-            result(0, y, x) = BGR[0].at<uchar>(y,x);
-            result(1, y, x) = BGR[1].at<uchar>(y,x);
-            result(2, y, x) = BGR[2].at<uchar>(y,x);
+            planes[c][x] = (bgr[3 * x + c] - mean[c]) * scale;
         }
     }
+}
 
-    return result;
+void bgrToTensor(const cv::Mat& image, TensorView<float> result, const float mean[3], float scale)
+{
+    assert(image.type() == CV_8UC3);
+    assert((result.dimensions() == Shape{3, image.rows, image.cols}));
+    assert(result.stride(2) == 1);
+
+    ThreadPool::global().parallelFor(image.rows, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            float *const planes[3] = {&result(0, y, 0), &result(1, y, 0), &result(2, y, 0)};
+            convertRow(image.ptr<uchar>(y), planes, image.cols, mean, scale);
+        }
+    }, 8);
 }
 
 Tensor<float> labelToTensor(const cv::Mat& mask, int label)
@@ -80,22 +136,19 @@ cv::Mat maskToMat(const Tensor<float>& tensor)
     return image;
 }
 
-Tensor<float> cropLike(const Tensor<float> data, const cv::Mat templateImage, int offset)
+cv::Mat maskToMat(const BitMask& mask)
 {
-    int rows = templateImage.rows;
-    int cols = templateImage.cols;
+    cv::Mat image(mask.rows(), mask.width(), CV_8UC1);
 
-    Tensor<float> result({rows, cols});
-
-    for (int y = 0; y < rows; y++)
+    for (int y = 0; y < image.rows; y++)
     {
-        for (int x = 0; x < cols; x++)
+        for (int x = 0; x < image.cols; x++)
         {
-            result(y, x) = data(y + offset, x + offset);
+            image.at<unsigned char>(y,x) = mask.test(y, x) ? 255 : 0;
         }
     }
 
-    return result;
+    return image;
 }
 
 cv::Mat cropLike(const cv::Mat data, const cv::Mat templateImage, int offset)
@@ -143,61 +196,37 @@ Tensor<float> loadImage(const std::string& path)
     return matToTensor(image);
 }
 
-Tensor<float> maxarg(const Tensor<float>& data)
+Tensor<float> maxarg(TensorView<const float> data)
 {
-    Tensor<float> result({data.columnLength(), data.rowLength()});
+    Tensor<float> result(Shape{data.columnLength(), data.rowLength()});
 
-    for (int y = 0; y < data.columnLength(); y++)
+    ThreadPool::global().parallelFor(data.columnLength(), [&](int begin, int end)
     {
-        for (int x = 0; x < data.rowLength(); x++)
+        for (int y = begin; y < end; y++)
         {
-            int max = 0;
-            float maxel = data(0, y, x);
-            for (int c = 0; c < data.channelLength(); c++)
+            for (int x = 0; x < data.rowLength(); x++)
             {
-                float el = data(c, y, x);
-                if (el > maxel)
+                int max = 0;
+                float maxel = data(0, y, x);
+                for (int c = 0; c < data.channelLength(); c++)
                 {
-                    max = c;
-                    maxel = data(c, y, x);
+                    float el = data(c, y, x);
+                    if (el > maxel)
+                    {
+                        max = c;
+                        maxel = data(c, y, x);
+                    }
                 }
-            }
 
-            result(y, x) = max;
+                result(y, x) = max;
+            }
         }
-    }
+    });
 
     return result;
 }
 
 
-Tensor<float> diffFrames(const cv::Mat frame, const cv::Mat prevFrame, Tensor<float> accumMatrix, int threshold)
-{
-    Tensor<float> mask(std::vector<int>{prevFrame.rows, prevFrame.cols});
-    cv::Mat diff = cv::Mat::zeros(frame.rows, frame.cols, CV_8UC3);
-    cv::absdiff(frame, prevFrame, diff);
-
-    for (int j = 0; j < frame.rows; j++)
-    {
-        for (int i = 0; i < frame.cols; i++)
-        {
-            cv::Vec3b x = diff.at<cv::Vec3b>(j,i);
-            accumMatrix(j,i) += x[0] + x[1] + x[2];
-            if (accumMatrix(j,i) > threshold)
-            {
-                mask(j,i) = 255;
-                accumMatrix(j,i) = 0;
-            }
-            else
-            {
-                mask(j,i) = 0;
-            }
-        }
-    }
-
-    return mask;
-}
-
 void addNoiseToVideo(std::string filename, double prob)
 {
     cv::VideoCapture cap(filename);
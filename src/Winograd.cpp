@@ -0,0 +1,288 @@
+#include "Winograd.hpp"
+#include "ThreadPool.hpp"
+#include "Gemm.hpp"
+#include <algorithm>
+
+namespace MaskedCNN {
+
+// Tiles transformed and multiplied together; bounds the buffers to a few MB on large frames
+static constexpr int tileBlock = 256;
+
+// Where the 2x2 results of a Winograd tile go: pixel (dy, dx) of the tile is written to
+// base + dy * rowStride + dx of each output channel, rows and cols tell how much of it is inside
+struct WinogradTile
+{
+    int y;
+    int x;
+    int base;
+    int rowStride;
+    int rows;
+    int cols;
+};
+
+bool isWinogradConvolution(int filterSize, int stride)
+{
+    return filterSize == 3 && stride == 1;
+}
+
+// U = G g G^T
+void winogradTransformFilter(const Tensor<float>& filter, Tensor<float>& transformed)
+{
+    const int outputChannels = filter.dimensions()[0];
+    const int inputChannels = filter.dimensions()[1];
+    assert(filter.dimensions()[2] == 3 && filter.dimensions()[3] == 3);
+
+    transformed.resize({16, outputChannels, inputChannels});
+    const int matrixSize = outputChannels * inputChannels;
+    float *u = transformed.dataAddress();
+
+    for (int o = 0; o < outputChannels; o++)
+    {
+        for (int c = 0; c < inputChannels; c++)
+        {
+            const float *g = filter.dataAddress() + (o * inputChannels + c) * 9;
+
+            float t[4][3];
+            for (int j = 0; j < 3; j++)
+            {
+                t[0][j] = g[j];
+                t[1][j] = 0.5f * (g[j] + g[3 + j] + g[6 + j]);
+                t[2][j] = 0.5f * (g[j] - g[3 + j] + g[6 + j]);
+                t[3][j] = g[6 + j];
+            }
+
+            float *uc = u + o * inputChannels + c;
+            for (int i = 0; i < 4; i++)
+            {
+                uc[(i * 4 + 0) * matrixSize] = t[i][0];
+                uc[(i * 4 + 1) * matrixSize] = 0.5f * (t[i][0] + t[i][1] + t[i][2]);
+                uc[(i * 4 + 2) * matrixSize] = 0.5f * (t[i][0] - t[i][1] + t[i][2]);
+                uc[(i * 4 + 3) * matrixSize] = t[i][2];
+            }
+        }
+    }
+}
+
+// V = B^T d B for every channel of the listed tiles, stored as [16][channels][count]
+static void transformInput(TensorView<const float> im, int channels, int height, int width, int pad,
+                           const WinogradTile *tiles, int count, float *v)
+{
+    const int matrixSize = channels * count;
+
+    ThreadPool::global().parallelFor(channels, [&](int begin, int end)
+    {
+        for (int c = begin; c < end; c++)
+        {
+            const float *channelIm = im.dataAddress() + c * im.stride(0);
+            const int rowStride = im.stride(1);
+            for (int t = 0; t < count; t++)
+            {
+                const int y0 = tiles[t].y - pad;
+                const int x0 = tiles[t].x - pad;
+
+                float d[4][4];
+                if (y0 >= 0 && y0 + 4 <= height && x0 >= 0 && x0 + 4 <= width)
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        const float *row = channelIm + (y0 + i) * rowStride + x0;
+                        d[i][0] = row[0]; d[i][1] = row[1]; d[i][2] = row[2]; d[i][3] = row[3];
+                    }
+                }
+                else
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        for (int j = 0; j < 4; j++)
+                        {
+                            const int y = y0 + i;
+                            const int x = x0 + j;
+                            d[i][j] = (y >= 0 && y < height && x >= 0 && x < width) ? channelIm[y * rowStride + x] : 0;
+                        }
+                    }
+                }
+
+                float r[4][4];
+                for (int j = 0; j < 4; j++)
+                {
+                    r[0][j] = d[0][j] - d[2][j];
+                    r[1][j] = d[1][j] + d[2][j];
+                    r[2][j] = d[2][j] - d[1][j];
+                    r[3][j] = d[1][j] - d[3][j];
+                }
+
+                float *vt = v + c * count + t;
+                for (int i = 0; i < 4; i++)
+                {
+                    vt[(i * 4 + 0) * matrixSize] = r[i][0] - r[i][2];
+                    vt[(i * 4 + 1) * matrixSize] = r[i][1] + r[i][2];
+                    vt[(i * 4 + 2) * matrixSize] = r[i][2] - r[i][1];
+                    vt[(i * 4 + 3) * matrixSize] = r[i][1] - r[i][3];
+                }
+            }
+        }
+    });
+}
+
+// Y = A^T m A of every output channel, written through the tile placement
+static void transformOutput(const float *m, int channels, const WinogradTile *tiles, int count, int channelStride, float *out)
+{
+    const int matrixSize = channels * count;
+
+    ThreadPool::global().parallelFor(channels, [&](int begin, int end)
+    {
+        for (int o = begin; o < end; o++)
+        {
+            float *channelOut = out + o * channelStride;
+            for (int t = 0; t < count; t++)
+            {
+                const float *mt = m + o * count + t;
+                float r[2][4];
+                for (int j = 0; j < 4; j++)
+                {
+                    const float m0 = mt[(0 * 4 + j) * matrixSize];
+                    const float m1 = mt[(1 * 4 + j) * matrixSize];
+                    const float m2 = mt[(2 * 4 + j) * matrixSize];
+                    const float m3 = mt[(3 * 4 + j) * matrixSize];
+                    r[0][j] = m0 + m1 + m2;
+                    r[1][j] = m1 - m2 - m3;
+                }
+
+                float y[2][2];
+                for (int i = 0; i < 2; i++)
+                {
+                    y[i][0] = r[i][0] + r[i][1] + r[i][2];
+                    y[i][1] = r[i][1] - r[i][2] - r[i][3];
+                }
+
+                const WinogradTile& tile = tiles[t];
+                for (int i = 0; i < tile.rows; i++)
+                {
+                    for (int j = 0; j < tile.cols; j++)
+                    {
+                        channelOut[tile.base + i * tile.rowStride + j] = y[i][j];
+                    }
+                }
+            }
+        }
+    });
+}
+
+static void winogradRun(TensorView<const float> input, const Tensor<float>& transformedFilter, const std::vector<WinogradTile>& tiles,
+                        Tensor<float>& inputBuffer, Tensor<float>& productBuffer, int channelStride, float *out, int pad)
+{
+    const int outputChannels = transformedFilter.dimensions()[1];
+    const int inputChannels = transformedFilter.dimensions()[2];
+    const int height = input.dimensions()[1];
+    const int width = input.dimensions()[2];
+    assert(input.dimensions()[0] == inputChannels);
+
+    const int block = std::min<int>(tileBlock, tiles.size());
+    if (inputBuffer.elementCount() < 16 * inputChannels * block)
+    {
+        inputBuffer.resize({16, inputChannels, block});
+    }
+    if (productBuffer.elementCount() < 16 * outputChannels * block)
+    {
+        productBuffer.resize({16, outputChannels, block});
+    }
+
+    const float *u = transformedFilter.dataAddress();
+    float *v = inputBuffer.dataAddress();
+    float *m = productBuffer.dataAddress();
+
+    for (size_t first = 0; first < tiles.size(); first += block)
+    {
+        const int count = std::min<int>(block, tiles.size() - first);
+
+        transformInput(input, inputChannels, height, width, pad, &tiles[first], count, v);
+
+        for (int xi = 0; xi < 16; xi++)
+        {
+            sgemm(outputChannels, count, inputChannels, u + xi * outputChannels * inputChannels, inputChannels,
+                  v + xi * inputChannels * count, count, m + xi * outputChannels * count, count);
+        }
+
+        transformOutput(m, outputChannels, &tiles[first], count, channelStride, out);
+    }
+}
+
+void winogradConvolution(TensorView<const float> input, const Tensor<float>& transformedFilter, Tensor<float>& inputBuffer,
+                         Tensor<float>& productBuffer, TensorView<float> out, int pad)
+{
+    if (input.dimensionCount() == 4)
+    {
+        for (int n = 0; n < input.dimensions()[0]; n++)
+        {
+            winogradConvolution(input.frame(n), transformedFilter, inputBuffer, productBuffer, out.frame(n), pad);
+        }
+        return;
+    }
+
+    assert(out.stride(2) == 1);
+    const int outputHeight = out.dimensions()[1];
+    const int outputWidth = out.dimensions()[2];
+    const int rowStride = out.stride(1);
+
+    std::vector<WinogradTile> tiles;
+    tiles.reserve(((outputHeight + 1) / 2) * ((outputWidth + 1) / 2));
+    for (int y = 0; y < outputHeight; y += 2)
+    {
+        for (int x = 0; x < outputWidth; x += 2)
+        {
+            tiles.push_back({y, x, y * rowStride + x, rowStride,
+                             std::min(2, outputHeight - y), std::min(2, outputWidth - x)});
+        }
+    }
+
+    winogradRun(input, transformedFilter, tiles, inputBuffer, productBuffer, out.stride(0), out.dataAddress(), pad);
+}
+
+int winogradConvolutionTiles(TensorView<const float> input, const TileMask& tiles, const Tensor<float>& transformedFilter,
+                             Tensor<float>& inputBuffer, Tensor<float>& productBuffer, Tensor<float>& outBuffer,
+                             int outputHeight, int outputWidth, int pad)
+{
+    const int outputChannels = transformedFilter.dimensions()[1];
+    const int size = tiles.tileSize();
+    assert(size % 2 == 0);
+
+    // Each occupied tile is split into 2x2 Winograd tiles; its pixels are numbered row by row
+    std::vector<WinogradTile> winogradTiles;
+    int patches = 0;
+    for (int ty = 0; ty < tiles.tilesY(); ty++)
+    {
+        for (int tx = 0; tx < tiles.tilesX(); tx++)
+        {
+            if (!tiles.occupied(ty, tx)) continue;
+
+            const int y0 = ty * size;
+            const int x0 = tx * size;
+            const int rows = std::min(size, outputHeight - y0);
+            const int cols = std::min(size, outputWidth - x0);
+
+            for (int y = 0; y < rows; y += 2)
+            {
+                for (int x = 0; x < cols; x += 2)
+                {
+                    winogradTiles.push_back({y0 + y, x0 + x, patches + y * cols + x, cols,
+                                             std::min(2, rows - y), std::min(2, cols - x)});
+                }
+            }
+            patches += rows * cols;
+        }
+    }
+
+    if (outBuffer.elementCount() < outputChannels * patches)
+    {
+        outBuffer.resize({outputChannels, patches});
+    }
+
+    if (patches > 0)
+    {
+        winogradRun(input, transformedFilter, winogradTiles, inputBuffer, productBuffer, patches, outBuffer.dataAddress(), pad);
+    }
+
+    return patches;
+}
+
+}
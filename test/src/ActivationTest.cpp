@@ -0,0 +1,46 @@
+#include "gtest/gtest.h"
+#include <cmath>
+#include <random>
+#include "Activation.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(ActivationTest, VectorizedActivationsMatchLibm)
+{
+    // Odd length for the tail, range past where e^x over- and underflows
+    const int num = 1001;
+    std::vector<float> x(num), y(num), delta(num);
+    for (int i = 0; i < num; i++)
+    {
+        x[i] = -100.0f + 200.0f * i / (num - 1);
+    }
+    x[num / 2] = 0.001f;
+
+    Sigmoid sigmoid;
+    sigmoid.activate(x.data(), y.data(), delta.data(), num);
+    for (int i = 0; i < num; i++)
+    {
+        const double expected = 1.0 / (1.0 + std::exp(-(double)x[i]));
+        ASSERT_NEAR(y[i], expected, 1e-6) << x[i];
+        ASSERT_NEAR(delta[i], expected * (1 - expected), 1e-6) << x[i];
+    }
+
+    Tanh tanh;
+    tanh.forward(x.data(), y.data(), num);
+    for (int i = 0; i < num; i++)
+    {
+        ASSERT_NEAR(y[i], std::tanh((double)x[i]), 1e-6) << x[i];
+    }
+
+    ReLu relu;
+    relu.activate(x.data(), y.data(), delta.data(), num);
+    for (int i = 0; i < num; i++)
+    {
+        ASSERT_EQ(y[i], std::max(x[i], 0.0f));
+        ASSERT_EQ(delta[i], x[i] > 0 ? 1.0f : 0.0f);
+    }
+}
+
+}
@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "BatchScheduler.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+// Class 0 where blue outweighs red, else 1. Padded by the 8 pixels the class map is cropped by.
+std::unique_ptr<Network> colorNet()
+{
+    Tensor<float> weights(Shape{2, 3, 1, 1});
+    weights(0, 0, 0, 0) = 1;
+    weights(1, 2, 0, 0) = 1;
+    Tensor<float> biases(Shape{2});
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(new ConvolutionalLayer(std::make_unique<Id>(), std::move(weights), std::move(biases), 1, 8, "score"));
+    layers[1]->addBottom(layers[0].get());
+    return std::make_unique<Network>(std::move(layers), 0);
+}
+
+const cv::Mat blue(6, 10, CV_8UC3, cv::Scalar(255, 0, 0));
+const cv::Mat red(6, 10, CV_8UC3, cv::Scalar(0, 0, 255));
+
+using Clock = std::chrono::steady_clock;
+
+// Class maps by stream, in the order the callback got them
+struct Results
+{
+    std::mutex mutex;
+    std::vector<std::pair<int, int>> received; // stream, class of the first pixel
+
+    BatchScheduler::Callback callback()
+    {
+        return [this](int stream, const Tensor<float>& classes)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            received.emplace_back(stream, (int)classes[0]);
+        };
+    }
+
+    bool waitFor(size_t count, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+    {
+        const auto end = Clock::now() + timeout;
+        while (Clock::now() < end)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (received.size() >= count)
+                {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+};
+
+TEST(BatchSchedulerTest, FullBatchRunsAtOnceAndReachesItsStreams)
+{
+    auto net = colorNet();
+    Results results;
+    BatchScheduler scheduler(*net, 2, std::chrono::seconds(30), results.callback());
+
+    const auto begin = Clock::now();
+    scheduler.submit(1, red);
+    scheduler.submit(0, blue);
+    ASSERT_TRUE(results.waitFor(2));
+    ASSERT_LT(Clock::now() - begin, std::chrono::seconds(10));
+
+    std::sort(results.received.begin(), results.received.end());
+    ASSERT_EQ(results.received, (std::vector<std::pair<int, int>>{{0, 0}, {1, 1}}));
+    ASSERT_EQ(scheduler.batchesRun(), 1u);
+    ASSERT_EQ(scheduler.framesRun(), 2u);
+}
+
+TEST(BatchSchedulerTest, PartialBatchIsRunAfterMaxWait)
+{
+    auto net = colorNet();
+    Results results;
+    const auto maxWait = std::chrono::milliseconds(50);
+    BatchScheduler scheduler(*net, 3, maxWait, results.callback());
+
+    const auto begin = Clock::now();
+    scheduler.submit(2, red);
+    ASSERT_TRUE(results.waitFor(1));
+    ASSERT_GE(Clock::now() - begin, maxWait);
+
+    ASSERT_EQ(results.received, (std::vector<std::pair<int, int>>{{2, 1}}));
+    ASSERT_EQ(scheduler.batchesRun(), 1u);
+}
+
+TEST(BatchSchedulerTest, NewerFrameReplacesAWaitingOne)
+{
+    auto net = colorNet();
+    Results results;
+    BatchScheduler scheduler(*net, 2, std::chrono::seconds(30), results.callback());
+
+    scheduler.submit(0, red);
+    scheduler.submit(0, blue);
+    scheduler.submit(1, red);
+    ASSERT_TRUE(results.waitFor(2));
+
+    std::sort(results.received.begin(), results.received.end());
+    ASSERT_EQ(results.received, (std::vector<std::pair<int, int>>{{0, 0}, {1, 1}}));
+    ASSERT_EQ(scheduler.framesDropped(), 1u);
+    ASSERT_EQ(scheduler.framesRun(), 2u);
+}
+
+TEST(BatchSchedulerTest, RejectsEmptyFramesAndRethrowsFailures)
+{
+    auto net = colorNet();
+    std::atomic<int> calls(0);
+    BatchScheduler scheduler(*net, 1, std::chrono::milliseconds(1), [&](int, const Tensor<float>&)
+    {
+        calls++;
+        throw std::runtime_error("sink failed");
+    });
+
+    ASSERT_THROW(scheduler.submit(0, cv::Mat()), std::runtime_error);
+    ASSERT_THROW(scheduler.submit(1, red), std::runtime_error);
+
+    // The callback's exception stops the scheduler and comes back out of submit
+    scheduler.submit(0, red);
+    bool rethrown = false;
+    const auto end = Clock::now() + std::chrono::seconds(5);
+    while (!rethrown && Clock::now() < end)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        try
+        {
+            scheduler.submit(0, red);
+        }
+        catch (const std::runtime_error& e)
+        {
+            rethrown = std::string(e.what()) == "sink failed";
+        }
+    }
+    ASSERT_TRUE(rethrown);
+    ASSERT_EQ(calls, 1);
+}
+
+}
@@ -0,0 +1,156 @@
+#include "gtest/gtest.h"
+#include <random>
+#include "BitMask.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+BitMask randomMask(int height, int width, double fill, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> distr(0, 1);
+    BitMask mask(height, width);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (distr(gen) < fill)
+            {
+                mask.set(y, x);
+            }
+        }
+    }
+    return mask;
+}
+
+TEST(BitMaskTest, ConvolveFromMatchesBruteForce)
+{
+    const int filterSize = 3, stride = 2, pad = 1;
+    BitMask prev = randomMask(37, 130, 0.02, 1);
+
+    const int outputHeight = (37 + 2 * pad - filterSize) / stride + 1;
+    const int outputWidth = (130 + 2 * pad - filterSize) / stride + 1;
+    BitMask mask(outputHeight, outputWidth);
+    mask.convolveFrom(prev, filterSize, stride, pad);
+
+    for (int y = 0; y < outputHeight; y++)
+    {
+        for (int x = 0; x < outputWidth; x++)
+        {
+            bool expected = false;
+            for (int dy = 0; dy < filterSize; dy++)
+            {
+                for (int dx = 0; dx < filterSize; dx++)
+                {
+                    int iy = y * stride - pad + dy;
+                    int ix = x * stride - pad + dx;
+                    if (iy >= 0 && iy < prev.height() && ix >= 0 && ix < prev.width() && prev.test(iy, ix))
+                    {
+                        expected = true;
+                    }
+                }
+            }
+            ASSERT_EQ(mask.test(y, x), expected) << y << " " << x;
+        }
+    }
+}
+
+TEST(BitMaskTest, DeconvolveFromMatchesBruteForce)
+{
+    const int filterSize = 4, stride = 2, pad = 1;
+    BitMask prev = randomMask(20, 70, 0.03, 2);
+
+    const int outputHeight = stride * (20 - 1) + filterSize - 2 * pad;
+    const int outputWidth = stride * (70 - 1) + filterSize - 2 * pad;
+    BitMask mask(outputHeight, outputWidth);
+    mask.deconvolveFrom(prev, filterSize, stride, pad);
+
+    BitMask expected(outputHeight, outputWidth);
+    for (int iy = 0; iy < prev.height(); iy++)
+    {
+        for (int ix = 0; ix < prev.width(); ix++)
+        {
+            if (!prev.test(iy, ix)) continue;
+            for (int dy = 0; dy < filterSize; dy++)
+            {
+                for (int dx = 0; dx < filterSize; dx++)
+                {
+                    int y = iy * stride - pad + dy;
+                    int x = ix * stride - pad + dx;
+                    if (y >= 0 && y < outputHeight && x >= 0 && x < outputWidth)
+                    {
+                        expected.set(y, x);
+                    }
+                }
+            }
+        }
+    }
+
+    for (int y = 0; y < outputHeight; y++)
+    {
+        for (int x = 0; x < outputWidth; x++)
+        {
+            ASSERT_EQ(mask.test(y, x), expected.test(y, x)) << y << " " << x;
+        }
+    }
+    ASSERT_EQ(mask.count(), expected.count());
+}
+
+TEST(BitMaskTest, TileMaskMarksTilesWithSetPixels)
+{
+    BitMask mask = randomMask(50, 150, 0.01, 3);
+    TileMask tiles(16);
+    tiles.build(mask);
+
+    ASSERT_EQ(tiles.tilesY(), 4);
+    ASSERT_EQ(tiles.tilesX(), 10);
+    for (int ty = 0; ty < tiles.tilesY(); ty++)
+    {
+        for (int tx = 0; tx < tiles.tilesX(); tx++)
+        {
+            bool expected = false;
+            for (int y = ty * 16; y < std::min((ty + 1) * 16, 50); y++)
+            {
+                for (int x = tx * 16; x < std::min((tx + 1) * 16, 150); x++)
+                {
+                    expected |= mask.test(y, x);
+                }
+            }
+            ASSERT_EQ(tiles.occupied(ty, tx), expected) << ty << " " << tx;
+        }
+    }
+}
+
+TEST(BitMaskTest, ErodeAndDilateMatchBruteForce)
+{
+    const int radius = 2;
+    BitMask prev = randomMask(29, 140, 0.6, 4);
+    BitMask eroded, dilated;
+    int dilatedCount = 0;
+    eroded.erodeFrom(prev, radius);
+    dilated.dilateFrom(prev, radius);
+
+    for (int y = 0; y < prev.height(); y++)
+    {
+        for (int x = 0; x < prev.width(); x++)
+        {
+            bool all = true, any = false;
+            for (int iy = std::max(y - radius, 0); iy <= std::min(y + radius, prev.height() - 1); iy++)
+            {
+                for (int ix = std::max(x - radius, 0); ix <= std::min(x + radius, prev.width() - 1); ix++)
+                {
+                    all &= prev.test(iy, ix);
+                    any |= prev.test(iy, ix);
+                }
+            }
+            ASSERT_EQ(eroded.test(y, x), all) << y << " " << x;
+            ASSERT_EQ(dilated.test(y, x), any) << y << " " << x;
+            dilatedCount += any;
+        }
+    }
+    // Nothing past the width
+    ASSERT_EQ(dilated.count(), dilatedCount);
+}
+
+}
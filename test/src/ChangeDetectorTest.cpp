@@ -0,0 +1,156 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <random>
+#include "ChangeDetector.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+// ChangeDetector written out pixel by pixel: the summed BGR difference at each compared pixel
+// accumulates, saturating at 65535, until it exceeds the threshold, which then marks the pixel,
+// or its whole block when downsampling, and resets the accumulator
+class ReferenceDetector
+{
+public:
+    ReferenceDetector(int threshold, int downsample, const cv::Mat &first)
+        :limit(std::min(threshold, 65534)), factor(downsample), reference(first.clone()),
+          accumulated(first.rows * first.cols, 0)
+    {
+    }
+
+    std::vector<bool> detect(const cv::Mat &frame)
+    {
+        const int height = frame.rows, width = frame.cols;
+        std::vector<bool> result(height * width, false);
+        for (int y = 0; y < height; y += factor)
+        {
+            for (int x = 0; x < width; x += factor)
+            {
+                const int sy = std::min(y + factor / 2, height - 1);
+                const int sx = std::min(x + factor / 2, width - 1);
+                int sum = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    sum += std::abs(frame.ptr<uint8_t>(sy)[3 * sx + c] - reference.ptr<uint8_t>(sy)[3 * sx + c]);
+                    reference.ptr<uint8_t>(sy)[3 * sx + c] = frame.ptr<uint8_t>(sy)[3 * sx + c];
+                }
+
+                int &accum = accumulated[sy * width + sx];
+                accum = std::min(accum + sum, 65535);
+                if (accum > limit)
+                {
+                    accum = 0;
+                    for (int by = y; by < std::min(y + factor, height); by++)
+                    {
+                        for (int bx = x; bx < std::min(x + factor, width); bx++)
+                        {
+                            result[by * width + bx] = true;
+                        }
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    int limit;
+    int factor;
+    cv::Mat reference;
+    std::vector<int> accumulated;
+};
+
+// Frames drifting by a few levels per channel, so differences accumulate over several frames
+cv::Mat drift(const cv::Mat &frame, int maxStep, std::mt19937 &gen)
+{
+    std::uniform_int_distribution<int> step(-maxStep, maxStep);
+    cv::Mat next = frame.clone();
+    for (int y = 0; y < next.rows; y++)
+    {
+        uint8_t *row = next.ptr<uint8_t>(y);
+        for (int i = 0; i < next.cols * 3; i++)
+        {
+            row[i] = std::min(std::max(row[i] + step(gen), 0), 255);
+        }
+    }
+    return next;
+}
+
+void expectSameMasks(int width, int height, int threshold, int downsample, int frames, int maxStep)
+{
+    std::mt19937 gen(width * 31 + downsample);
+    cv::Mat frame(height, width, CV_8UC3, cv::Scalar(128, 128, 128));
+    frame = drift(frame, 100, gen);
+
+    ChangeDetector detector(threshold, downsample);
+    ReferenceDetector reference(threshold, downsample, frame);
+    ASSERT_EQ(detector.detect(frame).howFilled(), 0);
+
+    int marked = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        frame = drift(frame, maxStep, gen);
+        const BitMask &mask = detector.detect(frame);
+        const std::vector<bool> expected = reference.detect(frame);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                ASSERT_EQ(mask.test(y, x), expected[y * width + x])
+                        << "width " << width << " downsample " << downsample << " frame " << f << " at " << y << "," << x;
+                marked += expected[y * width + x];
+            }
+        }
+    }
+    // Pixels have to both fire and carry their differences over for the comparison to mean much
+    ASSERT_GT(marked, 0);
+    ASSERT_LT(marked, frames * width * height);
+}
+
+TEST(ChangeDetectorTest, MatchesReferenceAcrossVectorBlocksAndWords)
+{
+    for (int width : {1, 15, 16, 17, 63, 64, 65, 130})
+    {
+        expectSameMasks(width, 5, 40, 1, 12, 6);
+    }
+}
+
+TEST(ChangeDetectorTest, MatchesReferenceWhenDownsampled)
+{
+    for (int width : {3, 37, 130})
+    {
+        expectSameMasks(width, 11, 40, 4, 12, 6);
+    }
+}
+
+TEST(ChangeDetectorTest, SaturatedAccumulatorExceedsCappedThreshold)
+{
+    // Toggling between black and white adds 765 per frame; 65535 is reached after 86 frames
+    const int width = 40;
+    const cv::Mat black(2, width, CV_8UC3, cv::Scalar(0, 0, 0));
+    const cv::Mat white(2, width, CV_8UC3, cv::Scalar(255, 255, 255));
+
+    for (int downsample : {1, 3})
+    {
+        ChangeDetector detector(1000000, downsample);
+        ASSERT_EQ(detector.threshold(), 65534);
+        detector.detect(black);
+
+        int firstFired = -1;
+        for (int f = 1; f <= 200 && firstFired < 0; f++)
+        {
+            const BitMask &mask = detector.detect(f % 2 ? white : black);
+            if (mask.howFilled() > 0)
+            {
+                ASSERT_EQ(mask.howFilled(), 1.0);
+                firstFired = f;
+            }
+        }
+        ASSERT_EQ(firstFired, 86);
+        // The accumulator started over
+        ASSERT_EQ(detector.detect(black).howFilled(), 0);
+    }
+}
+
+}
@@ -2,7 +2,10 @@
 #include <iostream>
 #include <string>
 #include "ConvOps.hpp"
+#include "Winograd.hpp"
 #include "Tensor.hpp"
+#include "ConvolutionalLayer.hpp"
+#include "InputLayer.hpp"
 
 using namespace MaskedCNN;
 
@@ -144,6 +147,38 @@ TEST_F(ConvolutionTest, PaddedStridedConvolution) {
         }
     }
 }
+TEST_F(ConvolutionTest, IndexedTransposedConvolutionUpdatesChangedInputs)
+{
+    Tensor<float> input(std::vector<int>{1,3,3});
+    input(0,0,0) = 6; input(0,0,1) = 14; input(0,0,2) = 17;
+    input(0,1,0) = 14; input(0,1,1) = 12; input(0,1,2) = 12;
+    input(0,2,0) = 8; input(0,2,1) = 10; input(0,2,2) = 17;
+
+    Tensor<float> output(std::vector<int>{1,7,7});
+    transposedConvolutionIm2Col(input, weights, colBuffer, output, 3, 2, 0);
+
+    input(0,1,2) = -3;
+    Tensor<float> result(std::vector<int>{1,7,7});
+    Tensor<float> resultBuffer;
+    transposedConvolutionIm2Col(input, weights, resultBuffer, result, 3, 2, 0);
+
+    std::vector<int> inputIndex{5};
+    std::vector<int> outputIndex;
+    for (int i = 0; i < 49; i++)
+    {
+        outputIndex.push_back(i);
+    }
+
+    Tensor<float> inputBuffer, anotherBuffer, outBuffer;
+    transposedConvolutionIm2ColIndexed(input, inputIndex, outputIndex, weights, inputBuffer, colBuffer,
+                                       anotherBuffer, outBuffer, 7, 7, 3, 2, 0);
+
+    for (int i = 0; i < 49; i++)
+    {
+        ASSERT_FLOAT_EQ(result[i], outBuffer[i]);
+    }
+}
+
 /*
 TEST_F(ConvolutionTest, PaddedStridedConvolutionGivesRightResultWithFullMask)
 {
@@ -222,6 +257,267 @@ TEST_F(ConvolutionTest, MultidimensionalSimpleConvolution) {
     output.toCpu();
     ASSERT_FLOAT_EQ(output(0,0,0), 136);
 }
+
+TEST_F(ConvolutionTest, IndexedConvolutionMatchesDenseOnActivePixels)
+{
+    Tensor<float> result(std::vector<int>{1,3,3});
+    convolution(matrix, weights, result, 3, 2, 1);
+
+    Tensor<float> mask(std::vector<int>{3,3});
+    mask(0,1) = 1;
+    mask(1,2) = 1;
+    mask(2,0) = 1;
+
+    std::vector<int> index;
+    Tensor<float> outBuffer;
+    Tensor<float> output(std::vector<int>{1,3,3});
+    output.fillwith(-1);
+
+    ASSERT_EQ(buildMaskIndex(mask, index), 3);
+    convolutionIm2ColIndexed(matrix, index, weights, colBuffer, outBuffer, 3, 3, 2, 1);
+    scatterIndexed(outBuffer.dataAddress(), index, 1, 9, output.dataAddress());
+
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (mask(i,j) > 0)
+            {
+                ASSERT_FLOAT_EQ(result(0,i,j), output(0,i,j));
+            }
+            else
+            {
+                ASSERT_FLOAT_EQ(-1, output(0,i,j));
+            }
+        }
+    }
+}
+
+TEST_F(ConvolutionTest, IndexedConvolutionOfBatchMatchesEachFrame)
+{
+    // Two frames: the matrix and its negation, with active pixels in both and the mask planes stacked
+    Tensor<float> batch(std::vector<int>{2,1,5,5});
+    for (int i = 0; i < 25; i++)
+    {
+        batch[i] = matrix[i];
+        batch[25 + i] = -matrix[i];
+    }
+
+    Tensor<float> expected(std::vector<int>{1,3,3});
+    convolution(matrix, weights, expected, 3, 2, 1);
+
+    BitMask mask(3, 3, 2);
+    mask.set(0, 1);
+    mask.set(3 + 1, 2);
+    mask.set(3 + 2, 0);
+
+    std::vector<int> index;
+    Tensor<float> outBuffer;
+    Tensor<float> output(std::vector<int>{2,1,3,3});
+    output.fillwith(-1);
+
+    ASSERT_EQ(mask.activeIndex(index), 3);
+    convolutionIm2ColIndexed(batch, index, weights, colBuffer, outBuffer, 3, 3, 2, 1);
+    scatterIndexed(outBuffer.dataAddress(), index, 1, 9, output.dataAddress());
+
+    for (int n = 0; n < 2; n++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                const float sign = (n == 0) ? 1 : -1;
+                ASSERT_FLOAT_EQ(mask.test(n * 3 + i, j) ? sign * expected(0,i,j) : -1, output(n,0,i,j));
+            }
+        }
+    }
+}
+
+TEST_F(ConvolutionTest, PointwiseConvolutionMatchesIm2Col)
+{
+    Tensor<float> input(std::vector<int>{3,4,5});
+    Tensor<float> filter(std::vector<int>{2,3,1,1});
+    for (int i = 0; i < input.elementCount(); i++) input[i] = (i * 7) % 11 - 5;
+    for (int i = 0; i < filter.elementCount(); i++) filter[i] = i - 2;
+
+    Tensor<float> expected(std::vector<int>{2,4,5});
+    Tensor<float> output(std::vector<int>{2,4,5});
+    convolutionIm2Col(input, filter, colBuffer, expected, 1, 1, 0);
+
+    ASSERT_TRUE(isPointwiseConvolution(4, 5, 1, 1, 0));
+    convolutionPointwise(input, filter, output);
+    for (int i = 0; i < output.elementCount(); i++)
+    {
+        ASSERT_FLOAT_EQ(expected[i], output[i]);
+    }
+
+    std::vector<int> index{1, 7, 19};
+    Tensor<float> outBuffer;
+    output.fillwith(-1);
+    convolutionPointwiseIndexed(input, index, filter, colBuffer, outBuffer);
+    scatterIndexed(outBuffer.dataAddress(), index, 2, 20, output.dataAddress());
+    for (int c = 0; c < 2; c++)
+    {
+        for (int p : index)
+        {
+            ASSERT_FLOAT_EQ(expected[c * 20 + p], output[c * 20 + p]);
+        }
+    }
+
+    // The whole 5x5 matrix under a 5x5 window: a single output pixel
+    Tensor<float> window(std::vector<int>{1,1,5,5});
+    for (int i = 0; i < window.elementCount(); i++) window[i] = i % 3;
+    Tensor<float> single(std::vector<int>{1,1,1});
+    Tensor<float> singleExpected(std::vector<int>{1,1,1});
+    convolution(matrix, window, singleExpected, 5, 1, 0);
+    ASSERT_TRUE(isPointwiseConvolution(5, 5, 5, 1, 0));
+    convolutionPointwise(matrix, window, single);
+    ASSERT_FLOAT_EQ(singleExpected[0], single[0]);
+}
+
+TEST_F(ConvolutionTest, ConvolutionOfViewMatchesCopy)
+{
+    Tensor<float> input(std::vector<int>{4,9,11});
+    Tensor<float> filter(std::vector<int>{2,3,3,3});
+    for (int i = 0; i < input.elementCount(); i++) input[i] = (i * 7) % 13 - 6;
+    for (int i = 0; i < filter.elementCount(); i++) filter[i] = (i % 5) - 2;
+
+    // Channels 1..3 of a 6x7 window, and the same elements copied out
+    const TensorView<const float> view = TensorView<const float>(input).slice(0, 1, 4).crop(2, 3, 6, 7);
+    Tensor<float> copy(std::vector<int>{3,6,7});
+    for (int c = 0; c < 3; c++)
+        for (int y = 0; y < 6; y++)
+            for (int x = 0; x < 7; x++)
+                copy(c, y, x) = view(c, y, x);
+    ASSERT_EQ(view(2, 5, 6), input(3, 7, 9));
+    ASSERT_FALSE(view.isContiguous());
+
+    // The output goes into channels 1..2 of a larger tensor
+    Tensor<float> expected(std::vector<int>{2,6,7});
+    Tensor<float> output(std::vector<int>{4,6,7});
+    convolutionIm2Col(copy, PackedWeights(filter), colBuffer, expected, 3, 1, 1);
+    convolutionIm2Col(view, PackedWeights(filter), colBuffer, TensorView<float>(output).slice(0, 1, 3), 3, 1, 1);
+    for (int i = 0; i < expected.elementCount(); i++)
+    {
+        ASSERT_FLOAT_EQ(expected[i], output[42 + i]);
+    }
+    for (int i = 0; i < 42; i++)
+    {
+        ASSERT_EQ(output[i], 0.0f);
+    }
+}
+
+TEST_F(ConvolutionTest, WinogradConvolutionMatchesDirect)
+{
+    Tensor<float> expected(std::vector<int>{1,5,5});
+    Tensor<float> output(std::vector<int>{1,5,5});
+    convolution(matrix, weights, expected, 3, 1, 1);
+
+    Tensor<float> transformed, inputBuffer, productBuffer;
+    winogradTransformFilter(weights, transformed);
+    winogradConvolution(matrix, transformed, inputBuffer, productBuffer, output, 1);
+
+    for (int i = 0; i < output.elementCount(); i++)
+    {
+        ASSERT_NEAR(expected[i], output[i], 1e-5);
+    }
+
+    // Only the tile holding (3,3) is computed: rows and columns 2..3
+    BitMask mask(5, 5);
+    mask.set(3, 3);
+    TileMask tiles(2);
+    tiles.build(mask);
+
+    std::vector<int> index;
+    Tensor<float> outBuffer;
+    ASSERT_EQ(buildTileIndex(tiles, 5, 5, index), 4);
+    ASSERT_EQ(winogradConvolutionTiles(matrix, tiles, transformed, inputBuffer, productBuffer, outBuffer, 5, 5, 1), 4);
+    for (int p = 0; p < 4; p++)
+    {
+        ASSERT_NEAR(expected[index[p]], outBuffer[p], 1e-5);
+    }
+}
+
+TEST_F(ConvolutionTest, WinogradFilterFollowsTrainedWeights)
+{
+    Tensor<float> input(std::vector<int>{32,6,6});
+    for (int i = 0; i < input.elementCount(); i++) input[i] = (i * 7) % 13 - 6;
+
+    InputLayer data("data");
+    ConvolutionalLayer conv(std::make_unique<Id>(), 1, 3, 1, 32, 32, "conv");
+    conv.addBottom(&data);
+    data.setInput(input);
+    conv.forwardPropagate();
+    ASSERT_GT(conv.getWinogradFilter().elementCount(), 0);
+
+    // One SGD step; the weights start at zero, so they change everywhere
+    data.setTrainingMode(true);
+    conv.setTrainingMode(true);
+    conv.setSGD(0.01f, 0, 1, 1, 0);
+    data.setInput(input);
+    conv.forwardPropagate();
+    conv.getDelta()->fillwith(1);
+    conv.backwardPropagate();
+    conv.updateParameters();
+
+    data.setTrainingMode(false);
+    conv.setTrainingMode(false);
+    data.setInput(input);
+    conv.forwardPropagate();
+
+    Tensor<float> trained = conv.getWeights();
+    Tensor<float> biases = conv.getBiases();
+    ConvolutionalLayer reference(std::make_unique<Id>(), std::move(trained), std::move(biases), 1, 1, "reference");
+    reference.setWinogradEnabled(false);
+    reference.addBottom(&data);
+    reference.forwardPropagate();
+
+    const Tensor<float> &output = *conv.getOutput();
+    const Tensor<float> &expected = *reference.getOutput();
+    ASSERT_NE(expected[0], 0.0f);
+    for (int i = 0; i < output.elementCount(); i++)
+    {
+        ASSERT_NEAR(expected[i], output[i], 1e-3 * std::abs(expected[i]) + 1e-3);
+    }
+}
+
+TEST_F(ConvolutionTest, TiledConvolutionMatchesDenseInOccupiedTiles)
+{
+    Tensor<float> result(std::vector<int>{1,5,5});
+    convolution(matrix, weights, result, 3, 1, 1);
+
+    BitMask mask(5, 5);
+    mask.set(0, 4);
+    mask.set(3, 1);
+    TileMask tiles(2);
+    tiles.build(mask);
+
+    std::vector<int> index;
+    Tensor<float> outBuffer;
+    Tensor<float> output(std::vector<int>{1,5,5});
+    output.fillwith(-1);
+
+    // Tile (0,2) is clipped to a single column, tile (1,0) is whole
+    const int patches = buildTileIndex(tiles, 5, 5, index);
+    ASSERT_EQ(patches, 6);
+    convolutionIm2ColTiles(matrix, tiles, patches, weights, colBuffer, outBuffer, 5, 5, 3, 1, 1);
+    scatterIndexed(outBuffer.dataAddress(), index, 1, 25, output.dataAddress());
+
+    for (int i = 0; i < 5; i++)
+    {
+        for (int j = 0; j < 5; j++)
+        {
+            if (tiles.occupied(i / 2, j / 2))
+            {
+                ASSERT_FLOAT_EQ(result(0,i,j), output(0,i,j));
+            }
+            else
+            {
+                ASSERT_FLOAT_EQ(-1, output(0,i,j));
+            }
+        }
+    }
+}
 /*
 TEST_F(ConvolutionTest, MultidimensionalSimpleConvolutionGivesRightResultWithFullMask) {
     Tensor<float> input(std::vector<int>{3,1,1});
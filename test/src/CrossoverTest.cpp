@@ -0,0 +1,33 @@
+#include "gtest/gtest.h"
+#include "Crossover.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(CrossoverTest, RecoversFromSlowSparseMeasurements)
+{
+    Crossover crossover;
+    crossover.denseMeasured(1.0);
+    // A sparse pass on 1% of the work that took twice as long as a dense one: never sparse again
+    crossover.sparseMeasured(2.0, 1, 100);
+    ASSERT_LT(crossover.crossoverFill(), 0.01);
+
+    // Dense passes only, as that estimate gives; it has to let a sparse pass be tried eventually
+    int passes = 0;
+    while (crossover.preferDense(0.05) && passes < 1000)
+    {
+        crossover.denseMeasured(1.0);
+        passes++;
+    }
+    ASSERT_LT(passes, 1000);
+
+    // Sparse passes that are cheap after all move the crossover up for good
+    for (int i = 0; i < 20; i++)
+    {
+        crossover.sparseMeasured(0.02, 5, 100);
+    }
+    ASSERT_GT(crossover.crossoverFill(), 0.5);
+}
+
+}
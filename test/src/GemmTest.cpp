@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+#include <random>
+#include "Gemm.hpp"
+#include "ThreadPool.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(GemmTest, SmallGemmMatchesNaive)
+{
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> distr(-1, 1);
+
+    // Row and column counts off the register blocks, depths over one k pass, padded lda
+    const int shapes[][3] = {{1, 1, 1}, {7, 33, 300}, {13, 5, 9}, {64, 40, 576}, {9, 100, 513}};
+    for (auto& shape : shapes)
+    {
+        const int m = shape[0], n = shape[1], k = shape[2];
+        const int lda = k + 3;
+        std::vector<float> a(m * lda), b(k * n), c(m * n, 123.0f);
+        for (auto& x : a) x = distr(gen);
+        for (auto& x : b) x = distr(gen);
+
+        smallGemm(m, n, k, a.data(), lda, b.data(), n, c.data(), n);
+
+        for (int i = 0; i < m; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                double expected = 0;
+                for (int p = 0; p < k; p++)
+                {
+                    expected += a[i * lda + p] * b[p * n + j];
+                }
+                ASSERT_NEAR(c[i * n + j], expected, 1e-4) << m << "x" << n << "x" << k << " at " << i << " " << j;
+            }
+        }
+    }
+}
+
+// op(A) [m x k] * op(B) [k x n], element (i, j)
+double naiveProduct(bool transA, bool transB, int k, const std::vector<float>& a, int lda,
+                    const std::vector<float>& b, int ldb, int i, int j)
+{
+    double sum = 0;
+    for (int p = 0; p < k; p++)
+    {
+        sum += (double)(transA ? a[p * lda + i] : a[i * lda + p]) * (transB ? b[j * ldb + p] : b[p * ldb + j]);
+    }
+    return sum;
+}
+
+TEST(GemmTest, BlasBlocksMatchNaive)
+{
+    // Several threads, so C is split into blocks of columns when wide and of rows when tall
+    ThreadPool::configureGlobal(4, false);
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> distr(-1, 1);
+
+    struct Case { int m, n, k; bool transA, transB; };
+    const Case cases[] = {{7, 1500, 33, false, false}, {5, 1100, 20, false, true},
+                          {100, 20, 50, true, false}, {90, 3, 17, true, true}};
+    for (const Case& t : cases)
+    {
+        const int lda = (t.transA ? t.m : t.k) + 1;
+        const int ldb = (t.transB ? t.k : t.n) + 2;
+        const int ldc = t.n + 3;
+        std::vector<float> a((t.transA ? t.k : t.m) * lda), b((t.transB ? t.n : t.k) * ldb), c(t.m * ldc, 123.0f);
+        for (auto& x : a) x = distr(gen);
+        for (auto& x : b) x = distr(gen);
+
+        blasSgemm(t.transA, t.transB, t.m, t.n, t.k, a.data(), lda, b.data(), ldb, c.data(), ldc);
+
+        for (int i = 0; i < t.m; i++)
+        {
+            for (int j = 0; j < t.n; j++)
+            {
+                ASSERT_NEAR(c[i * ldc + j], naiveProduct(t.transA, t.transB, t.k, a, lda, b, ldb, i, j), 1e-4)
+                        << t.m << "x" << t.n << "x" << t.k << " at " << i << " " << j;
+            }
+        }
+    }
+
+    // sgemm routes these to BLAS: narrower than a panel, and wider than the kernel takes
+    for (int n : {8, 1500})
+    {
+        const int m = 9, k = 40;
+        std::vector<float> a(m * k), b(k * n), c(m * n);
+        for (auto& x : a) x = distr(gen);
+        for (auto& x : b) x = distr(gen);
+        ASSERT_FALSE(smallGemmPreferred(m, n, k));
+
+        sgemm(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+        for (int i = 0; i < m; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                ASSERT_NEAR(c[i * n + j], naiveProduct(false, false, k, a, k, b, n, i, j), 1e-4);
+            }
+        }
+    }
+    ThreadPool::configureGlobal(0, false);
+}
+
+}
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "GraphExecutor.hpp"
+#include "ThreadPool.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+// Records when it ran and checks that its bottoms were done by then
+class RecordingLayer : public Layer
+{
+public:
+    RecordingLayer(std::string name, std::atomic<int>& clock, bool throws = false)
+        :clock(clock), throws(throws)
+    {
+        this->name = name;
+    }
+
+    void forwardPropagate() override
+    {
+        for (Layer *bottom : bottoms)
+        {
+            const int bottomFinished = static_cast<RecordingLayer*>(bottom)->finished;
+            EXPECT_GE(bottomFinished, 0) << name << " ran before " << bottom->getName();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        if (throws)
+        {
+            throw std::runtime_error(name);
+        }
+        runs++;
+        finished = clock++;
+    }
+    void backwardPropagate() override {}
+    Shape getOutputDimensions() override { return Shape{}; }
+
+    std::atomic<int>& clock;
+    bool throws;
+    int runs = 0;
+    std::atomic<int> finished{-1};
+};
+
+// input -> split into three branches of two layers -> merge
+std::vector<std::unique_ptr<Layer>> diamond(std::atomic<int>& clock, int throwing = -1)
+{
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new RecordingLayer("input", clock));
+    for (int branch = 0; branch < 3; branch++)
+    {
+        layers.emplace_back(new RecordingLayer("a" + std::to_string(branch), clock, branch == throwing));
+        layers.back()->addBottom(layers[0].get());
+        layers.emplace_back(new RecordingLayer("b" + std::to_string(branch), clock));
+        layers.back()->addBottom(layers[layers.size() - 2].get());
+    }
+    layers.emplace_back(new RecordingLayer("merge", clock));
+    for (int branch = 0; branch < 3; branch++)
+    {
+        layers.back()->addBottom(layers[2 + 2 * branch].get());
+    }
+    return layers;
+}
+
+TEST(GraphExecutorTest, RunsEveryLayerOnceAfterItsBottoms)
+{
+    ThreadPool::configureGlobal(4, false);
+
+    std::atomic<int> clock(0);
+    auto layers = diamond(clock);
+    GraphExecutor executor(layers);
+
+    for (int pass = 0; pass < 10; pass++)
+    {
+        for (auto& layer : layers)
+        {
+            static_cast<RecordingLayer*>(layer.get())->finished = -1;
+        }
+        executor.forward();
+    }
+
+    for (auto& layer : layers)
+    {
+        ASSERT_EQ(static_cast<RecordingLayer*>(layer.get())->runs, 10);
+    }
+    ASSERT_TRUE(executor.precedes(0, 7));
+    ASSERT_TRUE(executor.precedes(1, 2));
+    ASSERT_FALSE(executor.precedes(1, 4));
+    ASSERT_FALSE(executor.precedes(2, 1));
+
+    ThreadPool::configureGlobal(0, false);
+}
+
+TEST(GraphExecutorTest, ExceptionSkipsConsumersAndIsRethrown)
+{
+    ThreadPool::configureGlobal(4, false);
+
+    std::atomic<int> clock(0);
+    auto layers = diamond(clock, 1);
+    GraphExecutor executor(layers);
+
+    ASSERT_THROW(executor.forward(), std::runtime_error);
+    // The other branches still ran, the failed one and the merge did not
+    ASSERT_EQ(static_cast<RecordingLayer*>(layers[1].get())->runs, 1);
+    ASSERT_EQ(static_cast<RecordingLayer*>(layers[3].get())->runs, 0);
+    ASSERT_EQ(static_cast<RecordingLayer*>(layers[6].get())->runs, 1);
+    ASSERT_EQ(static_cast<RecordingLayer*>(layers[7].get())->runs, 0);
+
+    ThreadPool::configureGlobal(0, false);
+}
+
+}
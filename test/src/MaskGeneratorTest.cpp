@@ -0,0 +1,421 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <random>
+#include "BlockSadDetector.hpp"
+#include "BackgroundSubtractor.hpp"
+#include "MorphologicalFilter.hpp"
+#include "ChangeDetector.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+// Sets the w x h rectangle at (x0, y0) to value in every channel
+void paint(cv::Mat &frame, int x0, int y0, int w, int h, int value)
+{
+    for (int y = y0; y < y0 + h; y++)
+    {
+        std::fill(frame.ptr<uint8_t>(y) + 3 * x0, frame.ptr<uint8_t>(y) + 3 * (x0 + w), value);
+    }
+}
+
+// Frames drifting by a few levels per channel, with a white square jumping along the diagonal,
+// so there are strong, weak and unchanged regions
+cv::Mat nextFrame(const cv::Mat &frame, int index, int maxStep, std::mt19937 &gen)
+{
+    std::uniform_int_distribution<int> step(-maxStep, maxStep);
+    cv::Mat next = frame.clone();
+    for (int y = 0; y < next.rows; y++)
+    {
+        uint8_t *row = next.ptr<uint8_t>(y);
+        for (int i = 0; i < next.cols * 3; i++)
+        {
+            row[i] = std::min(std::max(row[i] + step(gen), 0), 255);
+        }
+    }
+    const int corner = (index * 5) % std::max(std::min(next.rows, next.cols) - 6, 1);
+    paint(next, corner, corner, std::min(6, next.cols), std::min(6, next.rows), 255);
+    return next;
+}
+
+cv::Mat startFrame(int height, int width, std::mt19937 &gen)
+{
+    cv::Mat frame(height, width, CV_8UC3, cv::Scalar(100, 100, 100));
+    std::uniform_int_distribution<int> value(60, 140);
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = frame.ptr<uint8_t>(y);
+        for (int i = 0; i < width * 3; i++)
+        {
+            row[i] = value(gen);
+        }
+    }
+    return frame;
+}
+
+void expectMask(const BitMask &mask, const std::vector<bool> &expected, int width, const std::string &where)
+{
+    ASSERT_EQ((int)expected.size(), mask.height() * mask.width());
+    for (int y = 0; y < mask.height(); y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            ASSERT_EQ(mask.test(y, x), expected[y * width + x]) << where << " at " << y << "," << x;
+        }
+    }
+}
+
+// BlockSadDetector written out pixel by pixel
+class ReferenceBlockSad
+{
+public:
+    ReferenceBlockSad(int threshold, int size, const cv::Mat &first)
+        :high(threshold), size(size), reference(first.clone()),
+          blocksY((first.rows + size - 1) / size), blocksX((first.cols + size - 1) / size),
+          wasMarked(blocksY * blocksX, false)
+    {
+    }
+
+    std::vector<bool> detect(const cv::Mat &frame)
+    {
+        std::vector<long> sad(blocksY * blocksX, 0), area(blocksY * blocksX, 0);
+        for (int y = 0; y < frame.rows; y++)
+        {
+            for (int x = 0; x < frame.cols; x++)
+            {
+                const int b = (y / size) * blocksX + x / size;
+                area[b]++;
+                for (int c = 0; c < 3; c++)
+                {
+                    sad[b] += std::abs(frame.ptr<uint8_t>(y)[3 * x + c] - reference.ptr<uint8_t>(y)[3 * x + c]);
+                }
+            }
+        }
+
+        auto above = [&](int b, int limit) { return sad[b] > (long)limit * area[b]; };
+        std::vector<bool> marked(blocksY * blocksX, false);
+        for (int by = 0; by < blocksY; by++)
+        {
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                const int b = by * blocksX + bx;
+                if (above(b, high))
+                {
+                    marked[b] = true;
+                    continue;
+                }
+                if (!above(b, high / 2))
+                {
+                    continue;
+                }
+                bool strongNeighbour = false;
+                for (int ny = std::max(by - 1, 0); ny <= std::min(by + 1, blocksY - 1); ny++)
+                {
+                    for (int nx = std::max(bx - 1, 0); nx <= std::min(bx + 1, blocksX - 1); nx++)
+                    {
+                        strongNeighbour = strongNeighbour || above(ny * blocksX + nx, high);
+                    }
+                }
+                marked[b] = wasMarked[b] || strongNeighbour;
+                (marked[b] ? weakMarked : weakSkipped)++;
+            }
+        }
+
+        std::vector<bool> result(frame.rows * frame.cols);
+        for (int y = 0; y < frame.rows; y++)
+        {
+            for (int x = 0; x < frame.cols; x++)
+            {
+                if (marked[(y / size) * blocksX + x / size])
+                {
+                    result[y * frame.cols + x] = true;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        reference.ptr<uint8_t>(y)[3 * x + c] = frame.ptr<uint8_t>(y)[3 * x + c];
+                    }
+                }
+            }
+        }
+        wasMarked = marked;
+        return result;
+    }
+
+    int weakMarked = 0;  // between half and the full threshold, marked by the hysteresis
+    int weakSkipped = 0; // between half and the full threshold, left alone
+
+private:
+    int high;
+    int size;
+    cv::Mat reference;
+    int blocksY, blocksX;
+    std::vector<bool> wasMarked;
+};
+
+TEST(MaskGeneratorTest, BlockSadMatchesReference)
+{
+    struct Case { int height, width, blockSize; };
+    int weakMarked = 0, weakSkipped = 0;
+    for (const Case &t : {Case{21, 37, 8}, Case{16, 64, 4}, Case{9, 10, 3}, Case{5, 7, 1}})
+    {
+        std::mt19937 gen(t.width);
+        cv::Mat frame = startFrame(t.height, t.width, gen);
+        BlockSadDetector detector(30, t.blockSize);
+        ReferenceBlockSad reference(30, t.blockSize, frame);
+        ASSERT_EQ(detector.detect(frame).count(), 0);
+
+        for (int f = 0; f < 15; f++)
+        {
+            frame = nextFrame(frame, f, 6, gen);
+            expectMask(detector.detect(frame), reference.detect(frame), t.width,
+                       "width " + std::to_string(t.width) + " frame " + std::to_string(f));
+        }
+        weakMarked += reference.weakMarked;
+        weakSkipped += reference.weakSkipped;
+    }
+    // Both sides of the hysteresis have to come up for the comparison to mean much
+    ASSERT_GT(weakMarked, 0);
+    ASSERT_GT(weakSkipped, 0);
+}
+
+// Three 8 x 8 blocks side by side, each at 100 plus its level in every channel
+cv::Mat blocks(int level0, int level1, int level2)
+{
+    cv::Mat frame(8, 24, CV_8UC3);
+    const int levels[] = {level0, level1, level2};
+    for (int b = 0; b < 3; b++)
+    {
+        paint(frame, 8 * b, 0, 8, 8, 100 + levels[b]);
+    }
+    return frame;
+}
+
+std::vector<bool> markedBlocks(const BitMask &mask)
+{
+    return {mask.test(0, 0), mask.test(0, 8), mask.test(0, 16)};
+}
+
+TEST(MaskGeneratorTest, BlockSadHysteresisAndDrift)
+{
+    // A level of 6 is a difference of 18 per pixel: above half the threshold of 30, not above it
+    BlockSadDetector detector(30, 8);
+    detector.detect(blocks(0, 0, 0));
+
+    // Half the threshold alone marks nothing, but the difference stays
+    ASSERT_EQ(markedBlocks(detector.detect(blocks(6, 0, 6))), (std::vector<bool>{false, false, false}));
+
+    // Block 0 drifted past the threshold; block 1 is next to it, block 2 only next to a weak one
+    ASSERT_EQ(markedBlocks(detector.detect(blocks(12, 6, 6))), (std::vector<bool>{true, true, false}));
+
+    // Block 0 was marked the frame before, so half the threshold keeps it marked; block 1 took
+    // over its frame as the reference and has no difference left
+    ASSERT_EQ(markedBlocks(detector.detect(blocks(18, 6, 6))), (std::vector<bool>{true, false, false}));
+
+    // Block 2 never took over a frame, so it drifted past the threshold on its own
+    ASSERT_EQ(markedBlocks(detector.detect(blocks(18, 6, 11))), (std::vector<bool>{false, false, true}));
+}
+
+// BackgroundSubtractor written out pixel by pixel
+class ReferenceBackground
+{
+public:
+    ReferenceBackground(int threshold, int shift, const cv::Mat &first)
+        :limit(threshold), shift(shift), background(first.rows * first.cols * 3),
+          previous(first.rows * first.cols, false)
+    {
+        for (int y = 0; y < first.rows; y++)
+        {
+            for (int i = 0; i < first.cols * 3; i++)
+            {
+                background[y * first.cols * 3 + i] = first.ptr<uint8_t>(y)[i] * 256;
+            }
+        }
+    }
+
+    std::vector<bool> detect(const cv::Mat &frame)
+    {
+        std::vector<bool> result(frame.rows * frame.cols);
+        for (int y = 0; y < frame.rows; y++)
+        {
+            for (int x = 0; x < frame.cols; x++)
+            {
+                int distance = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    const int pixel = frame.ptr<uint8_t>(y)[3 * x + c] * 256;
+                    int &model = background[(y * frame.cols + x) * 3 + c];
+                    distance += std::abs(pixel - model) / 256;
+                    // Rounding towards minus infinity, as an arithmetic shift does
+                    model += (int)std::floor((pixel - model) / double(1 << shift));
+                }
+                const int p = y * frame.cols + x;
+                const bool foreground = distance > limit;
+                result[p] = foreground || previous[p];
+                leftBehind += !foreground && previous[p];
+                previous[p] = foreground;
+            }
+        }
+        return result;
+    }
+
+    int leftBehind = 0; // marked for the foreground of the frame before only
+
+private:
+    int limit;
+    int shift;
+    std::vector<int> background;
+    std::vector<bool> previous;
+};
+
+TEST(MaskGeneratorTest, BackgroundSubtractorMatchesReference)
+{
+    int leftBehind = 0;
+    for (int shift : {0, 2, 5})
+    {
+        for (int width : {1, 15, 63, 64, 65, 130})
+        {
+            std::mt19937 gen(width * 7 + shift);
+            cv::Mat frame = startFrame(9, width, gen);
+            BackgroundSubtractor detector(30, shift);
+            ReferenceBackground reference(30, shift, frame);
+            ASSERT_EQ(detector.detect(frame).count(), 0);
+
+            for (int f = 0; f < 12; f++)
+            {
+                frame = nextFrame(frame, f, 8, gen);
+                expectMask(detector.detect(frame), reference.detect(frame), width,
+                           "shift " + std::to_string(shift) + " width " + std::to_string(width) +
+                           " frame " + std::to_string(f));
+            }
+            leftBehind += reference.leftBehind;
+        }
+    }
+    ASSERT_GT(leftBehind, 0);
+}
+
+TEST(MaskGeneratorTest, BackgroundSubtractorAbsorbsAConstantChange)
+{
+    // A lighting change of 20 per channel is foreground at first, then learned into the background
+    const cv::Mat dark(4, 70, CV_8UC3, cv::Scalar(100, 100, 100));
+    const cv::Mat light(4, 70, CV_8UC3, cv::Scalar(120, 120, 120));
+    BackgroundSubtractor detector(30, 2);
+    detector.detect(dark);
+
+    ASSERT_EQ(detector.detect(light).howFilled(), 1.0);
+    ASSERT_EQ(detector.foreground().howFilled(), 1.0);
+    int frames = 1;
+    while (detector.foreground().count() > 0 && frames < 20)
+    {
+        detector.detect(light);
+        frames++;
+    }
+    // 60 falls to 45, 33 and 24; the mask keeps the last foreground one frame longer
+    ASSERT_EQ(frames, 4);
+    ASSERT_EQ(detector.mask().howFilled(), 1.0);
+    ASSERT_EQ(detector.detect(light).count(), 0);
+}
+
+// Gives the mask it was made with
+class FixedGenerator : public MaskGenerator
+{
+public:
+    explicit FixedGenerator(const BitMask &next) : next(next) {}
+
+    virtual const BitMask& detect(const cv::Mat&) override { return next; }
+    virtual void setReference(const cv::Mat&) override {}
+    virtual void setThreshold(int) override {}
+    virtual const BitMask& mask() const override { return next; }
+    virtual std::unique_ptr<MaskGenerator> clone() const override { return std::make_unique<FixedGenerator>(next); }
+    virtual std::string name() const override { return "fixed"; }
+
+private:
+    const BitMask &next;
+};
+
+// Any pixel of the (2 * radius + 1) square around (y, x) having the value, outside counting as outside
+bool anyInSquare(const BitMask &mask, int y, int x, int radius, bool value, bool outside)
+{
+    for (int dy = -radius; dy <= radius; dy++)
+    {
+        for (int dx = -radius; dx <= radius; dx++)
+        {
+            const int iy = y + dy, ix = x + dx;
+            const bool inside = iy >= 0 && iy < mask.height() && ix >= 0 && ix < mask.width();
+            if ((inside ? mask.test(iy, ix) : outside) == value)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+TEST(MaskGeneratorTest, MorphologicalFilterOpensThenGrows)
+{
+    std::mt19937 gen(4);
+    std::uniform_real_distribution<double> distr(0, 1);
+    for (int width : {9, 64, 100})
+    {
+        BitMask raw(13, width);
+        for (int y = 0; y < raw.height(); y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                // Solid regions to survive the opening, and specks that don't
+                if ((x / 8 + y / 5) % 3 == 0 || distr(gen) < 0.1)
+                {
+                    raw.set(y, x);
+                }
+            }
+        }
+
+        const int radii[][2] = {{1, 1}, {0, 2}, {2, 0}, {1, 3}};
+        for (auto &r : radii)
+        {
+            const int open = r[0], grow = r[1];
+            MorphologicalFilter filter(std::make_unique<FixedGenerator>(raw), open, grow);
+            const BitMask &cleaned = filter.detect(cv::Mat());
+
+            // Erosion counts pixels past the border as set, dilation as clear
+            BitMask eroded(raw.height(), width);
+            for (int y = 0; y < raw.height(); y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (!anyInSquare(raw, y, x, open, false, true))
+                    {
+                        eroded.set(y, x);
+                    }
+                }
+            }
+            for (int y = 0; y < raw.height(); y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    ASSERT_EQ(cleaned.test(y, x), anyInSquare(eroded, y, x, open + grow, true, false))
+                            << "width " << width << " radii " << open << "," << grow << " at " << y << "," << x;
+                }
+            }
+            ASSERT_GT(cleaned.count(), 0);
+        }
+    }
+}
+
+TEST(MaskGeneratorTest, NamesMakeTheirGenerators)
+{
+    for (const std::string name : {"pixel", "block", "background", "pixel+open", "block+open", "background+open+open"})
+    {
+        auto generator = makeMaskGenerator(name, 40);
+        ASSERT_EQ(generator->name(), name);
+        ASSERT_EQ(generator->clone()->name(), name);
+    }
+    ASSERT_EQ(dynamic_cast<ChangeDetector&>(*makeMaskGenerator("pixel", 40)).threshold(), 40);
+    ASSERT_EQ(dynamic_cast<BlockSadDetector&>(*makeMaskGenerator("block", 40)).threshold(), 40);
+    ASSERT_EQ(dynamic_cast<BackgroundSubtractor&>(*makeMaskGenerator("background", 40)).threshold(), 40);
+
+    for (const std::string name : {"", "+open", "blocks", "open+block", "block+opened", "Block"})
+    {
+        ASSERT_THROW(makeMaskGenerator(name, 40), std::runtime_error) << name;
+    }
+}
+
+}
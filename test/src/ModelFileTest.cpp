@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <unistd.h>
+#include "ModelFile.hpp"
+#include "ConvolutionalLayer.hpp"
+#include "InputLayer.hpp"
+#include "PoolLayer.hpp"
+#include "FullyConnectedLayer.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+Tensor<float> randomTensor(const Shape& dims, std::mt19937& gen)
+{
+    std::normal_distribution<float> distr(0, 0.1f);
+    Tensor<float> result(dims);
+    for (int i = 0; i < result.elementCount(); i++)
+    {
+        result[i] = distr(gen);
+    }
+    return result;
+}
+
+// A Winograd convolution, a transposed one and a fully connected layer, packed as after loading
+std::vector<std::unique_ptr<Layer>> smallNet()
+{
+    std::mt19937 gen(0);
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(new ConvolutionalLayer(std::make_unique<ReLu>(), randomTensor({32, 32, 3, 3}, gen),
+                                               randomTensor({32}, gen), 1, 1, "conv"));
+    layers.emplace_back(new PoolLayer(2, "pool"));
+    layers.emplace_back(new DeconvolutionalLayer(std::make_unique<Id>(), randomTensor({32, 32, 4, 4}, gen),
+                                                 randomTensor({32}, gen), 2, 0, "up"));
+    layers.emplace_back(new FullyConnectedLayer(std::make_unique<Id>(), randomTensor({3, 32 * 12 * 12}, gen),
+                                                randomTensor({3}, gen), "fc"));
+    for (size_t i = 1; i < layers.size(); i++)
+    {
+        layers[i]->addBottom(layers[i - 1].get());
+        layers[i]->packWeights();
+    }
+    return layers;
+}
+
+// A model file path under the test's temporary directory, removed however the test ends
+struct TemporaryModel
+{
+    const std::string path = ::testing::TempDir() + "ModelFileTest." + std::to_string(getpid()) + ".mcnn";
+    ~TemporaryModel() { std::remove(path.c_str()); }
+};
+
+// Overwrites the first stored shape equal to from, which has to be as long as to
+void patchShape(const std::string& path, const std::vector<int32_t>& from, const std::vector<int32_t>& to)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char *pattern = reinterpret_cast<const char*>(from.data());
+    auto found = std::search(bytes.begin(), bytes.end(), pattern, pattern + from.size() * sizeof(int32_t));
+    ASSERT_NE(found, bytes.end());
+    std::memcpy(&*found, to.data(), to.size() * sizeof(int32_t));
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size());
+}
+
+std::vector<float> run(std::vector<std::unique_ptr<Layer>>& layers, const Tensor<float>& input)
+{
+    dynamic_cast<InputLayer*>(layers[0].get())->setInput(input);
+    for (auto& layer : layers)
+    {
+        layer->forwardPropagate();
+    }
+    const Tensor<float>& output = *layers.back()->getOutput();
+    return std::vector<float>(output.dataAddress(), output.dataAddress() + output.elementCount());
+}
+
+TEST(ModelFileTest, LoadedLayersComputeTheSameAndUseTheMapping)
+{
+    const TemporaryModel file;
+    const std::string& path = file.path;
+    auto original = smallNet();
+    ModelFile::save(original, path);
+
+    {
+        ModelFile model(path);
+        auto loaded = model.createLayers();
+        ASSERT_EQ(loaded.size(), original.size());
+        ASSERT_EQ(loaded[3]->getBottoms()[0], loaded[2].get());
+
+        std::mt19937 gen(1);
+        const Tensor<float> input = randomTensor({32, 10, 10}, gen);
+        ASSERT_EQ(run(loaded, input), run(original, input));
+
+        // Weights and packed weights are read where they lie in the file
+        auto *conv = static_cast<ConvolutionalLayer*>(loaded[1].get());
+        for (const float *blob : {conv->getWeights().dataAddress(), conv->getPackedWeights().data(),
+                                  conv->getWinogradFilter().dataAddress(), loaded[4]->getWeights().dataAddress()})
+        {
+            const uint8_t *begin = static_cast<const uint8_t*>(model.data());
+            ASSERT_GE((const uint8_t*)blob, begin);
+            ASSERT_LT((const uint8_t*)blob, begin + model.size());
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(blob) % 64, 0u);
+        }
+    }
+}
+
+TEST(ModelFileTest, PackedWeightsWithoutWinogradFilterGetOne)
+{
+    auto original = smallNet();
+    auto *packed = static_cast<ConvolutionalLayer*>(original[1].get());
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(new ConvolutionalLayer(std::make_unique<ReLu>(), Tensor<float>(packed->getWeights()),
+                                               Tensor<float>(packed->getBiases()), 1, 1, "conv"));
+    layers[1]->addBottom(layers[0].get());
+    auto *conv = static_cast<ConvolutionalLayer*>(layers[1].get());
+    const PackedWeights& weights = packed->getPackedWeights();
+    conv->usePackedWeights(PackedWeights::packedView(weights.data(), weights.rows(), weights.cols(), weights.stride()));
+    ASSERT_EQ(conv->getWinogradFilter(), packed->getWinogradFilter());
+
+    std::mt19937 gen(2);
+    const Tensor<float> input = randomTensor({32, 10, 10}, gen);
+    original.resize(2);
+    ASSERT_EQ(run(layers, input), run(original, input));
+}
+
+TEST(ModelFileTest, CorruptShapesAreRejected)
+{
+    const TemporaryModel file;
+    std::mt19937 gen(3);
+
+    // Biases that don't match the filter
+    {
+        std::vector<std::unique_ptr<Layer>> layers;
+        layers.emplace_back(new InputLayer("data"));
+        layers.emplace_back(new ConvolutionalLayer(std::make_unique<ReLu>(), randomTensor({8, 3, 3, 3}, gen),
+                                                   Tensor<float>(), 1, 1, "conv"));
+        layers[1]->addBottom(layers[0].get());
+        ModelFile::save(layers, file.path);
+        ASSERT_THROW(ModelFile(file.path).createLayers(), std::runtime_error);
+    }
+
+    ModelFile::save(smallNet(), file.path);
+    ASSERT_NO_THROW(ModelFile(file.path).createLayers());
+
+    const std::vector<int32_t> filterShape = {4, 32, 32, 3, 3};
+    const std::vector<int32_t> fcShape = {2, 3, 32 * 12 * 12};
+    const std::vector<std::pair<std::vector<int32_t>, std::vector<int32_t>>> patches = {
+        {filterShape, {4, 32, -32, 3, 3}},
+        // 3 * 1431655766 wraps around to 2 in 32 bits
+        {fcShape, {2, 3, 1431655766}},
+        // Not the shape the packed weights were made from
+        {filterShape, {4, 32, 16, 3, 3}}};
+    for (const auto& patch : patches)
+    {
+        ModelFile::save(smallNet(), file.path);
+        patchShape(file.path, patch.first, patch.second);
+        ASSERT_THROW(ModelFile(file.path).createLayers(), std::runtime_error) << patch.second[2];
+    }
+}
+
+}
@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+#include <random>
+#include "Network.hpp"
+#include "EltwiseLayer.hpp"
+#include "MaskGenerator.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+Tensor<float> randomTensor(const Shape& dims, std::mt19937& gen)
+{
+    std::normal_distribution<float> distr(0, 0.3f);
+    Tensor<float> result(dims);
+    for (int i = 0; i < result.elementCount(); i++)
+    {
+        result[i] = distr(gen);
+    }
+    return result;
+}
+
+// A chain with two branches summed in the middle, so buffers can be shared along the chain but
+// not between the branches
+std::vector<std::unique_ptr<Layer>> branchedNet()
+{
+    std::mt19937 gen(0);
+    auto conv = [&](int in, int out, std::string name)
+    {
+        return new ConvolutionalLayer(std::make_unique<ReLu>(), randomTensor({out, in, 3, 3}, gen),
+                                      randomTensor({out}, gen), 1, 1, name);
+    };
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(conv(3, 8, "conv1"));
+    layers.emplace_back(conv(8, 8, "conv2"));
+    layers.emplace_back(conv(8, 8, "left"));
+    layers.emplace_back(conv(8, 8, "right"));
+    layers.emplace_back(new EltwiseLayer("sum"));
+    layers.emplace_back(conv(8, 8, "conv3"));
+    layers.emplace_back(conv(8, 4, "conv4"));
+    const int bottoms[][2] = {{-1, -1}, {0, -1}, {1, -1}, {2, -1}, {2, -1}, {3, 4}, {5, -1}, {6, -1}};
+    for (size_t i = 1; i < layers.size(); i++)
+    {
+        for (int b : bottoms[i])
+        {
+            if (b >= 0)
+            {
+                layers[i]->addBottom(layers[b].get());
+            }
+        }
+    }
+    return layers;
+}
+
+std::vector<float> outputOf(Layer& layer)
+{
+    const Tensor<float>& output = *layer.getOutput();
+    return std::vector<float>(output.dataAddress(), output.dataAddress() + output.elementCount());
+}
+
+// The same layers run one after another, each with an output of its own
+std::vector<float> unplanned(const Tensor<float>& input)
+{
+    auto layers = branchedNet();
+    dynamic_cast<InputLayer*>(layers[0].get())->setInput(input);
+    for (auto& layer : layers)
+    {
+        layer->forwardPropagate();
+    }
+    return outputOf(*layers.back());
+}
+
+TEST(NetworkTest, MemoryPlanKeepsOutputsAndSharesBuffers)
+{
+    std::mt19937 gen(1);
+    const Tensor<float> first = randomTensor({3, 12, 16}, gen);
+    const Tensor<float> second = randomTensor({3, 12, 16}, gen);
+    Tensor<float> fullMask({12, 16});
+    fullMask.fillwith(1);
+
+    auto layers = branchedNet();
+    Layer& last = *layers.back();
+    Network net(std::move(layers), 0);
+
+    // Masked inference keeps every output
+    net.setMaskEnabled(true);
+    net.infer(first, fullMask);
+    const size_t ownBytes = net.outputBytes();
+    ASSERT_EQ(outputOf(last), unplanned(first));
+
+    // The plan is made after this frame; its results have to survive the move into shared buffers
+    net.setMaskEnabled(false);
+    net.infer(second, fullMask);
+    ASSERT_EQ(outputOf(last), unplanned(second));
+    ASSERT_LT(net.outputBytes(), ownBytes);
+
+    net.infer(first, fullMask);
+    ASSERT_EQ(outputOf(last), unplanned(first));
+}
+
+// Counts the frames it is given
+class CountingGenerator : public MaskGenerator
+{
+public:
+    explicit CountingGenerator(int &detects) : detects(detects) {}
+
+    virtual const BitMask& detect(const cv::Mat &frame) override
+    {
+        detects++;
+        return inner.detect(frame);
+    }
+    virtual void setReference(const cv::Mat &frame) override { inner.setReference(frame); }
+    virtual void setThreshold(int threshold) override { inner.setThreshold(threshold); }
+    virtual const BitMask& mask() const override { return inner.mask(); }
+    virtual std::unique_ptr<MaskGenerator> clone() const override { return std::make_unique<CountingGenerator>(detects); }
+    virtual std::string name() const override { return "counting"; }
+
+private:
+    int &detects;
+    ChangeDetector inner;
+};
+
+TEST(NetworkTest, StreamGeneratorsOutliveDefaultChangesAndSmallerBatches)
+{
+    // A 1x1 convolution, padded by the 8 pixels the class maps are cropped by
+    std::mt19937 gen(2);
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(new ConvolutionalLayer(std::make_unique<Id>(), randomTensor({2, 3, 1, 1}, gen),
+                                               randomTensor({2}, gen), 1, 8, "score"));
+    layers[1]->addBottom(layers[0].get());
+    Network net(std::move(layers), 0);
+
+    int detects = 0;
+    net.setMaskGenerator(2, std::make_unique<CountingGenerator>(detects));
+    const cv::Mat frame(6, 10, CV_8UC3, cv::Scalar(10, 20, 30));
+
+    // Stream 2 isn't part of this batch, nor is the new default meant for it
+    net.forwardBatch({frame, frame});
+    net.setMaskGenerator(makeMaskGenerator("block", 30));
+    ASSERT_EQ(detects, 0);
+
+    net.forwardBatch({frame, frame, frame});
+    net.forwardBatch({frame, frame, cv::Mat()});
+    net.forwardBatch({frame, frame, frame});
+    ASSERT_EQ(detects, 2);
+}
+
+}
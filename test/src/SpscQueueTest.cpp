@@ -0,0 +1,57 @@
+#include "gtest/gtest.h"
+#include <thread>
+#include "SpscQueue.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(SpscQueueTest, HoldsCapacityItems)
+{
+    SpscQueue<int> queue(3);
+    ASSERT_TRUE(queue.tryPush(1));
+    ASSERT_TRUE(queue.tryPush(2));
+    ASSERT_TRUE(queue.tryPush(3));
+    ASSERT_FALSE(queue.tryPush(4));
+
+    int item;
+    ASSERT_TRUE(queue.tryPop(item));
+    ASSERT_EQ(item, 1);
+    ASSERT_TRUE(queue.tryPush(4));
+    for (int expected = 2; expected <= 4; expected++)
+    {
+        ASSERT_TRUE(queue.tryPop(item));
+        ASSERT_EQ(item, expected);
+    }
+    ASSERT_FALSE(queue.tryPop(item));
+}
+
+TEST(SpscQueueTest, PassesItemsInOrderBetweenThreads)
+{
+    constexpr int count = 100000;
+    SpscQueue<int> queue(7);
+
+    std::thread producer([&]
+    {
+        for (int i = 0; i < count; i++)
+        {
+            while (!queue.tryPush(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    for (int expected = 0; expected < count; expected++)
+    {
+        int item;
+        while (!queue.tryPop(item))
+        {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(item, expected);
+    }
+    producer.join();
+}
+
+}
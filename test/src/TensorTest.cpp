@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+#include <cstdint>
+#include "Tensor.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(TensorTest, StorageIsAlignedAndReusedOnShrink)
+{
+    Tensor<float> t(std::vector<int>{3, 17, 5});
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(t.dataAddress()) % TensorAllocator::alignment, 0u);
+
+    const float *storage = t.dataAddress();
+    t.resize({2, 10});
+    ASSERT_EQ(t.dataAddress(), storage);
+    ASSERT_EQ(t.capacity(), 3 * 17 * 5);
+    for (int i = 0; i < t.elementCount(); i++)
+    {
+        ASSERT_EQ(t[i], 0.0f);
+    }
+}
+
+TEST(TensorTest, PoolServesRepeatedFramesWithoutSystemAllocations)
+{
+    PoolAllocator pool;
+    TensorAllocator& previous = TensorAllocator::current();
+    TensorAllocator::setCurrent(pool);
+    {
+        Tensor<float> kept;
+        for (int frame = 0; frame < 10; frame++)
+        {
+            // A per-frame temporary moved into a long-lived tensor, as Network::forward does
+            Tensor<float> temporary(std::vector<int>{3, 40, 60}, uninitialized{});
+            Tensor<float> other(std::vector<int>{40, 60});
+            kept = std::move(temporary);
+            if (frame == 1)
+            {
+                ASSERT_EQ(pool.systemAllocations(), 3u);
+            }
+        }
+        ASSERT_EQ(pool.systemAllocations(), 3u);
+    }
+    TensorAllocator::setCurrent(previous);
+}
+
+TEST(TensorTest, MoveAssignmentTakesOverStorage)
+{
+    Tensor<float> a(std::vector<int>{4, 4});
+    a(1, 2) = 5;
+    const float *storage = a.dataAddress();
+
+    Tensor<float> b(std::vector<int>{2});
+    b = std::move(a);
+    ASSERT_EQ(b.dataAddress(), storage);
+    ASSERT_EQ(b(1, 2), 5.0f);
+    ASSERT_EQ(a.position(), DataPosition::UNDEFINED);
+    ASSERT_EQ(a.elementCount(), 0);
+}
+
+TEST(TensorTest, ShapeKeepsStridesAndElementCount)
+{
+    const Shape shape{2, 3, 4, 5};
+    ASSERT_EQ(shape.size(), 4);
+    ASSERT_EQ(shape.elementCount(), 120);
+    ASSERT_EQ(shape.stride(0), 60);
+    ASSERT_EQ(shape.stride(2), 5);
+    ASSERT_EQ(shape.stride(3), 1);
+    ASSERT_EQ(Shape().elementCount(), 0);
+    ASSERT_TRUE(shape == Shape(std::vector<int>{2, 3, 4, 5}));
+    ASSERT_TRUE(shape != Shape({2, 3, 4}));
+
+    Tensor<float> t(shape);
+    t(1, 2, 3, 4) = 7;
+    ASSERT_EQ(t[119], 7.0f);
+    t.reshape({6, 4, 5});
+    ASSERT_EQ(t(5, 3, 4), 7.0f);
+}
+
+}
@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include <atomic>
+#include "ThreadPool.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(ThreadPoolTest, ParallelForVisitsEveryIndexOnce)
+{
+    ThreadPool pool(4);
+    std::vector<std::atomic<int>> visits(1000);
+
+    for (int repeat = 0; repeat < 50; repeat++)
+    {
+        pool.parallelFor(visits.size(), [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                visits[i]++;
+            }
+        });
+    }
+
+    for (const auto& v : visits)
+    {
+        ASSERT_EQ(v.load(), 50);
+    }
+}
+
+TEST(ThreadPoolTest, NestedParallelForRunsInline)
+{
+    ThreadPool pool(4);
+    std::atomic<int> sum(0);
+
+    pool.parallelFor(16, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            pool.parallelFor(10, [&](int innerBegin, int innerEnd)
+            {
+                sum += innerEnd - innerBegin;
+            });
+        }
+    });
+
+    ASSERT_EQ(sum.load(), 160);
+}
+
+}
@@ -0,0 +1,236 @@
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+#include "VideoPipeline.hpp"
+#include "MaskGenerator.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+// Class 0 where blue outweighs red, else 1. Padded by the 8 pixels the class map is cropped by.
+std::unique_ptr<Network> colorNet()
+{
+    Tensor<float> weights(Shape{2, 3, 1, 1});
+    weights(0, 0, 0, 0) = 1;
+    weights(1, 2, 0, 0) = 1;
+    Tensor<float> biases(Shape{2});
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.emplace_back(new InputLayer("data"));
+    layers.emplace_back(new ConvolutionalLayer(std::make_unique<Id>(), std::move(weights), std::move(biases), 1, 8, "score"));
+    layers[1]->addBottom(layers[0].get());
+    auto net = std::make_unique<Network>(std::move(layers), 0);
+    net->setMaskEnabled(true);
+    return net;
+}
+
+// Blue (class 0) or red (class 1), numbered in the green channel of its first pixel
+cv::Mat numberedFrame(int index, int cls)
+{
+    cv::Mat frame(6, 10, CV_8UC3, cls == 0 ? cv::Scalar(255, 0, 0) : cv::Scalar(0, 0, 255));
+    frame.at<cv::Vec3b>(0, 0)[1] = index;
+    return frame;
+}
+
+// Frames of the given classes, optionally throwing instead of giving frame failAt
+struct Clip
+{
+    std::vector<int> classes;
+    int failAt = -1;
+    std::atomic<int> calls{0};
+
+    VideoPipeline::Source source()
+    {
+        return [this](cv::Mat& frame)
+        {
+            const int index = calls++;
+            if (index == failAt)
+            {
+                throw std::runtime_error("source failed");
+            }
+            if (index >= (int)classes.size())
+            {
+                return false;
+            }
+            numberedFrame(index, classes[index]).copyTo(frame);
+            return true;
+        };
+    }
+};
+
+// Frame numbers in the order the sink got them, and whether every pixel had the class of its frame
+struct Received
+{
+    std::vector<int> frames;
+    bool classesRight = true;
+
+    VideoPipeline::Sink sink(const Clip& clip)
+    {
+        return [this, &clip](const cv::Mat& frame, const Tensor<float>& classes)
+        {
+            const int index = frame.at<cv::Vec3b>(0, 0)[1];
+            frames.push_back(index);
+            EXPECT_EQ(classes.elementCount(), frame.rows * frame.cols);
+            for (int i = 0; i < classes.elementCount(); i++)
+            {
+                classesRight = classesRight && classes[i] == clip.classes[index];
+            }
+        };
+    }
+};
+
+std::vector<int> upTo(int count)
+{
+    std::vector<int> result(count);
+    for (int i = 0; i < count; i++)
+    {
+        result[i] = i;
+    }
+    return result;
+}
+
+TEST(VideoPipelineTest, DeliversEveryFrameInOrderUntilTheSourceEnds)
+{
+    auto net = colorNet();
+    VideoPipeline pipeline(*net, 30, 3);
+
+    Clip clip;
+    for (int i = 0; i < 20; i++)
+    {
+        clip.classes.push_back((i / 3) % 2);
+    }
+    Received received;
+    pipeline.run(clip.source(), received.sink(clip));
+
+    ASSERT_EQ(received.frames, upTo(20));
+    ASSERT_TRUE(received.classesRight);
+    // The source isn't asked again after it ended the clip
+    ASSERT_EQ(clip.calls, 21);
+
+    const auto stats = pipeline.stageStats();
+    const char *names[] = {"decode", "mask", "convert", "infer", "output"};
+    ASSERT_EQ(stats.size(), 5u);
+    for (size_t s = 0; s < stats.size(); s++)
+    {
+        ASSERT_EQ(stats[s].name, names[s]);
+        ASSERT_EQ(stats[s].frames, 20u);
+    }
+    ASSERT_GT(pipeline.meanLatencySeconds(), 0);
+}
+
+TEST(VideoPipelineTest, ANewClipShowsNothingOfTheLastOne)
+{
+    auto net = colorNet();
+    VideoPipeline pipeline(*net, 30);
+
+    Clip red;
+    red.classes = {1, 1, 1};
+    Received first;
+    pipeline.run(red.source(), first.sink(red));
+    ASSERT_TRUE(first.classesRight);
+
+    // The same pipeline, whose generator would otherwise still have the red frame as its reference
+    Clip blue;
+    blue.classes = {0, 0, 0};
+    Received second;
+    pipeline.run(blue.source(), second.sink(blue));
+    ASSERT_EQ(second.frames, upTo(3));
+    ASSERT_TRUE(second.classesRight);
+
+    // Another pipeline on the network, whose first, empty mask would keep the blue outputs
+    VideoPipeline other(*net, 30);
+    Clip redAgain;
+    redAgain.classes = {1, 1, 1};
+    Received third;
+    other.run(redAgain.source(), third.sink(redAgain));
+    ASSERT_TRUE(third.classesRight);
+}
+
+// Logs how many frames it, not its clones, had seen before each frame
+class LoggingGenerator : public MaskGenerator
+{
+public:
+    explicit LoggingGenerator(std::vector<int> &log) : log(log) {}
+
+    virtual const BitMask& detect(const cv::Mat &frame) override
+    {
+        log.push_back(seen++);
+        return inner.detect(frame);
+    }
+    virtual void setReference(const cv::Mat &frame) override { inner.setReference(frame); }
+    virtual void setThreshold(int threshold) override { inner.setThreshold(threshold); }
+    virtual const BitMask& mask() const override { return inner.mask(); }
+    virtual std::unique_ptr<MaskGenerator> clone() const override { return std::make_unique<LoggingGenerator>(log); }
+    virtual std::string name() const override { return "logging"; }
+
+private:
+    std::vector<int> &log;
+    int seen = 0;
+    ChangeDetector inner;
+};
+
+TEST(VideoPipelineTest, EveryClipStartsWithoutTheGeneratorsState)
+{
+    auto net = colorNet();
+    std::vector<int> log;
+    VideoPipeline pipeline(*net, std::make_unique<LoggingGenerator>(log));
+
+    for (int run = 0; run < 2; run++)
+    {
+        Clip clip;
+        clip.classes = {0, 1};
+        Received received;
+        pipeline.run(clip.source(), received.sink(clip));
+    }
+    ASSERT_EQ(log, (std::vector<int>{0, 1, 0, 1}));
+}
+
+TEST(VideoPipelineTest, StageFailuresAreRethrownOnceAllStagesStopped)
+{
+    auto net = colorNet();
+    VideoPipeline pipeline(*net, 30, 2);
+
+    Clip clip;
+    clip.classes = std::vector<int>(10, 1);
+    clip.failAt = 5;
+    Received received;
+    try
+    {
+        pipeline.run(clip.source(), received.sink(clip));
+        FAIL() << "The source's exception was not rethrown";
+    }
+    catch (const std::runtime_error& e)
+    {
+        ASSERT_EQ(std::string(e.what()), "source failed");
+    }
+    // Frames before the failure may or may not have reached the sink, but in order
+    ASSERT_EQ(received.frames, upTo(received.frames.size()));
+    ASSERT_LE(received.frames.size(), 5u);
+
+    // A failing sink: nothing runs once run() has returned
+    Clip more;
+    more.classes = std::vector<int>(50, 0);
+    int sinkCalls = 0;
+    ASSERT_THROW(pipeline.run(more.source(), [&](const cv::Mat&, const Tensor<float>&)
+    {
+        if (++sinkCalls == 3)
+        {
+            throw std::runtime_error("sink failed");
+        }
+    }), std::runtime_error);
+    const int calls = more.calls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(more.calls, calls);
+    ASSERT_EQ(sinkCalls, 3);
+
+    // The pipeline is usable again
+    Clip after;
+    after.classes = {0, 1, 0, 1};
+    Received ok;
+    pipeline.run(after.source(), ok.sink(after));
+    ASSERT_EQ(ok.frames, upTo(4));
+    ASSERT_TRUE(ok.classesRight);
+}
+
+}
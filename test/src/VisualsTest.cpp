@@ -0,0 +1,52 @@
+#include "gtest/gtest.h"
+#include "Visuals.hpp"
+
+using namespace MaskedCNN;
+
+namespace {
+
+TEST(VisualsTest, BgrToTensorMatchesScalarConversion)
+{
+    const float mean[3] = {104.0f, 116.5f, 122.7f};
+    const float scale = 0.017f;
+    const int rows = 3;
+
+    for (int width : {1, 15, 16, 17, 33})
+    {
+        // A window of a wider image, so rows are not contiguous
+        cv::Mat image(rows + 2, width + 7, CV_8UC3);
+        for (int y = 0; y < image.rows; y++)
+        {
+            for (int i = 0; i < image.cols * 3; i++)
+            {
+                image.ptr<uchar>(y)[i] = (y * 131 + i * 37) % 256;
+            }
+        }
+        const cv::Mat window = image(cv::Rect(5, 1, width, rows));
+        ASSERT_FALSE(window.isContinuous());
+
+        // Into the interior of a larger tensor, whose rows aren't contiguous either
+        Tensor<float> storage(Shape{3, rows + 1, width + 2});
+        storage.fillwith(-1);
+        bgrToTensor(window, TensorView<float>(storage).crop(1, 1, rows, width), mean, scale);
+
+        for (int c = 0; c < 3; c++)
+        {
+            for (int y = 0; y <= rows; y++)
+            {
+                for (int x = 0; x < width + 2; x++)
+                {
+                    if (y == 0 || x == 0 || x == width + 1)
+                    {
+                        ASSERT_EQ(storage(c, y, x), -1.0f);
+                        continue;
+                    }
+                    const float expected = (window.ptr<uchar>(y - 1)[3 * (x - 1) + c] - mean[c]) * scale;
+                    ASSERT_NEAR(storage(c, y, x), expected, 1e-5f) << "width " << width << " at " << c << "," << y << "," << x;
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,31 @@
+#include "NetworkLoader.hpp"
+#include "ModelFile.hpp"
+#include <iostream>
+
+using namespace MaskedCNN;
+
+// Converts a Caffe model into the .mcnn format, which Network maps instead of parsing
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <model.caffemodel> <model.mcnn>" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        auto layers = loadCaffeNet(argv[1]);
+        ModelFile::save(layers, argv[2]);
+
+        // Read back, so a file that can't be loaded is noticed here
+        ModelFile model(argv[2]);
+        std::cout << model.createLayers().size() << " layers, " << model.size() << " bytes written to " << argv[2] << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}